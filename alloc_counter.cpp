@@ -0,0 +1,71 @@
+#include "alloc_counter.h"
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+static thread_local uint64_t allocations = 0;
+
+uint64_t threadAllocations() {
+    return allocations;
+}
+
+void AllocationCheck::end() {
+    uint64_t count = threadAllocations() - start;
+    bool warming = frame < warmupFrames || frame <= quietUntil;
+    frame++;
+    if (warming || count == 0) return;
+    total += count;
+    if (fatal) {
+        fprintf(stderr, "%llu heap allocation(s) inside frame %llu\n", (unsigned long long)count,
+                (unsigned long long)(frame - 1));
+        abort();
+    }
+}
+
+// Replacements for every global operator new, counting on the way to malloc
+static void* countedAlloc(size_t size, size_t align) {
+    allocations++;
+    if (size == 0) size = 1;
+    while (true) {
+        void* p = align > alignof(std::max_align_t) ? aligned_alloc(align, (size + align - 1) / align * align) : malloc(size);
+        if (p) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+static void* countedAllocNoThrow(size_t size, size_t align) noexcept {
+    try {
+        return countedAlloc(size, align);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new(size_t size) { return countedAlloc(size, 0); }
+void* operator new[](size_t size) { return countedAlloc(size, 0); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAllocNoThrow(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAllocNoThrow(size, 0); }
+void* operator new(size_t size, std::align_val_t align) { return countedAlloc(size, (size_t)align); }
+void* operator new[](size_t size, std::align_val_t align) { return countedAlloc(size, (size_t)align); }
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return countedAllocNoThrow(size, (size_t)align);
+}
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return countedAllocNoThrow(size, (size_t)align);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { free(p); }
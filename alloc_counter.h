@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocations made by the calling thread so far. Counting comes from the
+// global operator new replacements in alloc_counter.cpp, which are linked into
+// any program that calls this. C code (GLFW, the GL driver) uses malloc and
+// isn't counted
+uint64_t threadAllocations();
+
+// Guard around a frame loop body: begin() at the top of the frame, end() at
+// the bottom. Once warmupFrames have gone by, any allocation in between is
+// counted, and with `fatal` set the first one aborts with the frame number
+class AllocationCheck {
+public:
+    uint64_t warmupFrames = 120; // buffers and caches settle during these
+    bool fatal = false;
+
+    void begin() { start = threadAllocations(); }
+    void end();
+    // Something rare and expected is about to allocate (a buffer growing, a
+    // config reload): this frame and the next warmupFrames don't count
+    void rewarm() { quietUntil = frame + warmupFrames; }
+
+    uint64_t allocations() const { return total; } // after warm-up
+    uint64_t frames() const { return frame; }
+
+private:
+    uint64_t start = 0, frame = 0, total = 0;
+    uint64_t quietUntil = 0;
+};
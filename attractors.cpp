@@ -0,0 +1,527 @@
+#include "attractors.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+const float AttractorField::gridCell = 2.0f;
+const float AttractorField::exactRadius = 16.0f;
+// Where a lookup (eight gathers, plus the direct sum for misses) got cheaper
+// than the AVX-512 sum in orbit_bench, holes scattered over the disk
+const size_t AttractorField::gridMinBodies = 24;
+
+Vec2 Attractor::positionAt(double t) const {
+    if (!moving()) return { x, y };
+    double angle = phase + angularSpeed * t;
+    return { x + orbitRadius * (float)cos(angle), y + orbitRadius * (float)sin(angle) };
+}
+
+bool parseAttractor(const char* spec, Attractor& attractor) {
+    Attractor a;
+    float period = 0.0f;
+    int got = sscanf(spec, "%f:%f:%f:%f:%f:%f", &a.x, &a.y, &a.mass, &a.orbitRadius, &period, &a.phase);
+    if (got < 3 || got == 4 || !(a.mass > 0.0f)) return false;
+    if (got >= 5) {
+        if (a.orbitRadius < 0.0f || period == 0.0f) return false;
+        a.angularSpeed = 6.2831853f / period;
+    }
+    attractor = a;
+    return true;
+}
+
+bool parseBinary(const char* spec, vector<Attractor>& out) {
+    float separation = 0.0f, q = 1.0f;
+    if (sscanf(spec, "%f:%f", &separation, &q) < 1 || !(separation > 0.0f) || !(q > 0.0f && q <= 1.0f)) return false;
+    // each hole circles the common centre of mass, the lighter one further out
+    float m1 = M / (1.0f + q), m2 = M - m1;
+    float omega = sqrt(G * M / (separation * separation * separation));
+    Attractor a, b;
+    a.mass = m1;
+    a.orbitRadius = separation * m2 / M;
+    a.angularSpeed = omega;
+    b.mass = m2;
+    b.orbitRadius = separation * m1 / M;
+    b.angularSpeed = omega;
+    b.phase = 3.14159265f;
+    out.push_back(a);
+    out.push_back(b);
+    return true;
+}
+
+bool parseHalo(const char* spec, ExternalField& field) {
+    float speed = 0.0f, core = field.haloCore;
+    if (sscanf(spec, "%f:%f", &speed, &core) < 1 || speed < 0.0f || !(core > 0.0f)) return false;
+    field.haloSpeed = speed;
+    field.haloCore = core;
+    return true;
+}
+
+bool parseFieldGrid(const char* name, FieldGrid& mode) {
+    if (strcmp(name, "auto") == 0) mode = FieldGrid::Auto;
+    else if (strcmp(name, "on") == 0) mode = FieldGrid::On;
+    else if (strcmp(name, "off") == 0) mode = FieldGrid::Off;
+    else return false;
+    return true;
+}
+
+bool parseUniformField(const char* spec, ExternalField& field) {
+    return sscanf(spec, "%f:%f", &field.uniformX, &field.uniformY) == 2;
+}
+
+namespace {
+
+// Point mass sums over n points: the same softening as CentralForce, one
+// loop over the holes per register of particles
+typedef void (*SumKernel)(const float* bx, const float* by, const float* bgm, size_t k,
+                          const float* x, const float* y, float* ax, float* ay, size_t n);
+
+void sumScalar(const float* bx, const float* by, const float* bgm, size_t k,
+               const float* x, const float* y, float* ax, float* ay, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        float sx = 0.0f, sy = 0.0f;
+        for (size_t j = 0; j < k; ++j) {
+            float dx = x[i] - bx[j], dy = y[i] - by[j];
+            float r2 = dx*dx + dy*dy;
+            float r = max(sqrt(r2), 5.0f); // prevent singularity
+            float f = bgm[j] / (r2 * r);
+            sx -= f * dx;
+            sy -= f * dy;
+        }
+        ax[i] = sx;
+        ay[i] = sy;
+    }
+}
+
+// rsqrt plus one Newton-Raphson step and 1/r <= 0.2 for the clamp, like the step kernels in physics.cpp
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2,fma")))
+inline __m256 rsqrtAVX2(__m256 x) {
+    __m256 y = _mm256_rsqrt_ps(x);
+    __m256 hx = _mm256_mul_ps(x, _mm256_set1_ps(0.5f));
+    return _mm256_mul_ps(y, _mm256_fnmadd_ps(hx, _mm256_mul_ps(y, y), _mm256_set1_ps(1.5f)));
+}
+
+__attribute__((target("avx2,fma")))
+void sumAVX2(const float* bx, const float* by, const float* bgm, size_t k,
+             const float* x, const float* y, float* ax, float* ay, size_t n) {
+    const __m256 invSoft = _mm256_set1_ps(1.0f / 5.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i);
+        __m256 sx = _mm256_setzero_ps(), sy = _mm256_setzero_ps();
+        for (size_t j = 0; j < k; ++j) {
+            __m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(bx[j]));
+            __m256 dy = _mm256_sub_ps(py, _mm256_set1_ps(by[j]));
+            __m256 invR = rsqrtAVX2(_mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy)));
+            __m256 f = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(bgm[j]), _mm256_mul_ps(invR, invR)),
+                                     _mm256_min_ps(invR, invSoft));
+            sx = _mm256_fnmadd_ps(f, dx, sx);
+            sy = _mm256_fnmadd_ps(f, dy, sy);
+        }
+        _mm256_storeu_ps(ax + i, sx);
+        _mm256_storeu_ps(ay + i, sy);
+    }
+    sumScalar(bx, by, bgm, k, x + i, y + i, ax + i, ay + i, n - i);
+}
+
+// GCC 12 warns about the _mm512_undefined_ps() passthrough inside its own intrinsic headers
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+inline __m512 rsqrtAVX512(__m512 x) {
+    __m512 y = _mm512_rsqrt14_ps(x);
+    __m512 hx = _mm512_mul_ps(x, _mm512_set1_ps(0.5f));
+    return _mm512_mul_ps(y, _mm512_fnmadd_ps(hx, _mm512_mul_ps(y, y), _mm512_set1_ps(1.5f)));
+}
+
+__attribute__((target("avx512f")))
+void sumAVX512(const float* bx, const float* by, const float* bgm, size_t k,
+               const float* x, const float* y, float* ax, float* ay, size_t n) {
+    const __m512 invSoft = _mm512_set1_ps(1.0f / 5.0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 px = _mm512_loadu_ps(x + i), py = _mm512_loadu_ps(y + i);
+        __m512 sx = _mm512_setzero_ps(), sy = _mm512_setzero_ps();
+        for (size_t j = 0; j < k; ++j) {
+            __m512 dx = _mm512_sub_ps(px, _mm512_set1_ps(bx[j]));
+            __m512 dy = _mm512_sub_ps(py, _mm512_set1_ps(by[j]));
+            __m512 invR = rsqrtAVX512(_mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy)));
+            __m512 f = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(bgm[j]), _mm512_mul_ps(invR, invR)),
+                                     _mm512_min_ps(invR, invSoft));
+            sx = _mm512_fnmadd_ps(f, dx, sx);
+            sy = _mm512_fnmadd_ps(f, dy, sy);
+        }
+        _mm512_storeu_ps(ax + i, sx);
+        _mm512_storeu_ps(ay + i, sy);
+    }
+    sumScalar(bx, by, bgm, k, x + i, y + i, ax + i, ay + i, n - i);
+}
+
+#pragma GCC diagnostic pop
+
+#elif defined(__ARM_NEON)
+
+inline float32x4_t rsqrtNEON(float32x4_t x) {
+    float32x4_t y = vrsqrteq_f32(x);
+    y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(x, y), y)); // estimate is only ~8 bits,
+    y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(x, y), y)); // so refine twice
+    return y;
+}
+
+void sumNEON(const float* bx, const float* by, const float* bgm, size_t k,
+             const float* x, const float* y, float* ax, float* ay, size_t n) {
+    const float32x4_t invSoft = vdupq_n_f32(1.0f / 5.0f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t px = vld1q_f32(x + i), py = vld1q_f32(y + i);
+        float32x4_t sx = vdupq_n_f32(0.0f), sy = vdupq_n_f32(0.0f);
+        for (size_t j = 0; j < k; ++j) {
+            float32x4_t dx = vsubq_f32(px, vdupq_n_f32(bx[j]));
+            float32x4_t dy = vsubq_f32(py, vdupq_n_f32(by[j]));
+            float32x4_t invR = rsqrtNEON(vmlaq_f32(vmulq_f32(dy, dy), dx, dx));
+            float32x4_t f = vmulq_f32(vmulq_f32(vdupq_n_f32(bgm[j]), vmulq_f32(invR, invR)), vminq_f32(invR, invSoft));
+            sx = vmlsq_f32(sx, f, dx);
+            sy = vmlsq_f32(sy, f, dy);
+        }
+        vst1q_f32(ax + i, sx);
+        vst1q_f32(ay + i, sy);
+    }
+    sumScalar(bx, by, bgm, k, x + i, y + i, ax + i, ay + i, n - i);
+}
+
+#endif
+
+SumKernel selectSumKernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return sumAVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return sumAVX2;
+#elif defined(__ARM_NEON)
+    return sumNEON;
+#endif
+    return sumScalar;
+}
+
+// Halo and uniform field on top of whatever is in ax, ay
+void addExternal(const ExternalField& e, const float* x, const float* y, float* ax, float* ay, size_t n) {
+    if (e.haloSpeed > 0.0f) {
+        // potential v0^2/2 ln(r^2 + rc^2)
+        float v2 = e.haloSpeed * e.haloSpeed, core2 = e.haloCore * e.haloCore;
+        for (size_t i = 0; i < n; ++i) {
+            float dx = x[i] - centerX, dy = y[i] - centerY;
+            float f = v2 / (dx*dx + dy*dy + core2);
+            ax[i] -= f * dx;
+            ay[i] -= f * dy;
+        }
+    }
+    if (e.uniformX != 0.0f || e.uniformY != 0.0f) {
+        for (size_t i = 0; i < n; ++i) {
+            ax[i] += e.uniformX;
+            ay[i] += e.uniformY;
+        }
+    }
+}
+
+// What the grid lookups need, samples as x, y pairs row by row
+struct SampleGrid {
+    const float* data;
+    int columns, rows;
+    float minX, minY;
+};
+
+// Bilinear lookup at one point, false off the grid or next to a hole
+inline bool sampleOne(const SampleGrid& g, float x, float y, float& ax, float& ay) {
+    float fx = (x - g.minX) * (1.0f / AttractorField::gridCell), fy = (y - g.minY) * (1.0f / AttractorField::gridCell);
+    // written so NaN positions fail it too
+    if (!(fx >= 0.0f && fy >= 0.0f && fx < (float)(g.columns - 1) && fy < (float)(g.rows - 1))) return false;
+    int ix = (int)fx, iy = (int)fy;
+    float tx = fx - (float)ix, ty = fy - (float)iy;
+    const float* below = g.data + 2 * ((size_t)iy * g.columns + ix);
+    const float* above = below + 2 * g.columns;
+    float w00 = (1.0f - tx) * (1.0f - ty), w10 = tx * (1.0f - ty), w01 = (1.0f - tx) * ty, w11 = tx * ty;
+    ax = below[0] * w00 + below[2] * w10 + above[0] * w01 + above[2] * w11;
+    ay = below[1] * w00 + below[3] * w10 + above[1] * w01 + above[3] * w11;
+    return ax == ax; // a NaN corner means the cell is too close to a hole
+}
+
+// Look up n points, appending the ones the grid can't answer to `missed`.
+// Returns how many that was
+typedef size_t (*LookupKernel)(const SampleGrid& g, const float* x, const float* y, float* ax, float* ay,
+                               size_t n, uint32_t* missed);
+
+size_t lookupScalar(const SampleGrid& g, const float* x, const float* y, float* ax, float* ay,
+                    size_t n, uint32_t* missed) {
+    size_t misses = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (!sampleOne(g, x[i], y[i], ax[i], ay[i])) missed[misses++] = (uint32_t)i;
+    }
+    return misses;
+}
+
+// The vector lookups gather the four corners of every lane's cell. Lanes off
+// the grid read cell 0 and are thrown away with the misses
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2,fma")))
+size_t lookupAVX2(const SampleGrid& g, const float* x, const float* y, float* ax, float* ay,
+                  size_t n, uint32_t* missed) {
+    const __m256 minX = _mm256_set1_ps(g.minX), minY = _mm256_set1_ps(g.minY);
+    const __m256 invCell = _mm256_set1_ps(1.0f / AttractorField::gridCell);
+    const __m256 lastX = _mm256_set1_ps((float)(g.columns - 1)), lastY = _mm256_set1_ps((float)(g.rows - 1));
+    const __m256i rowStride = _mm256_set1_epi32(2 * g.columns), one = _mm256_set1_epi32(1);
+    const __m256i two = _mm256_set1_epi32(2), three = _mm256_set1_epi32(3);
+    const __m256 ones = _mm256_set1_ps(1.0f);
+    size_t misses = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 fx = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(x + i), minX), invCell);
+        __m256 fy = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(y + i), minY), invCell);
+        __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(fx, _mm256_setzero_ps(), _CMP_GE_OQ),
+                                                    _mm256_cmp_ps(fy, _mm256_setzero_ps(), _CMP_GE_OQ)),
+                                      _mm256_and_ps(_mm256_cmp_ps(fx, lastX, _CMP_LT_OQ),
+                                                    _mm256_cmp_ps(fy, lastY, _CMP_LT_OQ)));
+        fx = _mm256_and_ps(fx, inside);
+        fy = _mm256_and_ps(fy, inside);
+        __m256 cellX = _mm256_floor_ps(fx), cellY = _mm256_floor_ps(fy);
+        __m256 tx = _mm256_sub_ps(fx, cellX), ty = _mm256_sub_ps(fy, cellY);
+        __m256i below = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(cellY), rowStride),
+                                         _mm256_slli_epi32(_mm256_cvttps_epi32(cellX), 1));
+        __m256i above = _mm256_add_epi32(below, rowStride);
+        __m256 x00 = _mm256_i32gather_ps(g.data, below, 4), y00 = _mm256_i32gather_ps(g.data, _mm256_add_epi32(below, one), 4);
+        __m256 x10 = _mm256_i32gather_ps(g.data, _mm256_add_epi32(below, two), 4);
+        __m256 y10 = _mm256_i32gather_ps(g.data, _mm256_add_epi32(below, three), 4);
+        __m256 x01 = _mm256_i32gather_ps(g.data, above, 4), y01 = _mm256_i32gather_ps(g.data, _mm256_add_epi32(above, one), 4);
+        __m256 x11 = _mm256_i32gather_ps(g.data, _mm256_add_epi32(above, two), 4);
+        __m256 y11 = _mm256_i32gather_ps(g.data, _mm256_add_epi32(above, three), 4);
+        // lerp along x on both rows, then between the rows
+        __m256 sx = _mm256_sub_ps(ones, tx), sy = _mm256_sub_ps(ones, ty);
+        __m256 bottomX = _mm256_fmadd_ps(x10, tx, _mm256_mul_ps(x00, sx)), topX = _mm256_fmadd_ps(x11, tx, _mm256_mul_ps(x01, sx));
+        __m256 bottomY = _mm256_fmadd_ps(y10, tx, _mm256_mul_ps(y00, sx)), topY = _mm256_fmadd_ps(y11, tx, _mm256_mul_ps(y01, sx));
+        __m256 accX = _mm256_fmadd_ps(topX, ty, _mm256_mul_ps(bottomX, sy));
+        __m256 accY = _mm256_fmadd_ps(topY, ty, _mm256_mul_ps(bottomY, sy));
+        _mm256_storeu_ps(ax + i, accX);
+        _mm256_storeu_ps(ay + i, accY);
+        __m256 hit = _mm256_and_ps(inside, _mm256_cmp_ps(accX, accX, _CMP_ORD_Q));
+        for (unsigned m = ~(unsigned)_mm256_movemask_ps(hit) & 0xffu; m; m &= m - 1) {
+            missed[misses++] = (uint32_t)(i + __builtin_ctz(m));
+        }
+    }
+    for (; i < n; ++i) {
+        if (!sampleOne(g, x[i], y[i], ax[i], ay[i])) missed[misses++] = (uint32_t)i;
+    }
+    return misses;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+size_t lookupAVX512(const SampleGrid& g, const float* x, const float* y, float* ax, float* ay,
+                    size_t n, uint32_t* missed) {
+    const __m512 minX = _mm512_set1_ps(g.minX), minY = _mm512_set1_ps(g.minY);
+    const __m512 invCell = _mm512_set1_ps(1.0f / AttractorField::gridCell);
+    const __m512 lastX = _mm512_set1_ps((float)(g.columns - 1)), lastY = _mm512_set1_ps((float)(g.rows - 1));
+    const __m512i rowStride = _mm512_set1_epi32(2 * g.columns), one = _mm512_set1_epi32(1);
+    const __m512i two = _mm512_set1_epi32(2), three = _mm512_set1_epi32(3);
+    const __m512 ones = _mm512_set1_ps(1.0f);
+    size_t misses = 0, i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 fx = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(x + i), minX), invCell);
+        __m512 fy = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(y + i), minY), invCell);
+        __mmask16 inside = _mm512_cmp_ps_mask(fx, _mm512_setzero_ps(), _CMP_GE_OQ) &
+                           _mm512_cmp_ps_mask(fy, _mm512_setzero_ps(), _CMP_GE_OQ) &
+                           _mm512_cmp_ps_mask(fx, lastX, _CMP_LT_OQ) & _mm512_cmp_ps_mask(fy, lastY, _CMP_LT_OQ);
+        fx = _mm512_maskz_mov_ps(inside, fx);
+        fy = _mm512_maskz_mov_ps(inside, fy);
+        __m512 cellX = _mm512_roundscale_ps(fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512 cellY = _mm512_roundscale_ps(fy, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512 tx = _mm512_sub_ps(fx, cellX), ty = _mm512_sub_ps(fy, cellY);
+        __m512i below = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_cvttps_epi32(cellY), rowStride),
+                                         _mm512_slli_epi32(_mm512_cvttps_epi32(cellX), 1));
+        __m512i above = _mm512_add_epi32(below, rowStride);
+        __m512 x00 = _mm512_i32gather_ps(below, g.data, 4), y00 = _mm512_i32gather_ps(_mm512_add_epi32(below, one), g.data, 4);
+        __m512 x10 = _mm512_i32gather_ps(_mm512_add_epi32(below, two), g.data, 4);
+        __m512 y10 = _mm512_i32gather_ps(_mm512_add_epi32(below, three), g.data, 4);
+        __m512 x01 = _mm512_i32gather_ps(above, g.data, 4), y01 = _mm512_i32gather_ps(_mm512_add_epi32(above, one), g.data, 4);
+        __m512 x11 = _mm512_i32gather_ps(_mm512_add_epi32(above, two), g.data, 4);
+        __m512 y11 = _mm512_i32gather_ps(_mm512_add_epi32(above, three), g.data, 4);
+        __m512 sx = _mm512_sub_ps(ones, tx), sy = _mm512_sub_ps(ones, ty);
+        __m512 bottomX = _mm512_fmadd_ps(x10, tx, _mm512_mul_ps(x00, sx)), topX = _mm512_fmadd_ps(x11, tx, _mm512_mul_ps(x01, sx));
+        __m512 bottomY = _mm512_fmadd_ps(y10, tx, _mm512_mul_ps(y00, sx)), topY = _mm512_fmadd_ps(y11, tx, _mm512_mul_ps(y01, sx));
+        __m512 accX = _mm512_fmadd_ps(topX, ty, _mm512_mul_ps(bottomX, sy));
+        __m512 accY = _mm512_fmadd_ps(topY, ty, _mm512_mul_ps(bottomY, sy));
+        _mm512_storeu_ps(ax + i, accX);
+        _mm512_storeu_ps(ay + i, accY);
+        __mmask16 hit = inside & _mm512_cmp_ps_mask(accX, accX, _CMP_ORD_Q);
+        for (unsigned m = ~(unsigned)hit & 0xffffu; m; m &= m - 1) {
+            missed[misses++] = (uint32_t)(i + __builtin_ctz(m));
+        }
+    }
+    for (; i < n; ++i) {
+        if (!sampleOne(g, x[i], y[i], ax[i], ay[i])) missed[misses++] = (uint32_t)i;
+    }
+    return misses;
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+LookupKernel selectLookupKernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return lookupAVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return lookupAVX2;
+#endif
+    return lookupScalar;
+}
+
+} // namespace
+
+bool AttractorField::moving() const {
+    for (const Attractor& a : bodies) {
+        if (a.moving()) return true;
+    }
+    return false;
+}
+
+bool AttractorField::usesGrid() const {
+    if (gridMode == FieldGrid::Off || moving()) return false;
+    return gridMode == FieldGrid::On || max<size_t>(bodies.size(), 1) >= gridMinBodies;
+}
+
+void AttractorField::positionsAt(double t, vector<Vec2>& out) const {
+    out.clear();
+    if (bodies.empty()) out.push_back(Attractor().positionAt(t));
+    for (const Attractor& a : bodies) out.push_back(a.positionAt(t));
+}
+
+void AttractorField::setTime(double t, float G, ThreadPool* pool) {
+    if (bodies.empty()) scene.assign(1, Attractor());
+    else scene = bodies;
+    size_t k = scene.size();
+    bx.resize(k);
+    by.resize(k);
+    bgm.resize(k);
+    for (size_t j = 0; j < k; ++j) {
+        Vec2 p = scene[j].positionAt(t);
+        bx[j] = p.x;
+        by[j] = p.y;
+        bgm[j] = G * scene[j].mass;
+    }
+
+    if (!usesGrid()) {
+        grid.clear();
+    } else if (grid.empty() || G != cachedG) {
+        buildGrid(pool);
+    }
+    cachedG = G;
+}
+
+void AttractorField::exactAt(float x, float y, float& ax, float& ay) const {
+    sumScalar(bx.data(), by.data(), bgm.data(), bx.size(), &x, &y, &ax, &ay, 1);
+    addExternal(external, &x, &y, &ax, &ay, 1);
+}
+
+float AttractorField::nearestHole(float x, float y) const {
+    float best2 = INFINITY;
+    for (size_t j = 0; j < bx.size(); ++j) {
+        float dx = x - bx[j], dy = y - by[j];
+        best2 = min(best2, dx * dx + dy * dy);
+    }
+    return sqrt(best2);
+}
+
+double AttractorField::potentialAt(float x, float y) const {
+    double phi = 0.0;
+    for (size_t j = 0; j < bx.size(); ++j) {
+        double dx = (double)x - bx[j], dy = (double)y - by[j];
+        phi -= bgm[j] / max(sqrt(dx * dx + dy * dy), 5.0);
+    }
+    const ExternalField& e = external;
+    double dx = (double)x - centerX, dy = (double)y - centerY;
+    if (e.haloSpeed > 0.0f) phi += 0.5 * e.haloSpeed * e.haloSpeed * log(dx * dx + dy * dy + e.haloCore * e.haloCore);
+    return phi - e.uniformX * x - e.uniformY * y;
+}
+
+void AttractorField::accelerationAt(float x, float y, float& ax, float& ay) const {
+    SampleGrid g = { (const float*)grid.data(), columns, rows, area.minX, area.minY };
+    if (!grid.empty() && sampleOne(g, x, y, ax, ay)) return;
+    exactAt(x, y, ax, ay);
+}
+
+void AttractorField::accelerations(const float* x, const float* y, float* ax, float* ay, size_t n) const {
+    static const SumKernel sum = selectSumKernel();
+    if (grid.empty()) {
+        sum(bx.data(), by.data(), bgm.data(), bx.size(), x, y, ax, ay, n);
+        addExternal(external, x, y, ax, ay, n);
+        return;
+    }
+
+    // Grid first, whatever it can't answer is gathered up and summed directly
+    // as one batch, so the misses still go through the SIMD kernel
+    static const LookupKernel lookup = selectLookupKernel();
+    SampleGrid g = { (const float*)grid.data(), columns, rows, area.minX, area.minY };
+    const size_t batch = 2048;
+    float missX[batch], missY[batch], missAx[batch], missAy[batch];
+    uint32_t missed[batch];
+    for (size_t begin = 0; begin < n; begin += batch) {
+        size_t count = min(batch, n - begin);
+        size_t misses = lookup(g, x + begin, y + begin, ax + begin, ay + begin, count, missed);
+        if (misses == 0) continue;
+        for (size_t m = 0; m < misses; ++m) {
+            missX[m] = x[begin + missed[m]];
+            missY[m] = y[begin + missed[m]];
+        }
+        sum(bx.data(), by.data(), bgm.data(), bx.size(), missX, missY, missAx, missAy, misses);
+        addExternal(external, missX, missY, missAx, missAy, misses);
+        for (size_t m = 0; m < misses; ++m) {
+            ax[begin + missed[m]] = missAx[m];
+            ay[begin + missed[m]] = missAy[m];
+        }
+    }
+}
+
+void AttractorField::buildGrid(ThreadPool* pool) {
+    // same area UniformGrid covers by default, the screen plus a screen of margin
+    area = { -(float)width, -(float)height, 2.0f * width, 2.0f * height };
+    columns = (int)ceil((area.maxX - area.minX) / gridCell) + 1;
+    rows = (int)ceil((area.maxY - area.minY) / gridCell) + 1;
+    grid.assign((size_t)columns * rows, { 0.0f, 0.0f });
+
+    static const SumKernel sum = selectSumKernel();
+    auto sampleRows = [&](size_t begin, size_t end) {
+        vector<float> x(columns), y(columns), ax(columns), ay(columns);
+        for (int c = 0; c < columns; ++c) x[c] = area.minX + c * gridCell;
+        for (size_t r = begin; r < end; ++r) {
+            fill(y.begin(), y.end(), area.minY + r * gridCell);
+            sum(bx.data(), by.data(), bgm.data(), bx.size(), x.data(), y.data(), ax.data(), ay.data(), columns);
+            addExternal(external, x.data(), y.data(), ax.data(), ay.data(), columns);
+            Vec2* row = &grid[r * columns];
+            for (int c = 0; c < columns; ++c) row[c] = { ax[c], ay[c] };
+        }
+    };
+    if (pool) pool->parallelFor(rows, 32, sampleRows);
+    else sampleRows(0, rows);
+
+    // Hand the cells around every hole back to the direct sum
+    const float nan = nanf("");
+    int reach = (int)ceil(exactRadius / gridCell);
+    for (size_t j = 0; j < bx.size(); ++j) {
+        int cx = (int)floor((bx[j] - area.minX) / gridCell), cy = (int)floor((by[j] - area.minY) / gridCell);
+        for (int r = max(0, cy - reach); r <= min(rows - 1, cy + reach + 1); ++r) {
+            for (int c = max(0, cx - reach); c <= min(columns - 1, cx + reach + 1); ++c) {
+                grid[(size_t)r * columns + c] = { nan, nan };
+            }
+        }
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "physics.h"
+#include "spatial_grid.h"
+
+class ThreadPool;
+
+// One point mass. Static ones sit at (x, y). Moving ones go round (x, y) on a
+// circle of orbitRadius, so where they are is a pure function of simulated
+// time: nothing to integrate, nothing to checkpoint, a resumed run finds them
+// in the same place
+struct Attractor {
+    float x = centerX, y = centerY;
+    float mass = M;
+    float orbitRadius = 0.0f;
+    float angularSpeed = 0.0f; // rad per unit of simulated time, negative is clockwise
+    float phase = 0.0f;
+
+    bool moving() const { return orbitRadius != 0.0f && angularSpeed != 0.0f; }
+    Vec2 positionAt(double t) const;
+};
+
+// Potentials that aren't point masses, the halo is centred on the screen
+struct ExternalField {
+    float haloSpeed = 0.0f;   // logarithmic halo with a flat rotation curve at this speed, 0 = none
+    float haloCore = 100.0f;  // radius the halo flattens out inside
+    float uniformX = 0.0f, uniformY = 0.0f; // same acceleration everywhere
+};
+
+// "X:Y:MASS[:RADIUS:PERIOD[:PHASE]]", a negative period goes clockwise
+bool parseAttractor(const char* spec, Attractor& attractor);
+// "SEP[:Q]": two holes of total mass M on a circular Kepler orbit about the
+// centre, SEP apart with mass ratio Q = m2 / m1 in (0, 1]. Appends both
+bool parseBinary(const char* spec, std::vector<Attractor>& out);
+// "V0[:CORE]"
+bool parseHalo(const char* spec, ExternalField& field);
+// "AX:AY"
+bool parseUniformField(const char* spec, ExternalField& field);
+
+// When AttractorField samples its field onto a grid
+enum class FieldGrid {
+    Auto, // static scenes with at least gridMinBodies holes, below that the SIMD sum is cheaper
+    On,   // every static scene
+    Off,
+};
+
+// "auto", "on" or "off"
+bool parseFieldGrid(const char* name, FieldGrid& mode);
+
+// Every attractor plus the external field, the ForceModel::Attractors scene.
+// setTime() puts the holes where they are at the start of a step and the
+// force kernels read that. When nothing moves the whole field is sampled once
+// onto a grid and looked up bilinearly, which costs about the same for 1 hole or 50.
+// Cells close to a hole, where bilinear can't follow 1/r^2, and anything off
+// the grid fall back to the direct sum. Moving holes always use the direct
+// sum, vectorised across particles
+class AttractorField {
+public:
+    std::vector<Attractor> bodies; // empty = one hole of mass M at the centre
+    ExternalField external;
+    FieldGrid gridMode = FieldGrid::Auto;
+
+    static const float gridCell;    // px between samples
+    static const float exactRadius; // px around a hole the grid hands back to the direct sum
+    static const size_t gridMinBodies;
+
+    // Holes to their positions at t and G*m for G. Samples the grid the first
+    // time a static scene gets here, on the pool when there is one
+    void setTime(double t, float G, ThreadPool* pool = nullptr);
+
+    // Acceleration at a point: grid when it can, direct sum when it can't
+    void accelerationAt(float x, float y, float& ax, float& ay) const;
+    // Always the direct sum
+    void exactAt(float x, float y, float& ax, float& ay) const;
+    // Distance to the closest hole this step, block timesteps size levels by it
+    float nearestHole(float x, float y) const;
+    // Potential per unit mass, the direct sum plus the external field
+    double potentialAt(float x, float y) const;
+    // n points at once, the direct sum goes through the widest SIMD the CPU has
+    void accelerations(const float* x, const float* y, float* ax, float* ay, size_t n) const;
+
+    bool moving() const;
+    // Whether setTime() will build and use the grid for this scene
+    bool usesGrid() const;
+    bool cached() const { return !grid.empty(); }
+    size_t size() const { return bx.size(); }
+    // Where every hole is at t, for drawing them
+    void positionsAt(double t, std::vector<Vec2>& out) const;
+
+private:
+    void buildGrid(ThreadPool* pool);
+
+    std::vector<Attractor> scene;       // bodies, or the default hole
+    std::vector<float> bx, by, bgm;     // where each hole is this step, G * mass
+    float cachedG = 0.0f;
+
+    // Samples on the corners of gridCell squares over the UniformGrid area,
+    // NaN inside exactRadius of a hole
+    std::vector<Vec2> grid;
+    Rect area = { 0.0f, 0.0f, 0.0f, 0.0f };
+    int columns = 0, rows = 0;          // samples per row, rows of samples
+};
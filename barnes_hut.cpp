@@ -0,0 +1,210 @@
+#include "barnes_hut.h"
+#include "physics.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <numeric>
+
+using namespace std;
+
+static const int topDepth = 2;             // 4^2 = 16 subtrees built in parallel
+static const int maxDepth = 32;            // stop splitting coincident particles
+
+void BarnesHutTree::partition(uint32_t begin, uint32_t end, float cx, float cy, uint32_t split[5]) {
+    uint32_t* o = order.data();
+    const float* x = px;
+    const float* y = py;
+    // quadrant q has bit 0 set for x >= cx and bit 1 for y >= cy
+    uint32_t midY = (uint32_t)(std::partition(o + begin, o + end, [&](uint32_t i) { return y[i] < cy; }) - o);
+    uint32_t lowX = (uint32_t)(std::partition(o + begin, o + midY, [&](uint32_t i) { return x[i] < cx; }) - o);
+    uint32_t highX = (uint32_t)(std::partition(o + midY, o + end, [&](uint32_t i) { return x[i] < cx; }) - o);
+    split[0] = begin;
+    split[1] = lowX;
+    split[2] = midY;
+    split[3] = highX;
+    split[4] = end;
+}
+
+void BarnesHutTree::summarise(Node& node, const vector<Node>& pool) {
+    float m = 0.0f, mx = 0.0f, my = 0.0f;
+    if (node.leaf) {
+        for (uint32_t k = node.begin; k < node.end; ++k) {
+            mx += px[order[k]];
+            my += py[order[k]];
+        }
+        m = (node.end - node.begin) * mass;
+        mx *= mass;
+        my *= mass;
+    } else {
+        for (int32_t c : node.child) {
+            if (c < 0) continue;
+            m += pool[c].mass;
+            mx += pool[c].mass * pool[c].comX;
+            my += pool[c].mass * pool[c].comY;
+        }
+    }
+    node.mass = m;
+    node.comX = m > 0.0f ? mx / m : node.cx;
+    node.comY = m > 0.0f ? my / m : node.cy;
+}
+
+int32_t BarnesHutTree::buildNode(vector<Node>& out, uint32_t begin, uint32_t end,
+                                 float cx, float cy, float half, int depth) {
+    int32_t index = (int32_t)out.size();
+    out.push_back({ cx, cy, half, 0.0f, 0.0f, 0.0f, { -1, -1, -1, -1 }, begin, end, true });
+
+    if (end - begin > leafSize && depth < maxDepth) {
+        out[index].leaf = false;
+        uint32_t split[5];
+        partition(begin, end, cx, cy, split);
+        float h = half * 0.5f;
+        for (int q = 0; q < 4; ++q) {
+            if (split[q] == split[q + 1]) continue;
+            int32_t c = buildNode(out, split[q], split[q + 1], cx + ((q & 1) ? h : -h), cy + ((q & 2) ? h : -h), h, depth + 1);
+            out[index].child[q] = c;
+        }
+    }
+    summarise(out[index], out);
+    return index;
+}
+
+void BarnesHutTree::splitTop(uint32_t begin, uint32_t end, float cx, float cy, float half, int depth,
+                             int32_t parent, int quadrant) {
+    if (begin == end) return;
+    if (depth == topDepth || end - begin <= leafSize) {
+        subtrees.push_back({ parent, quadrant, begin, end, cx, cy, half });
+        return;
+    }
+
+    int32_t index = (int32_t)nodes.size();
+    nodes.push_back({ cx, cy, half, 0.0f, 0.0f, 0.0f, { -1, -1, -1, -1 }, begin, end, false });
+    if (parent >= 0) nodes[parent].child[quadrant] = index;
+
+    uint32_t split[5];
+    partition(begin, end, cx, cy, split);
+    float h = half * 0.5f;
+    for (int q = 0; q < 4; ++q) {
+        splitTop(split[q], split[q + 1], cx + ((q & 1) ? h : -h), cy + ((q & 2) ? h : -h), h, depth + 1, index, q);
+    }
+}
+
+void BarnesHutTree::build(const float* posX, const float* posY, size_t n, float particleMass, ThreadPool& pool) {
+    px = posX;
+    py = posY;
+    mass = particleMass;
+    nodes.clear();
+    subtrees.clear();
+    if (n == 0) return;
+
+    // Keep last step's order when the particle count hasn't changed: particles
+    // barely move between steps so it is already almost fully partitioned
+    if (order.size() != n) {
+        order.resize(n);
+        iota(order.begin(), order.end(), 0u);
+    }
+
+    // Bounding square, reduced per chunk so the result doesn't depend on scheduling
+    size_t numChunks = (n + physicsChunkSize - 1) / physicsChunkSize;
+    chunkBounds.resize(numChunks * 4);
+    pool.parallelFor(n, physicsChunkSize, [&](size_t begin, size_t end) {
+        float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+        for (size_t i = begin; i < end; ++i) {
+            minX = min(minX, posX[i]); maxX = max(maxX, posX[i]);
+            minY = min(minY, posY[i]); maxY = max(maxY, posY[i]);
+        }
+        float* b = &chunkBounds[begin / physicsChunkSize * 4];
+        b[0] = minX; b[1] = minY; b[2] = maxX; b[3] = maxY;
+    });
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    for (size_t c = 0; c < numChunks; ++c) {
+        minX = min(minX, chunkBounds[4*c]); minY = min(minY, chunkBounds[4*c+1]);
+        maxX = max(maxX, chunkBounds[4*c+2]); maxY = max(maxY, chunkBounds[4*c+3]);
+    }
+    float half = max(maxX - minX, maxY - minY) * 0.5f * 1.001f + 1e-3f;
+
+    // Top levels serially, then every subtree below them in parallel
+    splitTop(0, (uint32_t)n, (minX + maxX) * 0.5f, (minY + maxY) * 0.5f, half, 0, -1, 0);
+
+    if (subtreeNodes.size() < subtrees.size()) subtreeNodes.resize(subtrees.size());
+    pool.parallelFor(subtrees.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t s = begin; s < end; ++s) {
+            const Subtree& st = subtrees[s];
+            subtreeNodes[s].clear();
+            buildNode(subtreeNodes[s], st.begin, st.end, st.cx, st.cy, st.half, topDepth);
+        }
+    });
+
+    // Splice the subtrees in after the top nodes, shifting their child links
+    size_t topCount = nodes.size();
+    for (size_t s = 0; s < subtrees.size(); ++s) {
+        int32_t offset = (int32_t)nodes.size();
+        for (Node node : subtreeNodes[s]) {
+            for (int32_t& c : node.child) if (c >= 0) c += offset;
+            nodes.push_back(node);
+        }
+        if (subtrees[s].parent >= 0) nodes[subtrees[s].parent].child[subtrees[s].quadrant] = offset;
+    }
+    // Top nodes were created parents first, so walking back summarises children first
+    for (size_t i = topCount; i-- > 0;) summarise(nodes[i], nodes);
+
+    // Leaf sums read positions in tree order so each leaf is one contiguous run
+    sortedX.resize(n);
+    sortedY.resize(n);
+    rank.resize(n);
+    pool.parallelFor(n, physicsChunkSize, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            sortedX[k] = posX[order[k]];
+            sortedY[k] = posY[order[k]];
+            rank[order[k]] = (uint32_t)k;
+        }
+    });
+}
+
+void BarnesHutTree::accelerationAt(float x, float y, uint32_t self, float G, const NBodyParams& params,
+                                   float& ax, float& ay) const {
+    ax = ay = 0.0f;
+    if (nodes.empty()) return;
+    uint32_t skip = self < rank.size() ? rank[self] : noParticle;
+    float theta2 = params.theta * params.theta;
+    float eps2 = params.softening * params.softening;
+    float gm = G * mass;
+
+    int32_t stack[4 * maxDepth + 4];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        const Node& node = nodes[stack[--sp]];
+        float dx = node.comX - x, dy = node.comY - y;
+        float d2 = dx*dx + dy*dy;
+
+        if (4.0f * node.half * node.half < theta2 * d2) {
+            // far enough away: treat the whole cell as one mass at its centre of mass
+            float r2 = d2 + eps2;
+            float f = G * node.mass / (r2 * sqrt(r2));
+            ax += f * dx;
+            ay += f * dy;
+        } else if (node.leaf) {
+            for (uint32_t k = node.begin; k < node.end; ++k) {
+                if (k == skip) continue;
+                float ex = sortedX[k] - x, ey = sortedY[k] - y;
+                float r2 = ex*ex + ey*ey + eps2;
+                float f = gm / (r2 * sqrt(r2));
+                ax += f * ex;
+                ay += f * ey;
+            }
+        } else {
+            for (int32_t c : node.child) if (c >= 0) stack[sp++] = c;
+        }
+    }
+}
+
+void BarnesHutTree::accumulate(const float* posX, const float* posY, float* accX, float* accY,
+                               size_t begin, size_t end, float G, const NBodyParams& params) const {
+    for (size_t i = begin; i < end; ++i) {
+        float ax, ay;
+        accelerationAt(posX[i], posY[i], (uint32_t)i, G, params, ax, ay);
+        accX[i] += ax;
+        accY[i] += ay;
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Total mass of the disk in N-body mode when not given, shared evenly between particles
+const float defaultDiskMass = 200.0f;
+
+// Self-gravity settings for N-body mode, every particle has the same mass
+struct NBodyParams {
+    float particleMass = 0.0f;
+    float theta = 0.5f;        // opening angle, larger is faster and less accurate
+    float softening = 2.0f;    // Plummer softening length in px
+};
+
+// Barnes-Hut quadtree over a particle set.
+//
+// build() sorts particle indices into cells by recursive in-place partitioning
+// (leaves hold up to leafSize particles). The index order is kept between steps,
+// so a rebuild mostly walks already-partitioned data. The top two levels are
+// split serially and the 16 subtrees below them are built in parallel, then
+// spliced into one node pool. All node and index storage is reused between
+// builds, so steady-state rebuilds don't touch the heap
+class BarnesHutTree {
+public:
+    static const uint32_t leafSize = 8;
+    static const size_t walkChunkSize = 256; // walks cost far more than a plain step, so balance finer
+    static const uint32_t noParticle = UINT32_MAX;
+
+    void build(const float* posX, const float* posY, size_t n, float particleMass, ThreadPool& pool);
+
+    // Self-gravity of the whole tree at (x, y). Only reads the tree's own copy of
+    // the positions, so particles may move while other threads are still walking.
+    // self is the index the asking particle was built from, its own entry is
+    // skipped: once it has drifted off its stored position that entry isn't zero
+    void accelerationAt(float x, float y, uint32_t self, float G, const NBodyParams& params, float& ax, float& ay) const;
+
+    // Add the self-gravity acceleration of the whole tree at points [begin, end)
+    void accumulate(const float* posX, const float* posY, float* accX, float* accY,
+                    size_t begin, size_t end, float G, const NBodyParams& params) const;
+
+    size_t nodeCount() const { return nodes.size(); }
+
+private:
+    struct Node {
+        float cx, cy, half;       // cell centre and half width
+        float mass, comX, comY;   // total mass and centre of mass
+        int32_t child[4];         // -1 when empty, all -1 on leaves
+        uint32_t begin, end;      // particles [begin, end) of order[]
+        bool leaf;
+    };
+
+    // Cell whose subtree is built on its own thread
+    struct Subtree {
+        int32_t parent;
+        int quadrant;
+        uint32_t begin, end;
+        float cx, cy, half;
+    };
+
+    int32_t buildNode(std::vector<Node>& out, uint32_t begin, uint32_t end,
+                      float cx, float cy, float half, int depth);
+    void splitTop(uint32_t begin, uint32_t end, float cx, float cy, float half, int depth, int32_t parent, int quadrant);
+    void summarise(Node& node, const std::vector<Node>& pool);
+    // Partition order[begin, end) into the four quadrants around (cx, cy), returns the three split points
+    void partition(uint32_t begin, uint32_t end, float cx, float cy, uint32_t split[5]);
+
+    const float* px = nullptr;
+    const float* py = nullptr;
+    float mass = 0.0f;
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> rank;          // particle index -> its position in order[]
+    std::vector<float> sortedX, sortedY; // particle positions in order[] order, for leaf sums
+    std::vector<Subtree> subtrees;
+    std::vector<std::vector<Node>> subtreeNodes;
+    std::vector<float> chunkBounds;
+};
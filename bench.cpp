@@ -0,0 +1,397 @@
+// Benchmark harness: times the per-step CPU phases over a grid of particle
+// counts and trail lengths and writes the numbers as JSON. Given a baseline
+// JSON from an earlier run it flags phases that got slower than --threshold
+#include "attractors.h"
+#include "frame_arena.h"
+#include "frame_pack.h"
+#include "initial_conditions.h"
+#include "integrators.h"
+#include "morton_sort.h"
+#include "physics.h"
+#include "spatial_grid.h"
+#include "sph.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct BenchResult {
+    string phase;
+    size_t particles;
+    size_t trail;
+    double nsPerParticleStep;    // median over samples
+    double minNsPerParticleStep; // best sample, what baselines are compared on since it's the least noisy
+    size_t bytes;                // resident footprint of everything the phase works on
+    double gbPerSec;             // estimated traffic / median time
+    size_t reps;                 // calls timed
+};
+
+// Rough memory traffic per particle per step, from what each phase reads and writes
+static double phaseBytesPerParticle(const string& phase, size_t trail) {
+    if (phase.compare(0, 7, "physics") == 0) return 44.0; // pos, vel in; pos, vel, acc, temp out
+    if (phase == "trails") return 32.0;               // pos in, head/count in and out, one point out
+    if (phase == "init") return 44.0 + 8.0 * trail; // every field written once, trail rings zeroed
+    if (phase.compare(0, 4, "grid") == 0) return 28.0; // pos, vel in, cell id out and back in, id scattered
+    // pos in, key and slot through up to four digit passes, then every field and ring gathered
+    if (phase == "sort") return 100.0 + 2.0 * (44.0 + 8.0 * trail);
+    // pos, vel, energy in and copied to cell order, the eight per-particle sums written and read back,
+    // vel and energy out. The neighbour loops run out of L1 and aren't counted
+    if (phase == "sph") return 100.0;
+    if (phase.compare(0, 6, "field_") == 0) return 16.0; // pos in, acc out, the grid's own reads aren't counted
+    // pack: prev/curr pos and temp in, vertex out, plus every trail point. pack_cull is
+    // charged the same so its GB/s reads as the effective rate against a full pack
+    return 32.0 + 20.0 * trail;
+}
+
+static size_t systemBytes(const ParticleSystem& ps) {
+    size_t floats = ps.posX.capacity() + ps.posY.capacity() + ps.velX.capacity() + ps.velY.capacity() +
+                    ps.accX.capacity() + ps.accY.capacity() + ps.temp.capacity() + ps.stepSize.capacity() +
+                    ps.internalEnergy.capacity();
+    return floats * sizeof(float) + ps.trailPool.capacity() * sizeof(Vec2) +
+           (ps.trailHead.capacity() + ps.trailCount.capacity() + ps.id.capacity() + ps.slotOf.capacity() +
+            ps.generation.capacity() + ps.freeIds.capacity()) * sizeof(uint32_t);
+}
+
+// Seconds per call of `body`, one entry per sample. Small workloads are batched
+// so every sample lasts at least minSample and timer overhead stays out of
+// the numbers; sampling goes on until minSeconds have passed (at least minReps samples)
+static vector<double> timeReps(const function<void()>& body, double minSeconds, size_t minReps,
+                               size_t& calls, double minSample = 1e-3) {
+    auto run = [&](size_t inner) {
+        auto start = chrono::steady_clock::now();
+        for (size_t k = 0; k < inner; ++k) body();
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+
+    size_t inner = 1;
+    while (run(inner) < minSample && inner < (1u << 20)) inner *= 2; // also the warm-up
+
+    vector<double> times;
+    double total = 0.0;
+    while (times.size() < minReps || total < minSeconds) {
+        double t = run(inner);
+        times.push_back(t / inner);
+        total += t;
+    }
+    calls = times.size() * inner;
+    return times;
+}
+
+static BenchResult summarise(const string& phase, size_t n, size_t trail, vector<double> times, size_t calls,
+                             size_t bytes) {
+    sort(times.begin(), times.end());
+    double median = times[times.size() / 2];
+    BenchResult r;
+    r.phase = phase;
+    r.particles = n;
+    r.trail = trail;
+    r.nsPerParticleStep = median * 1e9 / n;
+    r.minNsPerParticleStep = times[0] * 1e9 / n;
+    r.bytes = bytes;
+    r.gbPerSec = phaseBytesPerParticle(phase, trail) * n / median * 1e-9;
+    r.reps = calls;
+    return r;
+}
+
+static vector<size_t> parseList(const char* text) {
+    vector<size_t> values;
+    stringstream in(text);
+    string item;
+    while (getline(in, item, ',')) {
+        if (!item.empty()) values.push_back((size_t)strtod(item.c_str(), nullptr)); // strtod so 1e6 works
+    }
+    return values;
+}
+
+// Pull "key": value out of one result line
+static bool jsonNumber(const string& line, const char* key, double& value) {
+    string pattern = string("\"") + key + "\":";
+    size_t at = line.find(pattern);
+    if (at == string::npos) return false;
+    value = strtod(line.c_str() + at + pattern.size(), nullptr);
+    return true;
+}
+
+static bool jsonString(const string& line, const char* key, string& value) {
+    string pattern = string("\"") + key + "\": \"";
+    size_t at = line.find(pattern);
+    if (at == string::npos) return false;
+    size_t begin = at + pattern.size();
+    size_t end = line.find('"', begin);
+    if (end == string::npos) return false;
+    value = line.substr(begin, end - begin);
+    return true;
+}
+
+// Results of an earlier run, one per line the way writeJson puts them
+static bool readBaseline(const char* path, vector<BenchResult>& results) {
+    ifstream in(path);
+    if (!in) return false;
+    string line;
+    while (getline(in, line)) {
+        BenchResult r;
+        double particles, trail;
+        if (!jsonString(line, "phase", r.phase) || !jsonNumber(line, "particles", particles) ||
+            !jsonNumber(line, "trail", trail) || !jsonNumber(line, "ns_per_particle_step", r.nsPerParticleStep) ||
+            !jsonNumber(line, "min_ns_per_particle_step", r.minNsPerParticleStep)) {
+            continue;
+        }
+        r.particles = (size_t)particles;
+        r.trail = (size_t)trail;
+        results.push_back(r);
+    }
+    return true;
+}
+
+static void writeJson(ostream& out, const vector<BenchResult>& results, unsigned threads,
+                      const char* integrator, const char* kernel) {
+    out << "{\n";
+    out << "  \"version\": 1,\n";
+    out << "  \"threads\": " << threads << ",\n";
+    out << "  \"integrator\": \"" << integrator << "\",\n";
+    out << "  \"kernel\": \"" << kernel << "\",\n";
+    out << "  \"note\": \"draw submission needs a GL context and isn't measured here\",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "    {\"phase\": \"%s\", \"particles\": %zu, \"trail\": %zu, \"ns_per_particle_step\": %.4f, "
+                 "\"min_ns_per_particle_step\": %.4f, \"bytes\": %zu, \"gb_per_s\": %.3f, \"reps\": %zu}%s\n",
+                 r.phase.c_str(), r.particles, r.trail, r.nsPerParticleStep, r.minNsPerParticleStep, r.bytes,
+                 r.gbPerSec, r.reps, i + 1 < results.size() ? "," : "");
+        out << line;
+    }
+    out << "  ]\n}\n";
+}
+
+static void usage(const char* prog) {
+    cerr << "Usage: " << prog << " [--counts N,N,...] [--trails L,L,...] [--threads T] [--integrator NAME]"
+         << " [--min-time S] [--max-bytes B] [--out FILE] [--baseline FILE] [--threshold FRACTION]\n";
+}
+
+int main(int argc, char** argv) {
+    vector<size_t> counts = { 100, 1000, 10000, 100000, 1000000, 10000000 };
+    vector<size_t> trails = { 0, maxTrailLength };
+    unsigned numThreads = 0;
+    const IntegratorInfo* integrator = &integrators[0];
+    double minSeconds = 0.25;
+    double maxBytes = 4e9;          // skip grid points whose particle store would be bigger
+    const char* outPath = nullptr;
+    const char* baselinePath = nullptr;
+    double threshold = 0.10;        // slower than baseline by more than this fails
+
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--counts") == 0 && hasValue) {
+            counts = parseList(argv[++i]);
+        } else if (strcmp(argv[i], "--trails") == 0 && hasValue) {
+            trails = parseList(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            numThreads = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--integrator") == 0 && hasValue && findIntegrator(argv[i + 1])) {
+            integrator = findIntegrator(argv[++i]);
+        } else if (strcmp(argv[i], "--min-time") == 0 && hasValue) {
+            minSeconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-bytes") == 0 && hasValue) {
+            maxBytes = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--out") == 0 && hasValue) {
+            outPath = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && hasValue) {
+            baselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && hasValue) {
+            threshold = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    const char* kernelName;
+    selectStepKernel(&kernelName);
+    ThreadPool pool(numThreads);
+    Integrator kernel = findKernel(integrator->name, ForceModel::Central, Precision::Float);
+    Integrator pwKernel = findKernel(integrator->name, ForceModel::PseudoNewtonian, Precision::Float);
+    Integrator geodesicKernel = findKernel(integrator->name, ForceModel::Geodesic, Precision::Float);
+    ForceContext context;
+
+    // 32 static holes scattered over the disk, for the direct sum against the cached grid
+    AttractorField sumField, gridField;
+    for (int j = 0; j < 32; ++j) {
+        Attractor a;
+        a.x = 100.0f + 600.0f * ((j * 37) % 101) / 101.0f;
+        a.y = 600.0f * ((j * 61) % 103) / 103.0f;
+        a.mass = M / 32;
+        sumField.bodies.push_back(a);
+    }
+    gridField = sumField;
+    sumField.gridMode = FieldGrid::Off;
+    gridField.gridMode = FieldGrid::On;
+    sumField.setTime(0.0, G);
+    gridField.setTime(0.0, G, &pool);
+
+    vector<BenchResult> results;
+    for (size_t trail : trails) {
+        for (size_t n : counts) {
+            if (n == 0) continue;
+            // store + both pack buffers, 12 bytes a vertex
+            double estimate = n * (8 * sizeof(float) + 3 * sizeof(uint32_t) + 12.0) + n * trail * (sizeof(Vec2) + 12.0);
+            if (estimate > maxBytes) {
+                cerr << "skipping " << n << " particles, trail " << trail << ": ~" << estimate / 1e9 << " GB\n";
+                continue;
+            }
+            cerr << n << " particles, trail " << trail << "..." << endl;
+
+            ParticleSystem ps;
+            initParticles(ps, n, trail, 1, InitDistribution(), &pool);
+
+            // Fill the rings so the trail and pack phases see steady-state data
+            for (size_t s = 0; s < trail; ++s) {
+                pool.parallelFor(n, physicsChunkSize, [&](size_t begin, size_t end) { recordTrails(ps, begin, end); });
+            }
+            size_t bytes = systemBytes(ps);
+
+            size_t calls;
+            // Startup from nothing, allocation included
+            auto initTimes = timeReps([&] {
+                ParticleSystem fresh;
+                initParticles(fresh, n, trail, 1, InitDistribution(), &pool);
+            }, minSeconds, 3, calls);
+            results.push_back(summarise("init", n, trail, initTimes, calls, bytes));
+
+            auto physics = timeReps([&] {
+                pool.parallelFor(n, physicsChunkSize, [&](size_t begin, size_t end) {
+                    kernel(ps, begin, end, defaultDt, context);
+                });
+            }, minSeconds, 3, calls);
+            results.push_back(summarise("physics", n, trail, physics, calls, bytes));
+
+            // Same step under the relativistic force models, to compare against physics. dt 0
+            // does the same work without moving anyone: the disk starts at Newtonian speeds, and
+            // hundreds of reps would drop its inner edge through the hole for the phases after
+            for (Integrator k : { pwKernel, geodesicKernel }) {
+                auto times = timeReps([&] {
+                    pool.parallelFor(n, physicsChunkSize, [&](size_t begin, size_t end) {
+                        k(ps, begin, end, 0.0f, context);
+                    });
+                }, minSeconds, 3, calls);
+                results.push_back(summarise(k == pwKernel ? "physics_pw" : "physics_geodesic", n, trail, times, calls, bytes));
+            }
+
+            for (const AttractorField* field : { &sumField, &gridField }) {
+                auto fieldTimes = timeReps([&] {
+                    pool.parallelFor(n, physicsChunkSize, [&](size_t begin, size_t end) {
+                        field->accelerations(ps.posX.data() + begin, ps.posY.data() + begin,
+                                             ps.accX.data() + begin, ps.accY.data() + begin, end - begin);
+                    });
+                }, minSeconds, 3, calls);
+                results.push_back(summarise(field->cached() ? "field_grid" : "field_sum", n, trail, fieldTimes, calls, bytes));
+            }
+
+            if (trail > 0) {
+                auto trailTimes = timeReps([&] {
+                    pool.parallelFor(n, physicsChunkSize, [&](size_t begin, size_t end) { recordTrails(ps, begin, end); });
+                }, minSeconds, 3, calls);
+                results.push_back(summarise("trails", n, trail, trailTimes, calls, bytes));
+            }
+
+            // Same single-threaded packing the render loop does, into plain memory instead of a mapped buffer
+            vector<float> particleData(3 * (n + 1));
+            vector<float> trailData(3 * n * trail);
+            auto pack = timeReps([&] {
+                packFrame(ps, ps, 0.5f, particleData.data(), trail > 0 ? trailData.data() : nullptr);
+            }, minSeconds, 3, calls);
+            results.push_back(summarise("pack", n, trail, pack, calls,
+                                        bytes + (particleData.size() + trailData.size()) * sizeof(float)));
+
+            UniformGrid grid;
+            auto gridTimes = timeReps([&] { grid.build(ps, &pool); }, minSeconds, 3, calls);
+            results.push_back(summarise("grid", n, trail, gridTimes, calls, bytes + 2 * n * sizeof(uint32_t)));
+
+            // Same pack culled to a 4x zoom on the black hole, the way the render loop queries the grid
+            View view;
+            view.zoom = 4.0f;
+            FrameArena arena(n * sizeof(uint32_t) / 8);
+            auto packCull = timeReps([&] {
+                arena.reset();
+                PackView pv;
+                pv.visible = view.visible().padded(5.0f / view.zoom);
+                pv.trailSpacing = 1.0f / view.zoom;
+                gatherCandidates(pv, grid, ps, defaultDt, arena);
+                packFrame(ps, ps, 0.5f, particleData.data(), trail > 0 ? trailData.data() : nullptr, &pv);
+            }, minSeconds, 3, calls);
+            results.push_back(summarise("pack_cull", n, trail, packCull, calls,
+                                        bytes + (particleData.size() + trailData.size()) * sizeof(float)));
+
+            // Morton order, then the grid and culled pack again over the sorted store. Particles
+            // start in id order, which is no order in space at all, like a disk a few turns in
+            MortonSorter sorter;
+            auto sortTimes = timeReps([&] { sorter.sort(ps, &pool); }, minSeconds, 3, calls);
+            results.push_back(summarise("sort", n, trail, sortTimes, calls, 2 * bytes + 4 * n * sizeof(uint32_t)));
+            gridTimes = timeReps([&] { grid.build(ps, &pool); }, minSeconds, 3, calls);
+            results.push_back(summarise("grid_sorted", n, trail, gridTimes, calls, bytes + 2 * n * sizeof(uint32_t)));
+            packCull = timeReps([&] {
+                arena.reset();
+                PackView pv;
+                pv.visible = view.visible().padded(5.0f / view.zoom);
+                pv.trailSpacing = 1.0f / view.zoom;
+                gatherCandidates(pv, grid, ps, defaultDt, arena);
+                packFrame(ps, ps, 0.5f, particleData.data(), trail > 0 ? trailData.data() : nullptr, &pv);
+            }, minSeconds, 3, calls);
+            results.push_back(summarise("pack_cull_sorted", n, trail, packCull, calls,
+                                        bytes + (particleData.size() + trailData.size()) * sizeof(float)));
+
+            // One SPH kick over the sorted store, automatic smoothing length. Positions
+            // don't move, so every rep sees the same neighbours
+            SphSolver hydro;
+            SphParams sph;
+            auto sphTimes = timeReps([&] { hydro.kick(ps, pool, defaultDt, sph); }, minSeconds, 3, calls);
+            results.push_back(summarise("sph", n, trail, sphTimes, calls, bytes + 13 * n * sizeof(float)));
+        }
+    }
+
+    if (outPath) {
+        ofstream out(outPath);
+        writeJson(out, results, pool.size(), integrator->name, kernelName);
+        if (!out) {
+            cerr << "Failed to write " << outPath << "\n";
+            return -1;
+        }
+    } else {
+        writeJson(cout, results, pool.size(), integrator->name, kernelName);
+    }
+
+    if (!baselinePath) return 0;
+    vector<BenchResult> baseline;
+    if (!readBaseline(baselinePath, baseline)) {
+        cerr << "Failed to read baseline " << baselinePath << "\n";
+        return -1;
+    }
+    int regressions = 0;
+    for (const BenchResult& r : results) {
+        for (const BenchResult& b : baseline) {
+            if (b.phase != r.phase || b.particles != r.particles || b.trail != r.trail) continue;
+            double change = r.minNsPerParticleStep / b.minNsPerParticleStep - 1.0;
+            bool regressed = change > threshold;
+            regressions += regressed;
+            fprintf(stderr, "%-8s %10zu particles, trail %3zu: %9.3f -> %9.3f ns/particle/step best (%+6.1f%%)%s\n",
+                    r.phase.c_str(), r.particles, r.trail, b.minNsPerParticleStep, r.minNsPerParticleStep,
+                    change * 100.0, regressed ? "  REGRESSION" : "");
+        }
+    }
+    if (regressions > 0) {
+        cerr << regressions << " phase(s) slower than the baseline by more than " << threshold * 100.0 << "%\n";
+        return 1;
+    }
+    return 0;
+}
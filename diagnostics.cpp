@@ -0,0 +1,207 @@
+#include "diagnostics.h"
+#include "attractors.h"
+#include "physics.h"
+#include <algorithm>
+#include <cmath>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+double specificPotential(ForceModel force, const ForceContext& ctx, double x, double y, double vx, double vy) {
+    if (force == ForceModel::Attractors) return ctx.attractors->potentialAt((float)x, (float)y);
+    double dx = x - centerX, dy = y - centerY;
+    double r = max(sqrt(dx * dx + dy * dy), 5.0); // prevent singularity, like the forces
+    double gm = (double)ctx.G * ctx.M;
+    if (force == ForceModel::PseudoNewtonian) return -gm / max(r - blackHoleRadius, 5.0);
+    if (force == ForceModel::Geodesic) {
+        double L = dx * vy - dy * vx;
+        return -gm / r - 0.5 * blackHoleRadius * L * L / (r * r * r); // GM L^2 / (c^2 r^3) with rs = 2 GM / c^2
+    }
+    return -gm / r;
+}
+
+namespace {
+
+// Sums for the hole at the centre, pw says whether it's Paczynski-Wiita
+typedef void (*MeasureKernel)(const float* px, const float* py, const float* vx, const float* vy, size_t n,
+                              double gm, bool pw, Diagnostics& out);
+
+void measureScalar(const float* px, const float* py, const float* vx, const float* vy, size_t n,
+                   double gm, bool pw, Diagnostics& out) {
+    for (size_t i = 0; i < n; ++i) {
+        double dx = (double)px[i] - centerX, dy = (double)py[i] - centerY;
+        double r = max(sqrt(dx * dx + dy * dy), 5.0);
+        out.kinetic += 0.5 * ((double)vx[i] * vx[i] + (double)vy[i] * vy[i]);
+        out.potential -= gm / (pw ? max(r - blackHoleRadius, 5.0) : r);
+        out.angularMomentum += dx * vy[i] - dy * vx[i];
+    }
+    out.particles += n;
+}
+
+// 1/r and 1/(r - rs) come from rsqrt and rcp plus a Newton-Raphson step in
+// float, like the step kernels: good to ~1e-7 relative and far cheaper than double
+// sqrt and divide. Every term is widened to double before it's summed, a 4096
+// particle chunk added up in float would lose the drift we're after
+#if defined(__x86_64__) || defined(__i386__)
+// GCC 12 warns about the undefined passthrough registers inside its own intrinsic headers
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+// Lower (h = 0) or upper half of a register as doubles
+__attribute__((target("avx2,fma")))
+inline __m256d widenAVX2(__m256 a, int h) {
+    return _mm256_cvtps_pd(h == 0 ? _mm256_castps256_ps128(a) : _mm256_extractf128_ps(a, 1));
+}
+
+__attribute__((target("avx2,fma")))
+void measureAVX2(const float* px, const float* py, const float* vx, const float* vy, size_t n,
+                 double gm, bool pw, Diagnostics& out) {
+    const __m256 cx = _mm256_set1_ps(centerX), cy = _mm256_set1_ps(centerY);
+    const __m256 invSoft = _mm256_set1_ps(1.0f / 5.0f), soft = _mm256_set1_ps(5.0f), rs = _mm256_set1_ps(blackHoleRadius);
+    const __m256 half = _mm256_set1_ps(0.5f), threeHalves = _mm256_set1_ps(1.5f), two = _mm256_set1_ps(2.0f);
+    const __m256d cxd = _mm256_set1_pd(centerX), cyd = _mm256_set1_pd(centerY);
+    const __m256d gmv = _mm256_set1_pd(gm), halfd = _mm256_set1_pd(0.5);
+    __m256d kinetic = _mm256_setzero_pd(), potential = _mm256_setzero_pd(), momentum = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(px + i), y = _mm256_loadu_ps(py + i);
+        __m256 u = _mm256_loadu_ps(vx + i), v = _mm256_loadu_ps(vy + i);
+        __m256 dx = _mm256_sub_ps(x, cx), dy = _mm256_sub_ps(y, cy);
+        __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+        __m256 invR = _mm256_rsqrt_ps(r2);
+        invR = _mm256_mul_ps(invR, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(invR, invR), threeHalves));
+        __m256 inv = _mm256_min_ps(invR, invSoft); // r >= 5
+        if (pw) {
+            __m256 gap = _mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(r2, invR), rs), soft); // NaN at r = 0 picks 5
+            inv = _mm256_rcp_ps(gap);
+            inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(gap, inv, two));
+        }
+        for (int h = 0; h < 2; ++h) {
+            __m256d ud = widenAVX2(u, h), vd = widenAVX2(v, h);
+            __m256d dxd = _mm256_sub_pd(widenAVX2(x, h), cxd), dyd = _mm256_sub_pd(widenAVX2(y, h), cyd);
+            kinetic = _mm256_fmadd_pd(halfd, _mm256_fmadd_pd(ud, ud, _mm256_mul_pd(vd, vd)), kinetic);
+            potential = _mm256_fnmadd_pd(gmv, widenAVX2(inv, h), potential);
+            momentum = _mm256_add_pd(momentum, _mm256_fmsub_pd(dxd, vd, _mm256_mul_pd(dyd, ud)));
+        }
+    }
+    double lanes[3][4];
+    _mm256_storeu_pd(lanes[0], kinetic);
+    _mm256_storeu_pd(lanes[1], potential);
+    _mm256_storeu_pd(lanes[2], momentum);
+    for (int k = 0; k < 4; ++k) {
+        out.kinetic += lanes[0][k];
+        out.potential += lanes[1][k];
+        out.angularMomentum += lanes[2][k];
+    }
+    out.particles += i;
+    measureScalar(px + i, py + i, vx + i, vy + i, n - i, gm, pw, out);
+}
+
+__attribute__((target("avx512f")))
+inline __m512d widenAVX512(__m512 a, int h) {
+    return _mm512_cvtps_pd(h == 0 ? _mm512_castps512_ps256(a)
+                                  : _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1)));
+}
+
+__attribute__((target("avx512f")))
+void measureAVX512(const float* px, const float* py, const float* vx, const float* vy, size_t n,
+                   double gm, bool pw, Diagnostics& out) {
+    const __m512 cx = _mm512_set1_ps(centerX), cy = _mm512_set1_ps(centerY);
+    const __m512 invSoft = _mm512_set1_ps(1.0f / 5.0f), soft = _mm512_set1_ps(5.0f), rs = _mm512_set1_ps(blackHoleRadius);
+    const __m512 half = _mm512_set1_ps(0.5f), threeHalves = _mm512_set1_ps(1.5f), two = _mm512_set1_ps(2.0f);
+    const __m512d cxd = _mm512_set1_pd(centerX), cyd = _mm512_set1_pd(centerY);
+    const __m512d gmv = _mm512_set1_pd(gm), halfd = _mm512_set1_pd(0.5);
+    __m512d kinetic = _mm512_setzero_pd(), potential = _mm512_setzero_pd(), momentum = _mm512_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 x = _mm512_loadu_ps(px + i), y = _mm512_loadu_ps(py + i);
+        __m512 u = _mm512_loadu_ps(vx + i), v = _mm512_loadu_ps(vy + i);
+        __m512 dx = _mm512_sub_ps(x, cx), dy = _mm512_sub_ps(y, cy);
+        __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+        __m512 invR = _mm512_rsqrt14_ps(r2);
+        invR = _mm512_mul_ps(invR, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(invR, invR), threeHalves));
+        __m512 inv = _mm512_min_ps(invR, invSoft);
+        if (pw) {
+            __m512 gap = _mm512_max_ps(_mm512_sub_ps(_mm512_mul_ps(r2, invR), rs), soft);
+            inv = _mm512_rcp14_ps(gap);
+            inv = _mm512_mul_ps(inv, _mm512_fnmadd_ps(gap, inv, two));
+        }
+        for (int h = 0; h < 2; ++h) {
+            __m512d ud = widenAVX512(u, h), vd = widenAVX512(v, h);
+            __m512d dxd = _mm512_sub_pd(widenAVX512(x, h), cxd), dyd = _mm512_sub_pd(widenAVX512(y, h), cyd);
+            kinetic = _mm512_fmadd_pd(halfd, _mm512_fmadd_pd(ud, ud, _mm512_mul_pd(vd, vd)), kinetic);
+            potential = _mm512_fnmadd_pd(gmv, widenAVX512(inv, h), potential);
+            momentum = _mm512_add_pd(momentum, _mm512_fmsub_pd(dxd, vd, _mm512_mul_pd(dyd, ud)));
+        }
+    }
+    out.kinetic += _mm512_reduce_add_pd(kinetic);
+    out.potential += _mm512_reduce_add_pd(potential);
+    out.angularMomentum += _mm512_reduce_add_pd(momentum);
+    out.particles += i;
+    measureScalar(px + i, py + i, vx + i, vy + i, n - i, gm, pw, out);
+}
+
+#pragma GCC diagnostic pop
+#endif
+
+// No NEON version, 64-bit float lanes only come with AArch64 and the scalar
+// loop is cheap next to the step it follows
+MeasureKernel selectMeasureKernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return measureAVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return measureAVX2;
+#endif
+    return measureScalar;
+}
+
+} // namespace
+
+void measureRange(const ParticleSystem& ps, size_t begin, size_t end, ForceModel force, const ForceContext& ctx,
+                  Diagnostics& out) {
+    double thermal = 0.0;
+    for (size_t i = begin; i < end; ++i) thermal += ps.internalEnergy[i];
+    out.thermal += thermal;
+    if (force == ForceModel::Attractors || force == ForceModel::Geodesic) {
+        for (size_t i = begin; i < end; ++i) {
+            double dx = (double)ps.posX[i] - centerX, dy = (double)ps.posY[i] - centerY;
+            double u = ps.velX[i], v = ps.velY[i];
+            out.kinetic += 0.5 * (u * u + v * v);
+            out.potential += specificPotential(force, ctx, ps.posX[i], ps.posY[i], u, v);
+            out.angularMomentum += dx * v - dy * u;
+        }
+        out.particles += end - begin;
+        return;
+    }
+    static const MeasureKernel kernel = selectMeasureKernel();
+    kernel(ps.posX.data() + begin, ps.posY.data() + begin, ps.velX.data() + begin, ps.velY.data() + begin,
+           end - begin, (double)ctx.G * ctx.M, force == ForceModel::PseudoNewtonian, out);
+    if (force == ForceModel::NBody) out.potential = NAN; // the hole alone isn't what nbody conserves
+}
+
+void DriftMonitor::observe(uint64_t step, const Diagnostics& d, bool rebase) {
+    if (!started || rebase) {
+        if (started) {
+            if (clean()) {
+                energyBefore = energyDrift();
+                momentumBefore = momentumDrift();
+            }
+            rebaseCount++;
+        }
+        reference = d;
+        started = true;
+    } else {
+        cleanIntervals++;
+    }
+    last = d;
+    lastStep = step;
+}
+
+void DriftMonitor::exchange(const Diagnostics& retired, const Diagnostics& spawned) {
+    if (!started) return; // the first measurement takes the population as it is then
+    reference.add(spawned);
+    reference.subtract(retired);
+}
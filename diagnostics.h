@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "forces.h"
+
+struct ParticleSystem;
+
+// Conserved quantities of the live particles, summed per unit particle mass
+// (every particle weighs the same). The potential is the external field of the
+// force model: the hole for central, pw and geodesic, every hole plus the halo
+// and uniform field for attractors. nbody would need the disk's own potential
+// too, which nothing sums, so its potential and energy are NaN (like
+// orbit_sweep's drift columns). Its angular momentum is still measured.
+// Thermal is the SPH internal energy, 0 without gas
+struct Diagnostics {
+    double kinetic = 0.0, potential = 0.0, thermal = 0.0;
+    double angularMomentum = 0.0; // about (centerX, centerY)
+    size_t particles = 0;
+
+    double energy() const { return kinetic + potential + thermal; }
+    void add(const Diagnostics& other) {
+        kinetic += other.kinetic;
+        potential += other.potential;
+        thermal += other.thermal;
+        angularMomentum += other.angularMomentum;
+        particles += other.particles;
+    }
+    void subtract(const Diagnostics& other) {
+        kinetic -= other.kinetic;
+        potential -= other.potential;
+        thermal -= other.thermal;
+        angularMomentum -= other.angularMomentum;
+        particles -= other.particles;
+    }
+};
+
+// Potential per unit mass at one point, same softening as the force kernels.
+// Geodesic adds -GM L^2 / (c^2 r^3), the term that makes kinetic plus potential
+// its conserved energy, so it needs the velocity. The others ignore it
+double specificPotential(ForceModel force, const ForceContext& ctx, double x, double y, double vx, double vy);
+
+// Add particles [begin, end) to out. Central, nbody and pw sum four or eight
+// particles a register in double, through the widest SIMD the CPU has, a chunk
+// fresh out of its integrator is still in cache so this costs no extra trip to
+// memory. Attractors and geodesic go through specificPotential one particle at a time
+void measureRange(const ParticleSystem& ps, size_t begin, size_t end, ForceModel force, const ForceContext& ctx,
+                  Diagnostics& out);
+
+// Relative drift of energy and angular momentum since the first measurement.
+// Retiring or spawning particles changes the totals without anything drifting,
+// so exchange() moves the reference by what those particles carried at the
+// moment they left or joined. A change that can't be accounted for that way
+// (a config reload) rebases instead: the drift up to the last measurement is
+// kept, the new totals become the reference and the steps in between are lost.
+// With no clean interval between two measurements the drift is NaN, not 0
+class DriftMonitor {
+public:
+    void observe(uint64_t step, const Diagnostics& d, bool rebase = false);
+    void exchange(const Diagnostics& retired, const Diagnostics& spawned);
+    void reset() { *this = DriftMonitor(); }
+
+    bool measured() const { return started; }
+    uint64_t step() const { return lastStep; }
+    const Diagnostics& latest() const { return last; }
+    double energyDrift() const {
+        return clean() ? energyBefore + relative(last.energy(), reference.energy()) : NAN;
+    }
+    double momentumDrift() const {
+        return clean() ? momentumBefore + relative(last.angularMomentum, reference.angularMomentum) : NAN;
+    }
+    size_t rebases() const { return rebaseCount; }
+
+private:
+    static double relative(double now, double start) { return start != 0.0 ? (now - start) / (start < 0 ? -start : start) : 0.0; }
+    bool clean() const { return rebaseCount == 0 || cleanIntervals > 0; }
+
+    bool started = false;
+    uint64_t lastStep = 0;
+    Diagnostics reference, last;
+    double energyBefore = 0.0, momentumBefore = 0.0; // drift of earlier populations
+    size_t rebaseCount = 0, cleanIntervals = 0;
+};
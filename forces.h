@@ -0,0 +1,156 @@
+#pragma once
+
+#include "attractors.h"
+#include "barnes_hut.h"
+#include "physics.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+// Force models the integrator kernels are templated on. Each is a small value
+// built once per chunk from a ForceContext, and operator() returns the
+// acceleration at a point in Real precision so it inlines straight into the
+// integrator loop. It gets the velocity too, only geodesic uses it. distance()
+// is how far a point is from the nearest hole, block timesteps pick levels from
+// it. Particle storage stays float whatever Real is
+
+// Everything a force model might need, filled in once per step
+struct ForceContext {
+    float G = ::G;
+    float M = ::M;
+    const BarnesHutTree* tree = nullptr; // N-body only, built from this step's start positions
+    NBodyParams nbody;
+    const AttractorField* attractors = nullptr; // attractors only, holes already placed for this step
+    std::atomic<uint64_t>* overTolerance = nullptr; // RK45 adds the particle-steps its substep cap forced through
+};
+
+enum class ForceModel { Central, PseudoNewtonian, NBody, Attractors, Geodesic };
+
+// Newtonian point mass at the centre, same maths as centralAcceleration
+template <typename Real>
+struct CentralForce {
+    Real gm, cx, cy;
+
+    explicit CentralForce(const ForceContext& ctx)
+        : gm((Real)ctx.G * (Real)ctx.M), cx((Real)centerX), cy((Real)centerY) {}
+
+    Real distance(Real x, Real y) const {
+        Real dx = x - cx, dy = y - cy;
+        return std::sqrt(dx*dx + dy*dy);
+    }
+
+    void operator()(Real x, Real y, Real vx, Real vy, Real& ax, Real& ay) const {
+        Real dx = x - cx, dy = y - cy;
+        Real r2 = dx*dx + dy*dy;
+        Real r = std::max(std::sqrt(r2), (Real)5); // prevent singularity
+        Real f = gm / (r2 * r);
+        ax = -f * dx;
+        ay = -f * dy;
+    }
+};
+
+// Paczynski-Wiita potential, -GM / (r - rs) with rs = blackHoleRadius. Cheap
+// stand-in for Schwarzschild: gives an innermost stable orbit at 3 rs, so
+// particles that drift inside it plunge instead of orbiting forever
+template <typename Real>
+struct PseudoNewtonianForce {
+    Real gm, cx, cy, rs;
+
+    explicit PseudoNewtonianForce(const ForceContext& ctx)
+        : gm((Real)ctx.G * (Real)ctx.M), cx((Real)centerX), cy((Real)centerY), rs((Real)blackHoleRadius) {}
+
+    Real distance(Real x, Real y) const {
+        Real dx = x - cx, dy = y - cy;
+        return std::sqrt(dx*dx + dy*dy);
+    }
+
+    void operator()(Real x, Real y, Real vx, Real vy, Real& ax, Real& ay) const {
+        Real dx = x - cx, dy = y - cy;
+        Real r = std::max(std::sqrt(dx*dx + dy*dy), (Real)5);
+        Real gap = std::max(r - rs, (Real)5); // same softening as the Newtonian clamp, measured from rs
+        Real f = gm / (gap * gap * r);
+        ax = -f * dx;
+        ay = -f * dy;
+    }
+};
+
+// Schwarzschild geodesics in the equatorial plane, timed by each particle's
+// proper time. Written in Cartesian form the radial geodesic equation is the
+// Newtonian pull plus -3 GM L^2 / (c^2 r^5) (dx, dy), L = x vy - y vx the
+// angular momentum per unit mass. c is set so the horizon 2 GM / c^2 sits at
+// blackHoleRadius, so the extra term is 1.5 rs L^2 / r^5 whatever G and M are.
+// It's still a central force, so every scheme here keeps L as well as it did
+// before, and the leapfrogs and Euler keep it to rounding. Like pw it has its
+// innermost stable orbit at 3 rs, but orbits precess by the right amount and
+// anything with too little L plunges
+template <typename Real>
+struct SchwarzschildForce {
+    Real gm, cx, cy, rs;
+
+    explicit SchwarzschildForce(const ForceContext& ctx)
+        : gm((Real)ctx.G * (Real)ctx.M), cx((Real)centerX), cy((Real)centerY), rs((Real)blackHoleRadius) {}
+
+    Real distance(Real x, Real y) const {
+        Real dx = x - cx, dy = y - cy;
+        return std::sqrt(dx*dx + dy*dy);
+    }
+
+    void operator()(Real x, Real y, Real vx, Real vy, Real& ax, Real& ay) const {
+        Real dx = x - cx, dy = y - cy;
+        Real r = std::max(std::sqrt(dx*dx + dy*dy), (Real)5);
+        Real L = dx * vy - dy * vx;
+        Real inv2 = 1 / (r * r);
+        Real f = (gm + (Real)1.5 * rs * L * L * inv2) * inv2 / r;
+        ax = -f * dx;
+        ay = -f * dy;
+    }
+};
+
+// Central mass plus Barnes-Hut self-gravity. The tree holds its own copy of
+// the positions it was built from, so substeps see the other particles where
+// they were at the start of the step. The kernel says which particle it's
+// stepping (bindParticle) so the walk leaves out its step-start self
+template <typename Real>
+struct NBodyForce {
+    CentralForce<Real> central;
+    const BarnesHutTree* tree;
+    NBodyParams params;
+    float G;
+    uint32_t self = BarnesHutTree::noParticle;
+
+    explicit NBodyForce(const ForceContext& ctx) : central(ctx), tree(ctx.tree), params(ctx.nbody), G(ctx.G) {}
+
+    Real distance(Real x, Real y) const { return central.distance(x, y); }
+
+    void operator()(Real x, Real y, Real vx, Real vy, Real& ax, Real& ay) const {
+        central(x, y, vx, vy, ax, ay);
+        float tx, ty;
+        tree->accelerationAt((float)x, (float)y, self, G, params, tx, ty);
+        ax += (Real)tx;
+        ay += (Real)ty;
+    }
+};
+
+// Tell a force model which particle the next calls are for, only nbody cares
+template <typename Force>
+inline void bindParticle(Force&, size_t) {}
+template <typename Real>
+inline void bindParticle(NBodyForce<Real>& force, size_t i) { force.self = (uint32_t)i; }
+
+// Every hole and external potential in an AttractorField. The field works in
+// float, so double precision only carries through the integrator itself
+template <typename Real>
+struct AttractorForce {
+    const AttractorField* field;
+
+    explicit AttractorForce(const ForceContext& ctx) : field(ctx.attractors) {}
+
+    Real distance(Real x, Real y) const { return (Real)field->nearestHole((float)x, (float)y); }
+
+    void operator()(Real x, Real y, Real vx, Real vy, Real& ax, Real& ay) const {
+        float fx, fy;
+        field->accelerationAt((float)x, (float)y, fx, fy);
+        ax = (Real)fx;
+        ay = (Real)fy;
+    }
+};
@@ -0,0 +1,31 @@
+#include "frame_arena.h"
+#include <algorithm>
+
+using namespace std;
+
+FrameArena::FrameArena(size_t bytes) : block(bytes ? new unsigned char[bytes] : nullptr), size(bytes) {}
+
+void* FrameArena::allocBytes(size_t bytes, size_t align) {
+    uintptr_t base = (uintptr_t)block.get();
+    size_t start = (size_t)(((base + offset + align - 1) & ~(uintptr_t)(align - 1)) - base);
+    frameBytes += bytes + (start - offset);
+    peak = max(peak, frameBytes);
+    if (block && start + bytes <= size) {
+        offset = start + bytes;
+        return block.get() + start;
+    }
+    // doesn't fit: a block of its own until the next reset() makes room
+    spills.emplace_back(new unsigned char[bytes + align]);
+    uintptr_t spill = (uintptr_t)spills.back().get();
+    return (void*)((spill + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+void FrameArena::reset() {
+    if (!spills.empty()) {
+        spills.clear();
+        size = peak + peak / 2; // some headroom so a slowly growing frame doesn't spill every time
+        block.reset(new unsigned char[size]);
+    }
+    offset = 0;
+    frameBytes = 0;
+}
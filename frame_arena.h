@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Linear allocator for scratch that only lives for one frame. alloc() bumps
+// an offset into one block and reset() rewinds it, so a frame that fits never
+// touches the heap. A frame that doesn't fit spills into extra blocks, and
+// the next reset() grows the main block to what that frame needed, so
+// spilling happens once rather than every frame. Nothing is constructed or
+// destroyed: use it for plain data only
+class FrameArena {
+public:
+    explicit FrameArena(size_t bytes = 0);
+
+    template <typename T>
+    T* alloc(size_t count) {
+        return static_cast<T*>(allocBytes(count * sizeof(T), alignof(T)));
+    }
+    void* allocBytes(size_t bytes, size_t align = alignof(std::max_align_t));
+
+    // Everything handed out since the last reset() is gone after this
+    void reset();
+
+    size_t used() const { return frameBytes; }  // this frame, spills included
+    size_t capacity() const { return size; }
+    size_t highWater() const { return peak; }   // most any frame has used
+
+private:
+    std::unique_ptr<unsigned char[]> block;
+    size_t size = 0, offset = 0;
+    size_t frameBytes = 0, peak = 0;
+    std::vector<std::unique_ptr<unsigned char[]>> spills;
+};
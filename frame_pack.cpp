@@ -0,0 +1,152 @@
+#include "frame_pack.h"
+#include "frame_arena.h"
+#include "physics.h"
+#include <algorithm>
+
+using namespace std;
+
+void gatherCandidates(PackView& view, const UniformGrid& grid, const ParticleSystem& snapshot, float dt,
+                      FrameArena& arena) {
+    // trails are one point per step, the 1.5 covers speeds having been higher
+    // than the current top during the trail, the one step covers the blend
+    float stepReach = grid.maxSpeed() * dt;
+    view.trailReach = snapshot.trailLength > 0 ? 1.5f * stepReach * snapshot.trailLength : 0.0f;
+    view.candidates = nullptr;
+    view.candidateCount = 0;
+    view.allVisible = false;
+    if (grid.size() != snapshot.size()) return; // built from some other state
+    Rect inner = view.visible.padded(-stepReach);
+    const Rect& b = grid.bounds();
+    view.allVisible = inner.contains(b.minX, b.minY) && inner.contains(b.maxX, b.maxY);
+    if (view.allVisible) return;
+    Rect reach = view.visible.padded(view.trailReach + stepReach);
+    size_t count = grid.count(reach);
+    if (count > snapshot.size() / 8) return;
+    uint32_t* ids = arena.alloc<uint32_t>(count);
+    view.candidateCount = grid.query(reach, ids);
+    view.candidates = ids;
+}
+
+// Slot i only blends from prev when it still holds the same particle there,
+// swapRemove() and spawns hand slots to other particles between snapshots
+static inline float blendWeight(const uint32_t* prevId, const uint32_t* currId, size_t i, float alpha) {
+    return prevId[i] == currId[i] ? alpha : 1.0f;
+}
+
+// Every particle as x, y, temp, straight loops the compiler can vectorise
+static void blendAll(const ParticleSystem& prev, const ParticleSystem& curr, float alpha, float* particleData) {
+    const float *prevX = prev.posX.data(), *prevY = prev.posY.data();
+    const float *currX = curr.posX.data(), *currY = curr.posY.data(), *temp = curr.temp.data();
+    const uint32_t *prevId = prev.id.data(), *currId = curr.id.data();
+    size_t shared = min(prev.size(), curr.size());
+    for (size_t i = 0; i < shared; ++i) {
+        // Store interpolated particle position data for rendering
+        float a = blendWeight(prevId, currId, i, alpha);
+        particleData[3*i] = prevX[i] + (currX[i] - prevX[i]) * a;     // X coordinate
+        particleData[3*i+1] = prevY[i] + (currY[i] - prevY[i]) * a;   // Y coordinate
+        particleData[3*i+2] = temp[i];
+    }
+    for (size_t i = shared; i < curr.size(); ++i) { // spawned since prev
+        particleData[3*i] = currX[i];
+        particleData[3*i+1] = currY[i];
+        particleData[3*i+2] = temp[i];
+    }
+}
+
+// Culled path: only particles whose blended position is visible, and the visible
+// trail points at least view.trailSpacing apart. Fade still comes from the point's
+// place in the full trail so decimated trails look the same, just coarser
+static PackCounts packVisible(const ParticleSystem& prev, const ParticleSystem& curr, float alpha,
+                              float* particleData, float* trailData, const PackView& view) {
+    size_t count = view.candidates ? view.candidateCount : curr.size();
+    size_t particles = 0, trailVertices = 0;
+    // locals, so the stores into particleData can't make the compiler reload them
+    const Rect visible = view.visible;
+    const uint32_t* candidates = view.candidates;
+    const float *prevX = prev.posX.data(), *prevY = prev.posY.data();
+    const float *currX = curr.posX.data(), *currY = curr.posY.data(), *temp = curr.temp.data();
+    const uint32_t *prevId = prev.id.data(), *currId = curr.id.data();
+    size_t shared = min(prev.size(), curr.size());
+
+    if (view.allVisible) {
+        blendAll(prev, curr, alpha, particleData); // nothing to drop
+        particles = curr.size();
+    } else {
+        for (size_t c = 0; c < count; ++c) {
+            size_t i = candidates ? candidates[c] : c;
+            float x = currX[i], y = currY[i];
+            if (i < shared) {
+                float a = blendWeight(prevId, currId, i, alpha);
+                x = prevX[i] + (x - prevX[i]) * a;
+                y = prevY[i] + (y - prevY[i]) * a;
+            }
+            // always written, only kept when visible, so there's no branch to mispredict
+            float* v = particleData + 3 * particles;
+            v[0] = x;
+            v[1] = y;
+            v[2] = temp[i];
+            particles += visible.contains(x, y);
+        }
+    }
+    if (!trailData) return { particles, 0 };
+
+    Rect trailBounds = visible.padded(view.trailReach);
+    float spacing2 = view.trailSpacing * view.trailSpacing;
+    for (size_t c = 0; c < count; ++c) {
+        size_t i = candidates ? candidates[c] : c;
+        if (!trailBounds.contains(currX[i], currY[i])) continue;
+
+        TrailSpan spans[2];
+        curr.trailSpans(i, spans[0], spans[1]);
+        size_t trailSize = curr.trailCount[i];
+        size_t j = 0;
+        float lastX = 0.0f, lastY = 0.0f;
+        bool kept = false;
+        for (const TrailSpan& span : spans) {
+            for (size_t k = 0; k < span.size; ++k, ++j) {
+                Vec2 p = span.data[k];
+                if (!visible.contains(p.x, p.y)) {
+                    kept = false; // start afresh where the trail comes back on screen
+                    continue;
+                }
+                float dx = p.x - lastX, dy = p.y - lastY;
+                if (kept && dx * dx + dy * dy < spacing2) continue;
+                float* v = trailData + 3 * trailVertices++;
+                v[0] = p.x;
+                v[1] = p.y;
+                v[2] = (float)j / trailSize;
+                lastX = p.x;
+                lastY = p.y;
+                kept = true;
+            }
+        }
+    }
+    return { particles, trailVertices };
+}
+
+PackCounts packFrame(const ParticleSystem& prev, const ParticleSystem& curr, float alpha,
+                     float* particleData, float* trailData, const PackView* view) {
+    if (view) return packVisible(prev, curr, alpha, particleData, trailData, *view);
+    blendAll(prev, curr, alpha, particleData);
+    if (!trailData) return { curr.size(), 0 };
+
+    size_t trailVertices = 0;
+    for (size_t i = 0; i < curr.size(); ++i) {
+        // Add trail points to trail data array, oldest first
+        TrailSpan spans[2];
+        curr.trailSpans(i, spans[0], spans[1]);
+        size_t trailSize = curr.trailCount[i];
+        size_t j = 0;
+        for (const TrailSpan& span : spans) {
+            for (size_t k = 0; k < span.size; ++k, ++j) {
+                float* v = trailData + 3 * trailVertices++;
+                v[0] = span.data[k].x;  // X position
+                v[1] = span.data[k].y;  // Y position
+                
+                // Calculate alpha for fading effect (newer points are more opaque)
+                v[2] = (float)j / trailSize;
+            }
+        }
+    }
+    return { curr.size(), trailVertices };
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "spatial_grid.h"
+
+class FrameArena;
+struct ParticleSystem;
+
+// What ends up on screen, so packing can skip everything else
+struct PackView {
+    Rect visible;                           // world rect on screen, padded by the point sprite radius
+    float trailSpacing = 0.0f;              // trail points closer than this to the last one kept are dropped, ~1 pixel
+    float trailReach = 0.0f;                // longest a trail can be, particles further out skip theirs
+    bool allVisible = false;                // every particle is on screen, only trails get culled
+    const uint32_t* candidates = nullptr;   // grid query covering every particle or trail that can be visible,
+    size_t candidateCount = 0;              // nullptr tests them all
+};
+
+// Fill in the rest of view from the grid: trailReach from its top speed,
+// allVisible from its bounds and, when the particles that can touch
+// view.visible are few enough that jumping around beats a straight scan,
+// candidates pointing at them, allocated from this frame's arena
+void gatherCandidates(PackView& view, const UniformGrid& grid, const ParticleSystem& snapshot, float dt,
+                      FrameArena& arena);
+
+struct PackCounts {
+    size_t particles;      // particle vertices written, the black hole goes after them
+    size_t trailVertices;
+};
+
+// Blend prev -> curr by alpha into x, y, temp particle vertices and, when trailData
+// is set, append every trail oldest first as x, y, fade vertices. Slots whose
+// particle id differs between the two (retired and reused) aren't blended. With a view
+// only visible particles are written and trails are decimated to its spacing
+PackCounts packFrame(const ParticleSystem& prev, const ParticleSystem& curr, float alpha,
+                     float* particleData, float* trailData, const PackView* view = nullptr);
@@ -0,0 +1,115 @@
+#include "gpu_physics.h"
+#include "physics.h"
+#include "shader.h"
+#include "trail_history.h"
+#include <vector>
+
+using namespace std;
+
+static const GLuint workgroupSize = 256;
+
+// Same maths as stepScalar, one invocation per particle
+static const char* physicsComputeSrc = R"(
+#version 430 core
+layout(local_size_x = 256) in;
+
+struct Particle {
+    vec2 pos;
+    vec2 vel;
+    float temp;
+    float pad;
+};
+
+layout(std430, binding = 0) buffer Particles {
+    Particle particles[];
+};
+
+// Trail ring, slot-major: slot s of particle i lives at s * uCount + i
+layout(std430, binding = 1) buffer History {
+    vec2 history[];
+};
+
+uniform uint uCount;
+uniform int uHistorySlot;                    // -1 when trails are off
+uniform float uDt;
+uniform float uGM;
+uniform vec2 uCenter;
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= uCount) return;
+    Particle p = particles[i];
+    if (uHistorySlot >= 0) history[uint(uHistorySlot) * uCount + i] = p.pos;
+
+    // Gravitational acceleration toward the black hole
+    vec2 d = p.pos - uCenter;
+    float r2 = dot(d, d);
+    float r = max(sqrt(r2), 5.0);            // prevent singularity
+    vec2 a = -(uGM / r2) * d / r;
+
+    p.vel += a * uDt;
+    p.pos += p.vel * uDt;
+
+    float speed = length(p.vel);
+    float dist = distance(p.pos, uCenter);
+    p.temp = min(speed * 0.01 + 200.0 / max(dist, 10.0), 3.0);
+
+    particles[i] = p;
+}
+)";
+
+void GpuPhysics::init(const ParticleSystem& ps) {
+    count = ps.size();
+    vector<Particle> initial(count);
+    for (size_t i = 0; i < count; ++i) {
+        initial[i] = { ps.posX[i], ps.posY[i], ps.velX[i], ps.velY[i], ps.temp[i], 0.0f };
+    }
+
+    program = createComputeProgram(physicsComputeSrc);
+    countLoc = glGetUniformLocation(program, "uCount");
+    dtLoc = glGetUniformLocation(program, "uDt");
+    gmLoc = glGetUniformLocation(program, "uGM");
+    centerLoc = glGetUniformLocation(program, "uCenter");
+    historySlotLoc = glGetUniformLocation(program, "uHistorySlot");
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(Particle), initial.data(), GL_DYNAMIC_COPY);
+
+    // Same buffer doubles as vertex input for the particle shader: x, y at location 0, temp at 1
+    glGenVertexArrays(1, &vertexArray);
+    glBindVertexArray(vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, x));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, temp));
+    glEnableVertexAttribArray(1);
+}
+
+void GpuPhysics::destroy() {
+    glDeleteVertexArrays(1, &vertexArray);
+    glDeleteBuffers(1, &buffer);
+    glDeleteProgram(program);
+    vertexArray = buffer = program = 0;
+}
+
+void GpuPhysics::step(int steps, float dt, float G, float M, TrailHistory* history) {
+    if (count == 0 || steps <= 0) return;
+
+    glUseProgram(program);
+    glUniform1ui(countLoc, (GLuint)count);
+    glUniform1f(dtLoc, dt);
+    glUniform1f(gmLoc, G * M);
+    glUniform2f(centerLoc, centerX, centerY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+    if (history) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, history->buffer());
+
+    GLuint groups = (GLuint)((count + workgroupSize - 1) / workgroupSize);
+    for (int s = 0; s < steps; ++s) {
+        glUniform1i(historySlotLoc, history ? history->advance() : -1);
+        glDispatchCompute(groups, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    // drawing reads the same buffer as vertex attributes, and trails through a texture buffer
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
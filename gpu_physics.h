@@ -0,0 +1,41 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstddef>
+
+struct ParticleSystem;
+class TrailHistory;
+
+// Compute-shader physics backend (GL 4.3). Particle state lives in one SSBO
+// that the compute pass updates in place; the same buffer object is bound as
+// the vertex buffer for drawing, so particles never travel back to the CPU
+class GpuPhysics {
+public:
+    // Matches the std430 layout of the Particle struct in the compute shader
+    struct Particle {
+        float x, y;
+        float vx, vy;
+        float temp;
+        float pad;
+    };
+
+    static bool supported() { return GLAD_GL_VERSION_4_3 != 0; }
+
+    // Upload the initial state, the CPU copy isn't touched again
+    void init(const ParticleSystem& ps);
+    void destroy();
+
+    // Run `steps` steps of dt, each one a dispatch over every particle. When
+    // given, every step also records the old positions into the next history slot
+    void step(int steps, float dt, float G, float M, TrailHistory* history = nullptr);
+
+    size_t size() const { return count; }
+    GLuint vao() const { return vertexArray; }
+
+private:
+    GLuint program = 0;
+    GLuint buffer = 0;
+    GLuint vertexArray = 0;
+    size_t count = 0;
+    GLint countLoc = -1, dtLoc = -1, gmLoc = -1, centerLoc = -1, historySlotLoc = -1;
+};
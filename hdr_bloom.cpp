@@ -0,0 +1,222 @@
+#include "hdr_bloom.h"
+#include "shader.h"
+#include <algorithm>
+
+using namespace std;
+
+// One triangle that covers the screen, uv 0..1 across the visible part
+static const char* fullscreenVertexSrc = R"(
+#version 330 core
+out vec2 vUv;
+
+void main() {
+    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    vUv = p;
+    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+// 4x4 texels down to one through four bilinear taps. With a threshold > 0 only
+// what's above it comes through, scaled by luminance so colours keep their hue
+static const char* downsampleFragmentSrc = R"(
+#version 330 core
+in vec2 vUv;
+out vec4 FragColor;
+uniform sampler2D uSource;
+uniform vec2 uTexel;                         // source texel size in uv
+uniform float uThreshold;
+
+void main() {
+    vec3 c = texture(uSource, vUv + uTexel * vec2(-1.0, -1.0)).rgb;
+    c += texture(uSource, vUv + uTexel * vec2(1.0, -1.0)).rgb;
+    c += texture(uSource, vUv + uTexel * vec2(-1.0, 1.0)).rgb;
+    c += texture(uSource, vUv + uTexel * vec2(1.0, 1.0)).rgb;
+    c *= 0.25;
+    if (uThreshold > 0.0) {
+        float luma = dot(c, vec3(0.2126, 0.7152, 0.0722));
+        c *= max(luma - uThreshold, 0.0) / max(luma, 1e-4);
+    }
+    FragColor = vec4(c, 1.0);
+}
+)";
+
+// 9-tap Gaussian along uStep in 5 fetches, bilinear filtering does the pairs
+static const char* blurFragmentSrc = R"(
+#version 330 core
+in vec2 vUv;
+out vec4 FragColor;
+uniform sampler2D uSource;
+uniform vec2 uStep;                          // one texel along the blur direction, in uv
+
+void main() {
+    vec3 c = texture(uSource, vUv).rgb * 0.2270270270;
+    c += texture(uSource, vUv + uStep * 1.3846153846).rgb * 0.3162162162;
+    c += texture(uSource, vUv - uStep * 1.3846153846).rgb * 0.3162162162;
+    c += texture(uSource, vUv + uStep * 3.2307692308).rgb * 0.0702702703;
+    c += texture(uSource, vUv - uStep * 3.2307692308).rgb * 0.0702702703;
+    FragColor = vec4(c, 1.0);
+}
+)";
+
+// Scene plus every bloom level, then 1 - exp(-x): linear in the dark, smoothly
+// saturating in the dense middle of the disk
+static const char* compositeFragmentSrc = R"(
+#version 330 core
+in vec2 vUv;
+out vec4 FragColor;
+uniform sampler2D uScene;
+uniform sampler2D uBloom0;
+uniform sampler2D uBloom1;
+uniform sampler2D uBloom2;
+uniform float uStrength;
+uniform float uExposure;
+
+void main() {
+    vec3 bloom = texture(uBloom0, vUv).rgb + texture(uBloom1, vUv).rgb + texture(uBloom2, vUv).rgb;
+    vec3 c = texture(uScene, vUv).rgb + bloom * (uStrength / 3.0);
+    FragColor = vec4(1.0 - exp(-c * uExposure), 1.0);
+}
+)";
+
+void HdrBloom::create() {
+    downsampleProgram = createProgram(fullscreenVertexSrc, downsampleFragmentSrc);
+    downSourceLoc = glGetUniformLocation(downsampleProgram, "uSource");
+    downTexelLoc = glGetUniformLocation(downsampleProgram, "uTexel");
+    downThresholdLoc = glGetUniformLocation(downsampleProgram, "uThreshold");
+    blurProgram = createProgram(fullscreenVertexSrc, blurFragmentSrc);
+    blurSourceLoc = glGetUniformLocation(blurProgram, "uSource");
+    blurStepLoc = glGetUniformLocation(blurProgram, "uStep");
+    compositeProgram = createProgram(fullscreenVertexSrc, compositeFragmentSrc);
+    compSceneLoc = glGetUniformLocation(compositeProgram, "uScene");
+    compBloomLoc[0] = glGetUniformLocation(compositeProgram, "uBloom0");
+    compBloomLoc[1] = glGetUniformLocation(compositeProgram, "uBloom1");
+    compBloomLoc[2] = glGetUniformLocation(compositeProgram, "uBloom2");
+    compStrengthLoc = glGetUniformLocation(compositeProgram, "uStrength");
+    compExposureLoc = glGetUniformLocation(compositeProgram, "uExposure");
+    glGenVertexArrays(1, &emptyVAO);
+}
+
+void HdrBloom::destroy() {
+    release(scene);
+    for (int k = 0; k < levels; ++k) {
+        release(level[k]);
+        release(scratch[k]);
+    }
+    glDeleteVertexArrays(1, &emptyVAO);
+    glDeleteProgram(downsampleProgram);
+    glDeleteProgram(blurProgram);
+    glDeleteProgram(compositeProgram);
+    emptyVAO = downsampleProgram = blurProgram = compositeProgram = 0;
+}
+
+void HdrBloom::resize(Target& t, int width, int height) {
+    if (t.texture && t.width == width && t.height == height) return;
+    release(t);
+    t.width = width;
+    t.height = height;
+    glGenTextures(1, &t.texture);
+    glBindTexture(GL_TEXTURE_2D, t.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &t.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, t.framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t.texture, 0);
+}
+
+void HdrBloom::release(Target& t) {
+    if (t.framebuffer) glDeleteFramebuffers(1, &t.framebuffer);
+    if (t.texture) glDeleteTextures(1, &t.texture);
+    t = Target();
+}
+
+void HdrBloom::allocate(int width, int height) {
+    if (scene.texture && scene.width == width && scene.height == height) return;
+    resize(scene, width, height);
+    int w = width, h = height;
+    for (int k = 0; k < levels; ++k) {
+        // a quarter of the target, then halving
+        w = max(1, (w + (k == 0 ? 3 : 1)) / (k == 0 ? 4 : 2));
+        h = max(1, (h + (k == 0 ? 3 : 1)) / (k == 0 ? 4 : 2));
+        resize(level[k], w, h);
+        resize(scratch[k], w, h);
+    }
+}
+
+void HdrBloom::begin(int width, int height, float r, float g, float b) {
+    allocate(width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene.framebuffer);
+    glViewport(0, 0, width, height);
+    glClearColor(r, g, b, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+}
+
+void HdrBloom::pass(const Target& dst) {
+    glBindFramebuffer(GL_FRAMEBUFFER, dst.framebuffer);
+    glViewport(0, 0, dst.width, dst.height);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void HdrBloom::resolve() {
+    GLint target = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+    glDisable(GL_BLEND);
+    glBindVertexArray(emptyVAO);
+    glActiveTexture(GL_TEXTURE0);
+
+    if (strength > 0.0f) {
+        for (int k = 0; k < levels; ++k) {
+            // the first level comes from the scene through the threshold, the rest from the level above
+            const Target& src = k == 0 ? scene : level[k - 1];
+            glUseProgram(downsampleProgram);
+            glUniform1i(downSourceLoc, 0);
+            // the taps sit one source texel out, so at 4:1 they cover the 4x4 block and at 2:1 its neighbours too
+            glUniform2f(downTexelLoc, 1.0f / src.width, 1.0f / src.height);
+            glUniform1f(downThresholdLoc, k == 0 ? threshold : 0.0f);
+            glBindTexture(GL_TEXTURE_2D, src.texture);
+            pass(level[k]);
+
+            glUseProgram(blurProgram);
+            glUniform1i(blurSourceLoc, 0);
+            glUniform2f(blurStepLoc, 1.0f / level[k].width, 0.0f);
+            glBindTexture(GL_TEXTURE_2D, level[k].texture);
+            pass(scratch[k]);
+            glUniform2f(blurStepLoc, 0.0f, 1.0f / level[k].height);
+            glBindTexture(GL_TEXTURE_2D, scratch[k].texture);
+            pass(level[k]);
+        }
+    } else {
+        // nothing to add, black levels keep the composite the same
+        for (int k = 0; k < levels; ++k) {
+            glBindFramebuffer(GL_FRAMEBUFFER, level[k].framebuffer);
+            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+    }
+
+    glUseProgram(compositeProgram);
+    glUniform1i(compSceneLoc, 0);
+    glBindTexture(GL_TEXTURE_2D, scene.texture);
+    for (int k = 0; k < levels; ++k) {
+        glUniform1i(compBloomLoc[k], k + 1);
+        glActiveTexture(GL_TEXTURE1 + k);
+        glBindTexture(GL_TEXTURE_2D, level[k].texture);
+    }
+    glUniform1f(compStrengthLoc, strength);
+    glUniform1f(compExposureLoc, exposure);
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)target);
+    glViewport(0, 0, scene.width, scene.height);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    for (int k = levels; k >= 0; --k) {
+        glActiveTexture(GL_TEXTURE0 + k);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
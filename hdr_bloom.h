@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Order-independent glow. The scene is drawn into a half-float target with
+// additive blending (GL_SRC_ALPHA, GL_ONE), so overlapping points just sum and
+// dense regions go past 1 instead of depending on draw order. resolve() then
+// picks out what's brighter than `threshold`, blurs it through a chain of
+// separable Gaussians at 1/4, 1/8 and 1/16 of the target size, adds it back
+// and tonemaps. The post passes cost the same however many particles overlap
+class HdrBloom {
+public:
+    static const int levels = 3;
+
+    float threshold = 1.0f; // only light above this blooms, one lone particle peaks at about 1
+    float strength = 0.6f;  // bloom added on top of the scene, 0 skips the blur passes
+    float exposure = 1.0f;
+
+    void create();
+    void destroy();
+
+    // Draw into the float target from here on, (re)allocated at this size and
+    // cleared to the background. Sets the additive blend
+    void begin(int width, int height, float r, float g, float b);
+    // Bloom and tonemap into whichever framebuffer is bound, over the whole of
+    // it at the target size. Leaves blending on with the usual alpha blend for
+    // whatever is drawn on top
+    void resolve();
+
+private:
+    struct Target {
+        GLuint texture = 0, framebuffer = 0;
+        int width = 0, height = 0;
+    };
+
+    void allocate(int width, int height);
+    static void resize(Target& t, int width, int height);
+    static void release(Target& t);
+    void pass(const Target& dst);
+
+    Target scene;
+    Target level[levels];  // blurred bloom at each size
+    Target scratch[levels]; // horizontal pass of the blur
+    GLuint emptyVAO = 0;    // full screen triangles come from gl_VertexID
+    GLuint downsampleProgram = 0, blurProgram = 0, compositeProgram = 0;
+    GLint downSourceLoc = -1, downTexelLoc = -1, downThresholdLoc = -1;
+    GLint blurSourceLoc = -1, blurStepLoc = -1;
+    GLint compSceneLoc = -1, compBloomLoc[levels] = { -1, -1, -1 }, compStrengthLoc = -1, compExposureLoc = -1;
+};
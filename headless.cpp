@@ -0,0 +1,340 @@
+// Headless batch runner: same physics as orbit, no window or GL context,
+// for compute nodes without a display
+#include "attractors.h"
+#include "diagnostics.h"
+#include "initial_conditions.h"
+#include "integrators.h"
+#include "lifecycle.h"
+#include "morton_sort.h"
+#include "physics.h"
+#include "sim_config.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+#include "trajectory.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+static void usage(const char* prog) {
+    cerr << "Usage: " << prog << " [--particles N] [--steps S] [--threads T] [--trail L]"
+         << " [--config FILE] [--set particles|trail|dt|G|M=VALUE]..."
+         << " [--dt DT] [--seed SEED] [--dump FILE] [--nbody] [--theta T] [--disk-mass MASS]"
+         << " [--integrator NAME] [--force central|pw|geodesic|nbody|attractors] [--precision float|double]"
+         << " [--checkpoint FILE] [--checkpoint-every S] [--resume FILE]"
+         << " [--trajectory FILE] [--traj-stride S] [--traj-subset BEGIN:END[:EVERY]] [--diag-every K]"
+         << " [--sort-every K] [--sph H[:ALPHA[:ENERGY[:COOLING]]]]"
+         << " [--emit ring:RMIN:RMAX[:RATE] | jet:X:Y:VX:VY:SPREAD:RATE]... [--max-particles N]"
+         << " [--escape-radius R] [--no-retire]"
+         << " [--attractor X:Y:MASS[:RADIUS:PERIOD[:PHASE]]]... [--binary SEP[:Q]] [--halo V0[:CORE]]"
+         << " [--uniform-field AX:AY] [--field-grid auto|on|off]"
+         << " [--init disk[:RMIN:RMAX] | ring:RADIUS:WIDTH | kepler:RMIN:RMAX[:SIGMA]]\n";
+    cerr << "Integrators:\n";
+    for (size_t i = 0; i < integratorCount; ++i) {
+        cerr << "  " << integrators[i].name << " - " << integrators[i].description << "\n";
+    }
+}
+
+// Write the final state as CSV, one particle per row in id order, so it
+// doesn't depend on how often the store was sorted
+static bool dumpState(const ParticleSystem& ps, const char* path) {
+    ofstream out(path);
+    if (!out) return false;
+    out << "x,y,vx,vy,temp,id,generation\n";
+    for (uint32_t k = 0; k < ps.nextId; ++k) {
+        uint32_t i = ps.slotOf[k];
+        if (i == ParticleSystem::noSlot) continue;
+        out << ps.posX[i] << ',' << ps.posY[i] << ',' << ps.velX[i] << ',' << ps.velY[i] << ',' << ps.temp[i] << ','
+            << k << ',' << ps.generation[k] << '\n';
+    }
+    return (bool)out;
+}
+
+int main(int argc, char** argv) {
+    size_t particleCount = 1000000;
+    bool particlesSet = false;
+    size_t steps = 1000;
+    size_t trailLength = maxTrailLength;
+    bool trailSet = false;
+    const char* configPath = nullptr; // --config and --set, read once at startup; the flags above still win
+    ParamOverrides overrides;
+    unsigned numThreads = 0;
+    float dt = defaultDt;
+    bool dtSet = false;
+    unsigned seed = (unsigned)time(nullptr);
+    const char* dumpPath = nullptr;
+    ForceModel force = ForceModel::Central;
+    Precision precision = Precision::Float;
+    NBodyParams nbody;
+    float diskMass = defaultDiskMass;
+    const IntegratorInfo* integrator = &integrators[0];
+    const char* checkpointPath = nullptr;
+    size_t checkpointEvery = 0; // 0 = only at the end
+    const char* resumePath = nullptr;
+    const char* trajectoryPath = nullptr;
+    TrajectoryOptions trajectory;
+    size_t diagEvery = 0; // energy and angular momentum every K steps, 0 = never
+    size_t sortEvery = defaultSortEvery; // Morton order every K steps, 0 = never
+    trajectory.dropWhenFull = false; // nothing to keep smooth here, a batch run wants every frame
+    bool retire = true;              // capture, escape and respawn through a Lifecycle
+    vector<Emitter> emitters;
+    size_t maxParticles = 0;
+    float escapeRadius = 2.0f * width;
+    AttractorField scene; // --attractor and friends, they imply --force attractors
+    bool gas = false;     // --sph
+    SphParams sph;
+    InitDistribution initDist;
+
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--particles") == 0 && hasValue) {
+            particleCount = strtoull(argv[++i], nullptr, 10);
+            particlesSet = true;
+        } else if (strcmp(argv[i], "--steps") == 0 && hasValue) {
+            steps = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            numThreads = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--trail") == 0 && hasValue) {
+            trailLength = strtoull(argv[++i], nullptr, 10);
+            trailSet = true;
+        } else if (strcmp(argv[i], "--config") == 0 && hasValue) {
+            configPath = argv[++i];
+        } else if (strcmp(argv[i], "--set") == 0 && hasValue && parseOverride(argv[i + 1], overrides)) {
+            ++i;
+        } else if (strcmp(argv[i], "--dt") == 0 && hasValue) {
+            dt = (float)atof(argv[++i]);
+            dtSet = true;
+        } else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+            seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--dump") == 0 && hasValue) {
+            dumpPath = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && hasValue) {
+            checkpointPath = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && hasValue) {
+            checkpointEvery = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--resume") == 0 && hasValue) {
+            resumePath = argv[++i];
+        } else if (strcmp(argv[i], "--trajectory") == 0 && hasValue) {
+            trajectoryPath = argv[++i];
+        } else if (strcmp(argv[i], "--traj-stride") == 0 && hasValue) {
+            trajectory.stride = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--traj-subset") == 0 && hasValue && parseTrajectorySubset(argv[i + 1], trajectory)) {
+            ++i;
+        } else if (strcmp(argv[i], "--diag-every") == 0 && hasValue) {
+            diagEvery = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--sort-every") == 0 && hasValue) {
+            sortEvery = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--sph") == 0 && hasValue && parseSph(argv[i + 1], sph)) {
+            ++i;
+            gas = true;
+        } else if (strcmp(argv[i], "--emit") == 0 && hasValue) {
+            Emitter e;
+            if (!parseEmitter(argv[++i], e)) {
+                cerr << "Bad emitter " << argv[i] << "\n";
+                return -1;
+            }
+            emitters.push_back(e);
+        } else if (strcmp(argv[i], "--max-particles") == 0 && hasValue) {
+            maxParticles = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--escape-radius") == 0 && hasValue) {
+            escapeRadius = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--no-retire") == 0) {
+            retire = false;
+        } else if (strcmp(argv[i], "--attractor") == 0 && hasValue) {
+            Attractor a;
+            if (!parseAttractor(argv[++i], a)) {
+                cerr << "Bad attractor " << argv[i] << "\n";
+                return -1;
+            }
+            scene.bodies.push_back(a);
+            force = ForceModel::Attractors;
+        } else if (strcmp(argv[i], "--binary") == 0 && hasValue) {
+            if (!parseBinary(argv[++i], scene.bodies)) {
+                cerr << "Bad binary " << argv[i] << "\n";
+                return -1;
+            }
+            force = ForceModel::Attractors;
+        } else if (strcmp(argv[i], "--halo") == 0 && hasValue && parseHalo(argv[i + 1], scene.external)) {
+            ++i;
+            force = ForceModel::Attractors;
+        } else if (strcmp(argv[i], "--uniform-field") == 0 && hasValue && parseUniformField(argv[i + 1], scene.external)) {
+            ++i;
+            force = ForceModel::Attractors;
+        } else if (strcmp(argv[i], "--field-grid") == 0 && hasValue && parseFieldGrid(argv[i + 1], scene.gridMode)) {
+            ++i;
+        } else if (strcmp(argv[i], "--init") == 0 && hasValue && parseInitDistribution(argv[i + 1], initDist)) {
+            ++i;
+        } else if (strcmp(argv[i], "--integrator") == 0 && hasValue && findIntegrator(argv[i + 1])) {
+            integrator = findIntegrator(argv[++i]);
+        } else if (strcmp(argv[i], "--force") == 0 && hasValue && parseForceModel(argv[i + 1], force)) {
+            ++i;
+        } else if (strcmp(argv[i], "--precision") == 0 && hasValue && parsePrecision(argv[i + 1], precision)) {
+            ++i;
+        } else if (strcmp(argv[i], "--nbody") == 0) {
+            force = ForceModel::NBody; // shorthand for --force nbody
+        } else if (strcmp(argv[i], "--theta") == 0 && hasValue) {
+            nbody.theta = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--disk-mass") == 0 && hasValue) {
+            diskMass = (float)atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    SimParams params;
+    params.particles = particleCount;
+    params.trailLength = trailLength;
+    params.dt = dt;
+    if (!loadParams(configPath, overrides, params)) return -1;
+    if (!particlesSet) particleCount = params.particles;
+    if (!trailSet) trailLength = params.trailLength;
+    if (!dtSet) dt = params.dt;
+    initDist.gm = params.G * params.M;
+
+    const char* kernelName;
+    selectStepKernel(&kernelName);
+    ThreadPool pool(numThreads);
+
+    ParticleSystem particles;
+    SnapshotInfo run;
+    if (resumePath) {
+        auto loadStart = chrono::steady_clock::now();
+        MappedSnapshot snapshot;
+        if (!snapshot.open(resumePath)) return -1;
+        snapshot.load(particles, &pool);
+        run = snapshot.info();
+        if (dtSet) run.dt = dt;
+        dt = run.dt;
+        seed = (unsigned)run.seed;
+        particleCount = particles.size();
+        trailLength = particles.trailLength;
+        cout << "resumed " << resumePath << " at step " << run.step << " in "
+             << chrono::duration<double>(chrono::steady_clock::now() - loadStart).count() << " s" << endl;
+    } else {
+        auto initStart = chrono::steady_clock::now();
+        initParticles(particles, particleCount, trailLength, seed, initDist, &pool);
+        cout << "init: " << initShapeName(initDist.shape) << " in "
+             << chrono::duration<double>(chrono::steady_clock::now() - initStart).count() << " s" << endl;
+        run.seed = seed;
+        run.dt = dt;
+    }
+
+    nbody.particleMass = particleCount > 0 ? diskMass / particleCount : 0.0f;
+    Lifecycle lifecycle;
+    if (retire) {
+        lifecycle.gm = params.G * params.M;
+        lifecycle.configure(particles, seed, emitters, maxParticles);
+        lifecycle.escapeRadius = escapeRadius;
+    }
+    Stepper stepper;
+    stepper.select(integrator->name, force, precision);
+    stepper.context.nbody = nbody;
+    stepper.context.G = params.G;
+    stepper.context.M = params.M;
+    stepper.attractors = scene;
+    stepper.time = run.time;
+    stepper.gas = gas;
+    sph.particleMass = particleCount > 0 ? diskMass / particleCount : 1.0f;
+    if (sph.smoothing == 0.0f) sph.smoothing = run.smoothing; // a resumed run keeps the h it picked
+    stepper.sph = sph;
+
+    cout << "particles: " << particleCount << ", steps: " << steps << ", trail: " << trailLength
+         << ", threads: " << pool.size() << ", kernel: " << kernelName << ", seed: " << seed
+         << ", integrator: " << integrator->name << ", force: " << forceModelName(force)
+         << ", precision: " << precisionName(precision) << endl;
+    if (force == ForceModel::NBody) cout << "n-body: theta " << nbody.theta << ", disk mass " << diskMass << endl;
+    if (gas) {
+        cout << "sph: alpha " << sph.alpha << ", energy floor " << sph.minEnergy << ", cooling time "
+             << sph.coolingTime << endl;
+    }
+    if (force == ForceModel::Attractors) {
+        cout << "attractors: " << max<size_t>(scene.bodies.size(), 1) << (scene.moving() ? " moving" : " static")
+             << ", field: " << (scene.usesGrid() ? "cached grid" : "direct sum") << endl;
+    }
+
+    TrajectoryWriter trajectoryWriter;
+    if (trajectoryPath && !trajectoryWriter.open(trajectoryPath, particles.nextId, trajectory)) {
+        cerr << "Failed to open " << trajectoryPath << "\n";
+        return -1;
+    }
+
+    SnapshotWriter checkpoints;
+    MortonSorter sorter;
+    DriftMonitor drift;
+    auto start = chrono::steady_clock::now();
+    for (size_t s = 0; s < steps; ++s) {
+        if (sortEvery > 0 && run.step % sortEvery == 0) sorter.sort(particles, &pool);
+        Diagnostics measured;
+        bool measuring = diagEvery > 0 && (run.step + 1) % diagEvery == 0;
+        stepper.step(particles, pool, dt, measuring ? &measured : nullptr);
+        run.step++;
+        run.time += dt;
+        run.smoothing = stepper.hydro.smoothing();
+        if (measuring) drift.observe(run.step, measured);
+        if (retire) {
+            if (force == ForceModel::Attractors) stepper.attractors.positionsAt(run.time, lifecycle.holes);
+            const ForceContext* measure = diagEvery > 0 ? &stepper.context : nullptr;
+            LifecycleStats changed = lifecycle.update(particles, run.step, dt, measure, force);
+            drift.exchange(changed.retiredSum, changed.spawnedSum);
+        }
+        trajectoryWriter.record(run.step, run.time, particles, &drift);
+        if (checkpointPath && checkpointEvery > 0 && (s + 1) % checkpointEvery == 0 && s + 1 < steps) {
+            // still busy with the last one means we're checkpointing faster than the disk, skip this one
+            checkpoints.submit(checkpointPath, particles, run);
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (trajectoryPath) {
+        trajectoryWriter.close();
+        cout << "trajectory: " << trajectoryWriter.framesWritten() << " frames written, "
+             << trajectoryWriter.framesDropped() << " dropped" << endl;
+    }
+
+    if (checkpointPath) {
+        checkpoints.wait();
+        if (!writeSnapshot(checkpointPath, particles, run)) {
+            cerr << "Failed to write " << checkpointPath << "\n";
+            return -1;
+        }
+    }
+
+    double stepsPerSec = seconds > 0.0 ? steps / seconds : 0.0;
+    cout << "elapsed: " << seconds << " s, " << stepsPerSec << " steps/s, "
+         << stepsPerSec * particleCount << " particle-steps/s" << endl;
+    if (retire) {
+        const LifecycleStats& t = lifecycle.totals();
+        cout << "lifecycle: " << t.captured << " captured, " << t.escaped << " escaped, " << t.spawned
+             << " spawned, " << particles.size() << " live of " << lifecycle.capacity << endl;
+    }
+
+    if (gas && steps > 0) {
+        cout << "sph: h " << stepper.hydro.smoothing() << ", " << stepper.hydro.meanNeighbours()
+             << " neighbours per particle, Courant dt " << stepper.hydro.courantDt();
+        if (dt > stepper.hydro.courantDt()) cout << " (dt is past it)";
+        cout << endl;
+    }
+
+    if (stepper.overTolerance > 0) {
+        cout << "rk45: " << stepper.overTolerance << " particle-steps hit the " << rkMaxSubsteps
+             << " substep cap and were accepted over tolerance" << endl;
+    }
+
+    if (drift.measured()) {
+        const Diagnostics& d = drift.latest();
+        cout << "diagnostics at step " << drift.step() << ": energy " << d.energy() << " (drift " << drift.energyDrift()
+             << "), angular momentum " << d.angularMomentum << " (drift " << drift.momentumDrift() << ")" << endl;
+    }
+
+    if (dumpPath && !dumpState(particles, dumpPath)) {
+        cerr << "Failed to write " << dumpPath << "\n";
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "initial_conditions.h"
+#include "rng.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+bool parseInitDistribution(const char* spec, InitDistribution& dist) {
+    InitDistribution d;
+    if (strcmp(spec, "disk") == 0) {
+        d.shape = InitShape::Disk;
+    } else if (strncmp(spec, "disk:", 5) == 0) {
+        if (sscanf(spec + 5, "%f:%f", &d.innerRadius, &d.outerRadius) != 2) return false;
+        d.shape = InitShape::Disk;
+    } else if (strncmp(spec, "ring:", 5) == 0) {
+        float radius, ringWidth;
+        if (sscanf(spec + 5, "%f:%f", &radius, &ringWidth) != 2 || ringWidth < 0.0f) return false;
+        d.innerRadius = radius - 0.5f * ringWidth;
+        d.outerRadius = radius + 0.5f * ringWidth;
+        d.shape = InitShape::Ring;
+    } else if (strncmp(spec, "kepler:", 7) == 0) {
+        if (sscanf(spec + 7, "%f:%f:%f", &d.innerRadius, &d.outerRadius, &d.dispersion) < 2 || d.dispersion < 0.0f) {
+            return false;
+        }
+        d.shape = InitShape::Kepler;
+    } else {
+        return false;
+    }
+    if (!(d.innerRadius > 0.0f) || d.outerRadius < d.innerRadius) return false;
+    dist = d;
+    return true;
+}
+
+const char* initShapeName(InitShape shape) {
+    static const char* names[] = { "disk", "ring", "kepler" };
+    return names[(int)shape];
+}
+
+void sampleOrbit(const InitDistribution& dist, const uint32_t random[4], Vec2& pos, Vec2& vel) {
+    float c, s;
+    rngDirection(random[0], c, s);
+    float u = rngUnit(random[1]);
+    float inner = dist.innerRadius, outer = dist.outerRadius;
+    // the kepler disk is uniform per unit area, so its radius goes as sqrt(u)
+    float radius = dist.shape == InitShape::Kepler ? sqrt(inner * inner + u * (outer * outer - inner * inner))
+                                                   : inner + u * (outer - inner);
+    float circular = sqrt(dist.gm / radius); // stable orbit velocity: = sqrt(GM/r)
+    float tangential = dist.shape == InitShape::Disk ? 0.9f * circular : circular;
+    float radial = 0.0f;
+    if (dist.shape == InitShape::Kepler) {
+        float n0, n1;
+        rngNormal(random[2], random[3], n0, n1);
+        radial = n0 * dist.dispersion * circular;
+        tangential += n1 * dist.dispersion * circular;
+    }
+    pos = { centerX + radius * c, centerY + radius * s };
+    vel = { radial * c - tangential * s, radial * s + tangential * c };
+}
+
+void initParticles(ParticleSystem& ps, size_t n, size_t trailLength, uint64_t seed,
+                   const InitDistribution& dist, ThreadPool* pool) {
+    size_t base = ps.size(), total = base + n;
+    ps.reserve(total, trailLength);
+    ps.posX.resize(total); ps.posY.resize(total);
+    ps.velX.resize(total); ps.velY.resize(total);
+    ps.accX.resize(total); ps.accY.resize(total);
+    ps.temp.resize(total, 1.0f);
+    ps.stepSize.resize(total);
+    ps.internalEnergy.resize(total);
+    ps.trailPool.resize(total * trailLength);
+    ps.trailHead.resize(total);
+    ps.trailCount.resize(total);
+    ps.id.resize(total);
+    // ids up front, serially: free ones first, then new ones off the end
+    uint32_t* id = ps.id.data() + base;
+    for (size_t i = 0; i < n; ++i) id[i] = ps.takeId(base + i);
+
+    // Everything above is zeroed already, chunks only write what they draw
+    const Philox rng(seed);
+    float* posX = ps.posX.data() + base; float* posY = ps.posY.data() + base;
+    float* velX = ps.velX.data() + base; float* velY = ps.velY.data() + base;
+    auto fill = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t k = id[i];
+            uint32_t counter[4] = { (uint32_t)k, (uint32_t)(k >> 32), ps.generation[id[i]], RngInit }, random[4];
+            rng(counter, random);
+            Vec2 pos, vel;
+            sampleOrbit(dist, random, pos, vel);
+            posX[i] = pos.x; posY[i] = pos.y;
+            velX[i] = vel.x; velY[i] = vel.y;
+        }
+    };
+    if (pool) pool->parallelFor(n, physicsChunkSize, fill);
+    else fill(0, n);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "physics.h"
+
+class ThreadPool;
+
+// How the starting particles are spread around the hole
+enum class InitShape {
+    Disk,   // radius uniform between inner and outer at 0.9 of circular speed, the original start
+    Ring,   // thin annulus on exactly circular orbits
+    Kepler, // uniform over the annulus area, circular speed plus a Gaussian velocity dispersion
+};
+
+struct InitDistribution {
+    InitShape shape = InitShape::Disk;
+    float innerRadius = 50.0f, outerRadius = 300.0f;
+    float dispersion = 0.1f; // kepler: spread of each velocity component as a fraction of circular speed
+    float gm = G * M;        // of the central hole, circular speed is sqrt(gm / r)
+};
+
+// "disk[:RMIN:RMAX]", "ring:RADIUS:WIDTH" or "kepler:RMIN:RMAX[:SIGMA]"
+bool parseInitDistribution(const char* spec, InitDistribution& dist);
+const char* initShapeName(InitShape shape);
+
+// One particle around the centre from four random words
+void sampleOrbit(const InitDistribution& dist, const uint32_t random[4], Vec2& pos, Vec2& vel);
+
+// Append n particles. Each only depends on the seed and the id and generation
+// it gets through a Philox counter, so chunks fill in parallel on the pool, a
+// seed gives the same state on any thread count, and particles appended later
+// (a config reload raising the count) never repeat earlier ones, even on a
+// reused id
+void initParticles(ParticleSystem& ps, size_t n, size_t trailLength, uint64_t seed,
+                   const InitDistribution& dist = InitDistribution(), ThreadPool* pool = nullptr);
@@ -0,0 +1,374 @@
+#include "integrators.h"
+#include "physics.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// One particle's state while a scheme works on it, Real precision throughout
+template <typename Real>
+struct Body {
+    Real x, y, vx, vy, ax, ay;
+    Real stepSize; // adaptive schemes: the substep that worked last time, 0 = none yet
+    bool overTolerance = false; // RK45: the substep cap made it accept an error over tolerance
+};
+
+// Drift-kick-drift leapfrog over h, one force evaluation and x, v in sync at both ends
+template <typename Real, typename Force>
+inline void leapfrogDKD(Body<Real>& b, Real h, const Force& force) {
+    b.x += b.vx * (Real)0.5 * h;
+    b.y += b.vy * (Real)0.5 * h;
+    force(b.x, b.y, b.vx, b.vy, b.ax, b.ay); // drifts keep L, so v from before the kick is right for geodesic
+    b.vx += b.ax * h;
+    b.vy += b.ay * h;
+    b.x += b.vx * (Real)0.5 * h;
+    b.y += b.vy * (Real)0.5 * h;
+}
+
+// Semi-implicit Euler, the original scheme
+struct Euler {
+    static constexpr const char* name = "euler";
+    static constexpr const char* description = "semi-implicit Euler (SIMD for central, pw, geodesic and attractors in float)";
+
+    template <typename Real, typename Force>
+    static void advance(Body<Real>& b, Real dt, const Force& force) {
+        force(b.x, b.y, b.vx, b.vy, b.ax, b.ay);
+        b.vx += b.ax * dt;
+        b.vy += b.ay * dt;
+        b.x += b.vx * dt;
+        b.y += b.vy * dt;
+    }
+};
+
+struct Leapfrog {
+    static constexpr const char* name = "leapfrog";
+    static constexpr const char* description = "drift-kick-drift leapfrog / velocity Verlet, 2nd order";
+
+    template <typename Real, typename Force>
+    static void advance(Body<Real>& b, Real dt, const Force& force) {
+        leapfrogDKD(b, dt, force);
+    }
+};
+
+// Yoshida's 4th order composition of three leapfrogs
+struct Yoshida {
+    static constexpr const char* name = "yoshida";
+    static constexpr const char* description = "Yoshida 4th order, three leapfrogs per step";
+
+    template <typename Real, typename Force>
+    static void advance(Body<Real>& b, Real dt, const Force& force) {
+        const Real w1 = (Real)(1.0 / (2.0 - cbrt(2.0)));
+        const Real w0 = (Real)1 - 2 * w1;
+        leapfrogDKD(b, w1 * dt, force);
+        leapfrogDKD(b, w0 * dt, force);
+        leapfrogDKD(b, w1 * dt, force);
+    }
+};
+
+// Dormand-Prince 5(4) with a per-particle adaptive substep. The substep that
+// worked last time is kept in ps.stepSize so each particle starts from its own scale
+struct RK45 {
+    static constexpr const char* name = "rk45";
+    static constexpr const char* description = "Dormand-Prince 5(4) with adaptive per-particle substeps";
+
+    template <typename Real>
+    struct State {
+        Real x, y, vx, vy;
+    };
+
+    template <typename Real, typename Force>
+    static State<Real> derivative(const State<Real>& s, const Force& force) {
+        State<Real> d = { s.vx, s.vy, 0, 0 };
+        force(s.x, s.y, s.vx, s.vy, d.vx, d.vy);
+        return d;
+    }
+
+    // s + h * sum(k[j] * a[j])
+    template <typename Real>
+    static State<Real> combine(const State<Real>& s, Real h, const State<Real>* k, const double* a, int stages) {
+        State<Real> r = s;
+        for (int j = 0; j < stages; ++j) {
+            Real ha = h * (Real)a[j];
+            r.x += ha * k[j].x;
+            r.y += ha * k[j].y;
+            r.vx += ha * k[j].vx;
+            r.vy += ha * k[j].vy;
+        }
+        return r;
+    }
+
+    template <typename Real, typename Force>
+    static void advance(Body<Real>& b, Real dt, const Force& force) {
+        static const double a2[] = { 1.0/5 };
+        static const double a3[] = { 3.0/40, 9.0/40 };
+        static const double a4[] = { 44.0/45, -56.0/15, 32.0/9 };
+        static const double a5[] = { 19372.0/6561, -25360.0/2187, 64448.0/6561, -212.0/729 };
+        static const double a6[] = { 9017.0/3168, -355.0/33, 46732.0/5247, 49.0/176, -5103.0/18656 };
+        static const double b5[] = { 35.0/384, 0.0, 500.0/1113, 125.0/192, -2187.0/6784, 11.0/84 };
+        // b5 - b4, the last term belongs to the seventh (first-same-as-last) stage
+        static const double e[] = { 71.0/57600, 0.0, -71.0/16695, 71.0/1920, -17253.0/339200, 22.0/525, -1.0/40 };
+
+        State<Real> s = { b.x, b.y, b.vx, b.vy };
+        Real h = b.stepSize > 0 ? b.stepSize : dt;
+        Real t = 0;
+
+        for (int step = 0; t < dt; ++step) {
+            bool last = step + 1 >= rkMaxSubsteps;
+            Real hTry = last ? dt - t : min(h, dt - t);
+
+            State<Real> k[7];
+            k[0] = derivative(s, force);
+            k[1] = derivative(combine(s, hTry, k, a2, 1), force);
+            k[2] = derivative(combine(s, hTry, k, a3, 2), force);
+            k[3] = derivative(combine(s, hTry, k, a4, 3), force);
+            k[4] = derivative(combine(s, hTry, k, a5, 4), force);
+            k[5] = derivative(combine(s, hTry, k, a6, 5), force);
+            State<Real> next = combine(s, hTry, k, b5, 6);
+            k[6] = derivative(next, force);
+
+            State<Real> err = combine(State<Real>{ 0, 0, 0, 0 }, hTry, k, e, 7);
+            Real errPos = sqrt(err.x * err.x + err.y * err.y);
+            Real errVel = sqrt(err.vx * err.vx + err.vy * err.vy) * dt;
+            Real ratio = max(errPos, errVel) / (Real)rkTolerance;
+
+            bool accepted = ratio <= 1 || last;
+            if (accepted) {
+                s = next;
+                t += hTry;
+            }
+            if (ratio > 1 && last) b.overTolerance = true;
+            // A step clipped to land on dt says nothing about h, so an accepted
+            // one keeps the proposal and the next step starts from that
+            Real factor = ratio > 0 ? (Real)0.9 * pow(ratio, (Real)-0.2) : (Real)5;
+            if (!(accepted && hTry < h)) h = hTry * min((Real)5, max((Real)0.2, factor));
+        }
+
+        b.x = s.x;
+        b.y = s.y;
+        b.vx = s.vx;
+        b.vy = s.vy;
+        force(b.x, b.y, b.vx, b.vy, b.ax, b.ay);
+        b.stepSize = h;
+    }
+};
+
+// Block timesteps: each particle takes 2^level leapfrog substeps, level picked
+// from how strongly it is being pulled and how close it is to the nearest hole.
+// The outer disk stays at level 0 while particles near a hole get sub-stepped,
+// and everyone meets again at dt
+struct Block {
+    static constexpr const char* name = "block";
+    static constexpr const char* description = "leapfrog with power-of-two block timesteps per particle";
+
+    template <typename Real, typename Force>
+    static void advance(Body<Real>& b, Real dt, const Force& force) {
+        Real ax, ay;
+        force(b.x, b.y, b.vx, b.vy, ax, ay);
+        Real r = max(force.distance(b.x, b.y), (Real)5);
+        Real a = sqrt(ax*ax + ay*ay);
+        Real wanted = a > 0 ? (Real)blockEta * sqrt(r / a) : dt;
+
+        int level = 0;
+        while (level < maxBlockLevel && dt / (Real)(1 << level) > wanted) level++;
+
+        int substeps = 1 << level;
+        Real h = dt / (Real)substeps;
+        for (int s = 0; s < substeps; ++s) leapfrogDKD(b, h, force);
+    }
+};
+
+// The generic kernel: load, run the scheme, store. Scheme and Force are both
+// resolved at compile time, so each instantiation is one straight loop
+template <typename Scheme, typename Force, typename Real>
+void runKernel(ParticleSystem& ps, size_t begin, size_t end, float dt, const ForceContext& ctx) {
+    Force force(ctx);
+    const Real h = (Real)dt;
+    uint64_t overTolerance = 0;
+    for (size_t i = begin; i < end; ++i) {
+        bindParticle(force, i);
+        Body<Real> b = { ps.posX[i], ps.posY[i], ps.velX[i], ps.velY[i], ps.accX[i], ps.accY[i], ps.stepSize[i] };
+        Scheme::advance(b, h, force);
+        overTolerance += b.overTolerance;
+        ps.posX[i] = (float)b.x;
+        ps.posY[i] = (float)b.y;
+        ps.velX[i] = (float)b.vx;
+        ps.velY[i] = (float)b.vy;
+        ps.accX[i] = (float)b.ax;
+        ps.accY[i] = (float)b.ay;
+        ps.stepSize[i] = (float)b.stepSize;
+    }
+    if (overTolerance > 0 && ctx.overTolerance) ctx.overTolerance->fetch_add(overTolerance, memory_order_relaxed);
+    calcTemp(ps.posX.data() + begin, ps.posY.data() + begin, ps.velX.data() + begin, ps.velY.data() + begin,
+             ps.temp.data() + begin, end - begin);
+}
+
+// Euler around the central mass in float is the hot path, it keeps the hand-written SIMD kernels
+void eulerSimd(ParticleSystem& ps, size_t begin, size_t end, float dt, const ForceContext& ctx) {
+    static const StepKernel kernel = [] { const char* name; return selectStepKernel(&name); }();
+    kernel(ps.posX.data() + begin, ps.posY.data() + begin,
+           ps.velX.data() + begin, ps.velY.data() + begin,
+           ps.accX.data() + begin, ps.accY.data() + begin,
+           ps.temp.data() + begin, end - begin, dt, ctx.G, ctx.M);
+}
+
+// pw and geodesic in float get a fused SIMD kernel of their own too
+void eulerPw(ParticleSystem& ps, size_t begin, size_t end, float dt, const ForceContext& ctx) {
+    static const HoleKernel kernel = selectHoleKernel();
+    kernel(ps.posX.data() + begin, ps.posY.data() + begin,
+           ps.velX.data() + begin, ps.velY.data() + begin,
+           ps.accX.data() + begin, ps.accY.data() + begin,
+           ps.temp.data() + begin, end - begin, dt, ctx.G * ctx.M, blackHoleRadius, 0.0f);
+}
+
+void eulerGeodesic(ParticleSystem& ps, size_t begin, size_t end, float dt, const ForceContext& ctx) {
+    static const HoleKernel kernel = selectHoleKernel();
+    kernel(ps.posX.data() + begin, ps.posY.data() + begin,
+           ps.velX.data() + begin, ps.velY.data() + begin,
+           ps.accX.data() + begin, ps.accY.data() + begin,
+           ps.temp.data() + begin, end - begin, dt, ctx.G * ctx.M, 0.0f, 1.5f * blackHoleRadius);
+}
+
+// Same for several holes: the field takes the whole chunk at once, through
+// its grid or its SIMD direct sum, then the usual integrate pass
+void eulerAttractors(ParticleSystem& ps, size_t begin, size_t end, float dt, const ForceContext& ctx) {
+    size_t n = end - begin;
+    float* ax = ps.accX.data() + begin;
+    float* ay = ps.accY.data() + begin;
+    ctx.attractors->accelerations(ps.posX.data() + begin, ps.posY.data() + begin, ax, ay, n);
+    integrate(ps.posX.data() + begin, ps.posY.data() + begin, ps.velX.data() + begin, ps.velY.data() + begin,
+              ax, ay, ps.temp.data() + begin, n, dt);
+}
+
+struct KernelEntry {
+    const char* integrator;
+    ForceModel force;
+    Precision precision;
+    Integrator kernel;
+};
+
+template <typename Scheme, typename Real>
+void addScheme(vector<KernelEntry>& table, Precision precision) {
+    table.push_back({ Scheme::name, ForceModel::Central, precision, runKernel<Scheme, CentralForce<Real>, Real> });
+    table.push_back({ Scheme::name, ForceModel::PseudoNewtonian, precision,
+                      runKernel<Scheme, PseudoNewtonianForce<Real>, Real> });
+    table.push_back({ Scheme::name, ForceModel::NBody, precision, runKernel<Scheme, NBodyForce<Real>, Real> });
+    table.push_back({ Scheme::name, ForceModel::Attractors, precision, runKernel<Scheme, AttractorForce<Real>, Real> });
+    table.push_back({ Scheme::name, ForceModel::Geodesic, precision, runKernel<Scheme, SchwarzschildForce<Real>, Real> });
+}
+
+template <typename Scheme>
+void addScheme(vector<KernelEntry>& table) {
+    addScheme<Scheme, float>(table, Precision::Float);
+    addScheme<Scheme, double>(table, Precision::Double);
+}
+
+const vector<KernelEntry>& kernelTable() {
+    static const vector<KernelEntry> table = [] {
+        vector<KernelEntry> t;
+        t.push_back({ Euler::name, ForceModel::Central, Precision::Float, eulerSimd }); // found before the generic one
+        t.push_back({ Euler::name, ForceModel::Attractors, Precision::Float, eulerAttractors });
+        t.push_back({ Euler::name, ForceModel::PseudoNewtonian, Precision::Float, eulerPw });
+        t.push_back({ Euler::name, ForceModel::Geodesic, Precision::Float, eulerGeodesic });
+        addScheme<Euler>(t);
+        addScheme<Leapfrog>(t);
+        addScheme<Yoshida>(t);
+        addScheme<RK45>(t);
+        addScheme<Block>(t);
+        return t;
+    }();
+    return table;
+}
+
+} // namespace
+
+const IntegratorInfo integrators[] = {
+    { Euler::name, Euler::description },
+    { Leapfrog::name, Leapfrog::description },
+    { Yoshida::name, Yoshida::description },
+    { RK45::name, RK45::description },
+    { Block::name, Block::description },
+};
+const size_t integratorCount = sizeof(integrators) / sizeof(integrators[0]);
+
+const IntegratorInfo* findIntegrator(const char* name) {
+    for (size_t i = 0; i < integratorCount; ++i) {
+        if (strcmp(integrators[i].name, name) == 0) return &integrators[i];
+    }
+    return nullptr;
+}
+
+static const char* forceModelNames[] = { "central", "pw", "nbody", "attractors", "geodesic" };
+static const char* precisionNames[] = { "float", "double" };
+
+const char* forceModelName(ForceModel force) { return forceModelNames[(int)force]; }
+const char* precisionName(Precision precision) { return precisionNames[(int)precision]; }
+
+bool parseForceModel(const char* name, ForceModel& force) {
+    for (int i = 0; i < (int)(sizeof(forceModelNames) / sizeof(forceModelNames[0])); ++i) {
+        if (strcmp(forceModelNames[i], name) == 0) {
+            force = (ForceModel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parsePrecision(const char* name, Precision& precision) {
+    for (int i = 0; i < 2; ++i) {
+        if (strcmp(precisionNames[i], name) == 0) {
+            precision = (Precision)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+Integrator findKernel(const char* integrator, ForceModel force, Precision precision) {
+    for (const KernelEntry& e : kernelTable()) {
+        if (e.force == force && e.precision == precision && strcmp(e.integrator, integrator) == 0) return e.kernel;
+    }
+    return nullptr;
+}
+
+void advanceParticles(ParticleSystem& ps, ThreadPool& pool, float dt, Integrator kernel,
+                      const ForceContext& ctx, size_t chunkSize, Diagnostics* measured, ForceModel force) {
+    pool.parallelFor(ps.size(), chunkSize, [&](size_t begin, size_t end) {
+        recordTrails(ps, begin, end);
+        kernel(ps, begin, end, dt, ctx);
+        if (measured) measureRange(ps, begin, end, force, ctx, measured[begin / chunkSize]);
+    });
+}
+
+bool Stepper::select(const char* integrator, ForceModel forceModel, Precision precision) {
+    Integrator k = findKernel(integrator, forceModel, precision);
+    if (!k) return false;
+    kernel = k;
+    force = forceModel;
+    return true;
+}
+
+void Stepper::step(ParticleSystem& ps, ThreadPool& pool, float dt, Diagnostics* measured) {
+    context.overTolerance = &overTolerance;
+    if (force == ForceModel::Attractors) {
+        attractors.setTime(time, context.G, &pool);
+        context.attractors = &attractors;
+    }
+    size_t chunkSize = force == ForceModel::NBody ? BarnesHutTree::walkChunkSize : physicsChunkSize;
+    if (measured) chunkDiagnostics.assign((ps.size() + chunkSize - 1) / chunkSize, Diagnostics());
+    if (force == ForceModel::NBody) {
+        tree.build(ps.posX.data(), ps.posY.data(), ps.size(), context.nbody.particleMass, pool);
+        context.tree = &tree;
+    }
+    if (gas) hydro.kick(ps, pool, dt, sph);
+    advanceParticles(ps, pool, dt, kernel, context, chunkSize, measured ? chunkDiagnostics.data() : nullptr, force);
+    if (gas) hydro.setTemperatures(ps, pool, sph);
+    if (measured) {
+        *measured = Diagnostics();
+        for (const Diagnostics& d : chunkDiagnostics) measured->add(d);
+    }
+    time += dt;
+}
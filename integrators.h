@@ -0,0 +1,77 @@
+#pragma once
+
+#include "barnes_hut.h"
+#include "diagnostics.h"
+#include "forces.h"
+#include "sph.h"
+#include <cstddef>
+#include <vector>
+
+class ThreadPool;
+struct ParticleSystem;
+
+// Advance particles [begin, end) by dt and refresh their temperature. Kernels
+// never touch particles outside their range, so any of them can run on thread
+// pool chunks. Every integrator x force model x precision combination is its
+// own template instantiation, picked once at startup with findKernel
+typedef void (*Integrator)(ParticleSystem& ps, size_t begin, size_t end, float dt, const ForceContext& ctx);
+
+enum class Precision { Float, Double };
+
+struct IntegratorInfo {
+    const char* name;
+    const char* description;
+};
+
+// Every integrator selectable with --integrator, the first one is the default
+extern const IntegratorInfo integrators[];
+extern const size_t integratorCount;
+
+// nullptr when no integrator has that name
+const IntegratorInfo* findIntegrator(const char* name);
+
+// Name <-> enum for --force and --precision, parse* return false on unknown names
+const char* forceModelName(ForceModel force);
+const char* precisionName(Precision precision);
+bool parseForceModel(const char* name, ForceModel& force);
+bool parsePrecision(const char* name, Precision& precision);
+
+// The instantiation for this combination, nullptr when the integrator is unknown
+Integrator findKernel(const char* integrator, ForceModel force, Precision precision);
+
+// Record trails then run `kernel` over every particle, split across the pool.
+// Given `measured`, every chunk also sums its diagnostics under `force` into
+// measured[begin / chunkSize] straight after its kernel, while it's still in cache
+void advanceParticles(ParticleSystem& ps, ThreadPool& pool, float dt, Integrator kernel,
+                      const ForceContext& ctx, size_t chunkSize,
+                      Diagnostics* measured = nullptr, ForceModel force = ForceModel::Central);
+
+// A chosen kernel plus the state its force model keeps between steps
+struct Stepper {
+    ForceModel force = ForceModel::Central;
+    Integrator kernel = nullptr;
+    ForceContext context;
+    BarnesHutTree tree;
+    AttractorField attractors; // attractors only, holes frozen where they are at the start of each step
+    double time = 0.0;         // simulated time, moves attractors. Set it when resuming
+    bool gas = false;          // SPH pressure and viscosity on top of the force model, temp from internal energy
+    SphParams sph;
+    SphSolver hydro;
+    std::atomic<uint64_t> overTolerance{0}; // RK45: particle-steps accepted over tolerance at the substep cap, whole run
+
+    // false when the combination isn't registered
+    bool select(const char* integrator, ForceModel force, Precision precision);
+    // One step of dt, rebuilding the tree first in N-body mode, placing the holes first with attractors
+    // and kicking with the gas forces first in SPH mode.
+    // Given `measured`, fills it with the diagnostics of the state the step ends on
+    void step(ParticleSystem& ps, ThreadPool& pool, float dt, Diagnostics* measured = nullptr);
+
+private:
+    std::vector<Diagnostics> chunkDiagnostics; // one per chunk, summed in chunk order so any thread count agrees
+};
+
+// Tuning for the adaptive schemes
+const float rkTolerance = 1e-3f;     // RK45: allowed local error in px (velocity error is scaled by dt)
+const int rkMaxSubsteps = 256;       // RK45: a particle never takes more substeps than this per step
+const float blockEta = 0.02f;        // block: substep <= eta * sqrt(r / |a|)
+const int maxBlockLevel = 10;        // block: at most 2^10 substeps per step
@@ -0,0 +1,118 @@
+#include "lifecycle.h"
+#include "initial_conditions.h"
+#include "rng.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+bool parseEmitter(const char* spec, Emitter& emitter) {
+    Emitter e;
+    float rate = 0.0f;
+    if (strncmp(spec, "ring:", 5) == 0) {
+        int got = sscanf(spec + 5, "%f:%f:%f", &e.innerRadius, &e.outerRadius, &rate);
+        if (got < 2 || e.innerRadius <= 0.0f || e.outerRadius < e.innerRadius) return false;
+        e.shape = EmitterShape::Ring;
+    } else if (strncmp(spec, "jet:", 4) == 0) {
+        if (sscanf(spec + 4, "%f:%f:%f:%f:%f:%f", &e.x, &e.y, &e.vx, &e.vy, &e.spread, &rate) != 6) return false;
+        if (rate <= 0.0f) return false; // a jet has nothing to refill
+        e.shape = EmitterShape::Jet;
+    } else {
+        return false;
+    }
+    if (rate < 0.0f) return false;
+    e.rate = rate;
+    emitter = e;
+    return true;
+}
+
+void Lifecycle::configure(ParticleSystem& ps, uint64_t runSeed, const vector<Emitter>& given, size_t maxParticles) {
+    seed = runSeed;
+    emitters = given.empty() ? vector<Emitter>(1) : given;
+    bool grows = false;
+    for (const Emitter& e : emitters) grows = grows || e.rate > 0.0f;
+    capacity = maxParticles > 0 ? maxParticles : ps.size() * (grows ? 2 : 1);
+    capacity = max(capacity, ps.size());
+    ps.reserve(capacity, ps.trailLength);
+}
+
+void Lifecycle::spawn(ParticleSystem& ps, const Emitter& e, uint64_t step, float dt, size_t emitterIndex, size_t count) {
+    count = min(count, capacity > ps.size() ? capacity - ps.size() : 0);
+    const Philox rng(seed);
+    InitDistribution ring; // same orbits initParticles starts on
+    ring.innerRadius = e.innerRadius;
+    ring.outerRadius = e.outerRadius;
+    ring.gm = gm;
+    for (size_t k = 0; k < count; ++k) {
+        uint32_t counter[4] = { (uint32_t)k, (uint32_t)step, (uint32_t)(step >> 32),
+                                RngSpawn | (uint32_t)emitterIndex << 8 }, random[4];
+        rng(counter, random);
+        Vec2 pos, vel;
+        if (e.shape == EmitterShape::Ring) {
+            sampleOrbit(ring, random, pos, vel);
+        } else {
+            vel = { e.vx + (2.0f * rngUnit(random[1]) - 1.0f) * e.spread, e.vy + (2.0f * rngUnit(random[2]) - 1.0f) * e.spread };
+            float age = rngUnit(random[3]) * dt; // left during the step, not all at once from the same point
+            pos = { e.x + vel.x * age, e.y + vel.y * age };
+        }
+        ps.add(pos, vel, 1.0f);
+    }
+    total.spawned += count;
+}
+
+LifecycleStats Lifecycle::update(ParticleSystem& ps, uint64_t step, float dt, const ForceContext* measure,
+                                 ForceModel force) {
+    LifecycleStats stats;
+    float capture2 = captureRadius * captureRadius, escape2 = escapeRadius * escapeRadius;
+    for (size_t i = 0; i < ps.size();) {
+        float dx = ps.posX[i] - centerX, dy = ps.posY[i] - centerY;
+        float r2 = dx * dx + dy * dy;
+        bool captured = r2 < capture2;
+        if (!holes.empty()) {
+            captured = false;
+            for (const Vec2& h : holes) {
+                float hx = ps.posX[i] - h.x, hy = ps.posY[i] - h.y;
+                captured = captured || hx * hx + hy * hy < capture2;
+            }
+        }
+        if (captured) {
+            stats.captured++;
+        } else if (!(r2 <= escape2)) { // NaN counts as gone too
+            stats.escaped++;
+        } else {
+            ++i;
+            continue;
+        }
+        if (measure) {
+            Diagnostics d;
+            measureRange(ps, i, i + 1, force, *measure, d);
+            if (isfinite(d.kinetic + d.angularMomentum)) stats.retiredSum.add(d); // a NaN particle shows up as drift
+        }
+        ps.swapRemove(i); // slot i now holds the old last particle, look at it again
+    }
+    size_t retired = stats.captured + stats.escaped;
+
+    // Refill emitters share the retired count, rate emitters follow simulated time
+    size_t refills = 0;
+    for (const Emitter& e : emitters) refills += e.rate == 0.0f;
+    size_t before = total.spawned, live = ps.size();
+    size_t refillIndex = 0;
+    for (size_t k = 0; k < emitters.size(); ++k) {
+        const Emitter& e = emitters[k];
+        size_t count;
+        if (e.rate == 0.0f) {
+            count = retired / refills + (refillIndex++ < retired % refills);
+        } else {
+            double t1 = (double)step * dt, t0 = (double)(step - 1) * dt;
+            count = (size_t)(floor(e.rate * t1) - floor(e.rate * t0));
+        }
+        if (count > 0) spawn(ps, e, step, dt, k, count);
+    }
+    stats.spawned = total.spawned - before;
+    if (measure && ps.size() > live) measureRange(ps, live, ps.size(), force, *measure, stats.spawnedSum);
+    total.captured += stats.captured;
+    total.escaped += stats.escaped;
+    return stats;
+}
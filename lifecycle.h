@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "diagnostics.h"
+#include "physics.h"
+
+// Where respawned particles come from
+enum class EmitterShape {
+    Ring, // near-circular orbits in an annulus around the hole, like initParticles
+    Jet,  // from one point with one velocity, jittered, each spawn a random part of the step along its way
+};
+
+struct Emitter {
+    EmitterShape shape = EmitterShape::Ring;
+    float rate = 0.0f;                  // particles per unit of simulated time, 0 = refill what was retired
+    float innerRadius = 50.0f, outerRadius = 300.0f; // ring
+    float x = centerX, y = centerY;     // jet origin
+    float vx = 0.0f, vy = 0.0f;         // jet velocity
+    float spread = 0.0f;                // jet: +- on each velocity component
+};
+
+// "ring:RMIN:RMAX[:RATE]" or "jet:X:Y:VX:VY:SPREAD:RATE"
+bool parseEmitter(const char* spec, Emitter& emitter);
+
+struct LifecycleStats {
+    size_t captured = 0, escaped = 0, spawned = 0;
+    // What the retired and the spawned particles carried when they changed,
+    // for DriftMonitor::exchange. Only summed when update() is given a context
+    Diagnostics retiredSum, spawnedSum;
+};
+
+// Retires particles that fell into the hole or left for good and spawns new ones
+// from the emitters. Live particles stay packed in [0, size()) through
+// swapRemove(), so every kernel only walks live data, and the store is reserved
+// for `capacity` once so steady state never allocates. Spawns are drawn from a
+// Philox counter of (step, emitter, index) under the seed, a resumed run
+// spawns the same particles
+class Lifecycle {
+public:
+    float captureRadius = blackHoleRadius;
+    float escapeRadius = 2.0f * width;  // from the hole
+    size_t capacity = 0;                // most live particles, spawns past it are skipped
+    uint64_t seed = 0;
+    float gm = G * M;                   // central hole, for the circular speed of ring spawns
+    std::vector<Emitter> emitters;      // empty = only retire
+    std::vector<Vec2> holes;            // capture around each of these, empty = the one at the centre
+
+    // No emitters given means one refill ring shaped like the initial disk.
+    // maxParticles 0 keeps the live count with refills only and allows twice it
+    // when a rate emitter can grow the population. Reserves ps for the capacity
+    void configure(ParticleSystem& ps, uint64_t seed, const std::vector<Emitter>& emitters, size_t maxParticles);
+
+    // Run after the step that took the state to `step`. Given `measure`, also
+    // sums the diagnostics of every particle it retires or spawns under `force`
+    LifecycleStats update(ParticleSystem& ps, uint64_t step, float dt, const ForceContext* measure = nullptr,
+                          ForceModel force = ForceModel::Central);
+
+    const LifecycleStats& totals() const { return total; } // counts only
+
+private:
+    void spawn(ParticleSystem& ps, const Emitter& e, uint64_t step, float dt, size_t emitterIndex, size_t count);
+
+    LifecycleStats total;
+};
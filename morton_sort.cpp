@@ -0,0 +1,142 @@
+#include "morton_sort.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+
+namespace {
+
+const size_t maxChunks = 16; // like UniformGrid::build, at most this many histograms per digit
+
+// 16 bits spread out to the even bits of 32
+inline uint32_t spreadBits(uint32_t v) {
+    v &= 0xffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// Position along one side of the area to 0..65535, clamped in float so
+// far-off (or NaN) positions can't overflow the int
+inline uint32_t quantize(float v, float lo, float scale) {
+    float f = min(max((v - lo) * scale, 0.0f), 65535.0f);
+    if (!(f == f)) f = 0.0f;
+    return (uint32_t)f;
+}
+
+} // namespace
+
+uint32_t MortonSorter::key(float x, float y) const {
+    float sx = 65536.0f / (area.maxX - area.minX), sy = 65536.0f / (area.maxY - area.minY);
+    return spreadBits(quantize(x, area.minX, sx)) | (spreadBits(quantize(y, area.minY, sy)) << 1);
+}
+
+void MortonSorter::sort(ParticleSystem& ps, ThreadPool* pool) {
+    size_t n = ps.size();
+    if (n < 2) return;
+    keys.resize(n); keyScratch.resize(n);
+    order.resize(n); orderScratch.resize(n);
+
+    size_t chunkSize = max(physicsChunkSize, (n + maxChunks - 1) / maxChunks);
+    size_t chunks = (n + chunkSize - 1) / chunkSize;
+    auto run = [&](const function<void(size_t, size_t)>& body) {
+        if (pool) pool->parallelFor(n, chunkSize, body);
+        else for (size_t b = 0; b < n; b += chunkSize) body(b, min(n, b + chunkSize));
+    };
+
+    // Keys, plus which bits differ anywhere so constant digits can be skipped.
+    // Chunk bit masks go in chunkCounts, two words a chunk
+    chunkCounts.assign(chunks * 256, 0);
+    run([&](size_t begin, size_t end) {
+        uint32_t any = 0, all = ~0u;
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t k = key(ps.posX[i], ps.posY[i]);
+            keys[i] = k;
+            order[i] = (uint32_t)i;
+            any |= k;
+            all &= k;
+        }
+        chunkCounts[begin / chunkSize * 2] = any;
+        chunkCounts[begin / chunkSize * 2 + 1] = all;
+    });
+    uint32_t any = 0, all = ~0u;
+    for (size_t k = 0; k < chunks; ++k) {
+        any |= chunkCounts[k * 2];
+        all &= chunkCounts[k * 2 + 1];
+    }
+    uint32_t varying = any ^ all;
+
+    // LSD radix, one stable counting sort per 8 bit digit: per chunk histograms,
+    // offsets digit-major then chunk, every chunk scatters on its own
+    for (int shift = 0; shift < 32; shift += 8) {
+        if (((varying >> shift) & 0xff) == 0) continue;
+        chunkCounts.assign(chunks * 256, 0);
+        run([&](size_t begin, size_t end) {
+            uint32_t* counts = chunkCounts.data() + begin / chunkSize * 256;
+            for (size_t i = begin; i < end; ++i) counts[(keys[i] >> shift) & 0xff]++;
+        });
+        uint32_t offset = 0;
+        for (size_t d = 0; d < 256; ++d) {
+            for (size_t k = 0; k < chunks; ++k) {
+                uint32_t count = chunkCounts[k * 256 + d];
+                chunkCounts[k * 256 + d] = offset;
+                offset += count;
+            }
+        }
+        run([&](size_t begin, size_t end) {
+            uint32_t* next = chunkCounts.data() + begin / chunkSize * 256;
+            for (size_t i = begin; i < end; ++i) {
+                uint32_t at = next[(keys[i] >> shift) & 0xff]++;
+                keyScratch[at] = keys[i];
+                orderScratch[at] = order[i];
+            }
+        });
+        keys.swap(keyScratch);
+        order.swap(orderScratch);
+    }
+
+    // Gather every array into the second store and swap the two. It's reserved
+    // like ps so the swap hands ps back the capacity the lifecycle reserved
+    size_t len = ps.trailLength;
+    sorted.reserve(ps.posX.capacity(), len);
+    sorted.posX.resize(n); sorted.posY.resize(n);
+    sorted.velX.resize(n); sorted.velY.resize(n);
+    sorted.accX.resize(n); sorted.accY.resize(n);
+    sorted.temp.resize(n);
+    sorted.stepSize.resize(n);
+    sorted.internalEnergy.resize(n);
+    sorted.trailPool.resize(n * len);
+    sorted.trailHead.resize(n);
+    sorted.trailCount.resize(n);
+    sorted.id.resize(n);
+    run([&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            size_t from = order[i];
+            sorted.posX[i] = ps.posX[from]; sorted.posY[i] = ps.posY[from];
+            sorted.velX[i] = ps.velX[from]; sorted.velY[i] = ps.velY[from];
+            sorted.accX[i] = ps.accX[from]; sorted.accY[i] = ps.accY[from];
+            sorted.temp[i] = ps.temp[from];
+            sorted.stepSize[i] = ps.stepSize[from];
+            sorted.internalEnergy[i] = ps.internalEnergy[from];
+            copy(ps.trailPool.begin() + from * len, ps.trailPool.begin() + (from + 1) * len,
+                 sorted.trailPool.begin() + i * len);
+            sorted.trailHead[i] = ps.trailHead[from];
+            sorted.trailCount[i] = ps.trailCount[from];
+            sorted.id[i] = ps.id[from];
+            ps.slotOf[ps.id[from]] = (uint32_t)i; // only live ids move, the rest stay noSlot
+        }
+    });
+    ps.posX.swap(sorted.posX); ps.posY.swap(sorted.posY);
+    ps.velX.swap(sorted.velX); ps.velY.swap(sorted.velY);
+    ps.accX.swap(sorted.accX); ps.accY.swap(sorted.accY);
+    ps.temp.swap(sorted.temp);
+    ps.stepSize.swap(sorted.stepSize);
+    ps.internalEnergy.swap(sorted.internalEnergy);
+    ps.trailPool.swap(sorted.trailPool);
+    ps.trailHead.swap(sorted.trailHead);
+    ps.trailCount.swap(sorted.trailCount);
+    ps.id.swap(sorted.id);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "physics.h"
+#include "spatial_grid.h"
+
+class ThreadPool;
+
+// Steps between sorts for --sort-every
+const size_t defaultSortEvery = 200;
+
+// Reorders the particle store along a Z-order (Morton) curve, so particles
+// that are close in space sit close in memory. Orbits smear the initial order
+// out within a few turns, and everything that visits neighbours after that
+// (the Barnes-Hut build, the culling grid and what it hands the packer) jumps
+// all over the arrays. Sorting every few hundred steps keeps those passes
+// walking mostly forward through memory.
+//
+// Keys are 16 bits of x and y over `area` interleaved, positions off it clamp
+// to its edge. The sort is a least significant digit radix sort of (key, slot)
+// in 8 bit digits, each digit counted and scattered per chunk on the pool like
+// UniformGrid::build, so it's stable and gives the same order on any thread
+// count. Digits every key agrees on are skipped. Every array then moves in
+// one gather into a second store, with each whole trail ring going along with
+// its particle; the second store is kept for the next sort, so this holds the
+// particle state twice. ids travel with their particles and slotOf is
+// rebuilt, so anything that names particles by id doesn't notice
+class MortonSorter {
+public:
+    Rect area = { -(float)width, -(float)height, 2.0f * width, 2.0f * height }; // same as the culling grid
+
+    void sort(ParticleSystem& ps, ThreadPool* pool = nullptr);
+
+    // Morton code of a point on area, exposed for the bench and tools
+    uint32_t key(float x, float y) const;
+
+private:
+    std::vector<uint32_t> keys, keyScratch;
+    std::vector<uint32_t> order, orderScratch; // order[new slot] = old slot
+    std::vector<uint32_t> chunkCounts;         // 256 per chunk per digit
+    ParticleSystem sorted;
+};
@@ -1,124 +1,221 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include "alloc_counter.h"
+#include "attractors.h"
+#include "barnes_hut.h"
+#include "diagnostics.h"
+#include "frame_arena.h"
+#include "frame_pack.h"
+#include "gpu_physics.h"
+#include "hdr_bloom.h"
+#include "initial_conditions.h"
+#include "integrators.h"
+#include "lifecycle.h"
+#include "morton_sort.h"
+#include "physics.h"
+#include "profiler.h"
+#include "profiler_overlay.h"
+#include "shader.h"
+#include "sim_config.h"
+#include "snapshot.h"
+#include "spatial_grid.h"
+#include "stream_buffer.h"
+#include "state_exchange.h"
+#include "thread_pool.h"
+#include "trail_history.h"
+#include "trajectory.h"
+#include "video_recorder.h"
 #include <vector>
 #include <cmath>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <string>
 
 using namespace std;
 
-// Simple 2D vector
-struct Vec2 {
-    float x, y;
+// Everything the render thread needs from one simulation step
+struct SimSnapshot {
+    ParticleSystem particles; // only positions, temperatures and trails are filled in
+    UniformGrid grid;         // where those particles are, for culling
+    std::vector<Vec2> holes;  // every black hole, just the centre one unless it's an attractor scene
+    uint64_t step = 0;
+    double time = 0.0;        // seconds on the steady clock when it was published
+    uint64_t layout = 0;      // bumped by every Morton sort, slots before and after hold different particles
 };
 
-// Particle
-struct Particle {
-    Vec2 pos;
-    Vec2 vel;
-    vector<Vec2> trail;
-    float temp;
-    size_t maxTrailLength = 50;
+// How trails get to the screen
+enum class TrailMode {
+    Cpu, // packed from the snapshot's trail rings every frame, drawn as points
+    Gpu, // newest position appended to a TrailHistory ring each step, drawn as line strips
+    Off,
 };
 
-const int width = 800, height = 600;
-const float G = 200.0f, M = 2000.0f;
-const int numParticles = 100;
-const float centerX = (float)width / 2;
-const float centerY = (float)height / 2;
-const float blackHoleRadius = 15.0f;
-const float accretionDiskRadius = 80.0f;
-
-// Gravitational acceleration toward origin (black hole at center)
-Vec2 gravity(Vec2 pos, float G, float M) {
-    float dx = pos.x - centerX; // computer x displacement
-    float dy = pos.y - centerY; // computer y displacement
-    float r2 = dx*dx + dy*dy;
-    float r = sqrt(r2);
-    if (r < 5.0f) r = 5.0f; // prevent singularity
-    float F = G * M / r2; // F = magnitude of acceleration
-    return { -F * dx / r, -F * dy / r }; // we create an acceleration vecotr towards the blackhole
+// Copy the fields rendering reads, vector assignment reuses capacity so this
+// stops allocating once every snapshot slot has seen the full particle count.
+// Trail rings are only copied when the renderer packs them itself
+void copyRenderState(const ParticleSystem& src, ParticleSystem& dst, bool trails = true) {
+    dst.posX = src.posX;
+    dst.posY = src.posY;
+    dst.temp = src.temp;
+    dst.id = src.id;
+    dst.generation = src.generation;
+    if (!trails) return;
+    dst.trailLength = src.trailLength;
+    dst.trailPool = src.trailPool;
+    dst.trailHead = src.trailHead;
+    dst.trailCount = src.trailCount;
 }
 
-float calcTemp(const Particle& p) {
-    float speed = sqrt(p.vel.x * p.vel.x + p.vel.y * p.vel.y);
-    float dist = sqrt((p.pos.x - centerX) * (p.pos.x - centerX) + (p.pos.y - centerY) * (p.pos.y - centerY));
-
-    float temp = speed * 0.01f + (200.0f / max(dist, 10.0f));
-
-    return min(temp, 3.0f);
+// Recreate a vertex stream with room for `bytes` a frame, plus some headroom,
+// when it has less: a config reload raised the particle count or trail length.
+// Points vao at the new buffer with the x, y, one float layout both streams use.
+// Returns whether it grew, the caller then begins its write again
+bool growStream(StreamBuffer& stream, GLuint vao, size_t bytes) {
+    if (bytes <= stream.capacity()) return false;
+    const size_t stride = 3 * sizeof(float);
+    stream.destroy();
+    glBindVertexArray(vao);
+    stream.create(GL_ARRAY_BUFFER, (bytes / stride + bytes / stride / 4 + 1) * stride);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)(2 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    return true;
 }
 
-// Update particle
-void updateParticle(Particle &p, float dt, float G, float M) {
+const int maxGpuStepsPerFrame = 16; // GPU backend, also the step count when --sim-rate is 0
+
+const char* windowTitle = "Black Hole OpenGL";
 
-    p.trail.push_back(p.pos);
-    if (p.trail.size() > p.maxTrailLength) {
-        p.trail.erase(p.trail.begin());
+// Per-zone milliseconds averaged over the last 30 frames, CPU then GPU
+void setProfilerTitle(GLFWwindow* window, const Profiler& profiler, FrameArena& arena) {
+    size_t frames = min<size_t>(30, profiler.framesRecorded());
+    if (frames == 0) return;
+    float frameMs = 0.0f;
+    for (size_t age = 0; age < frames; ++age) frameMs += profiler.frameMs(age) / frames;
+    const size_t capacity = 512; // every zone twice at "name 0000.00" fits with room to spare
+    char* title = arena.alloc<char>(capacity);
+    size_t length = snprintf(title, capacity, "%s | frame %.2f ms | cpu", windowTitle, frameMs);
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 1) length += snprintf(title + length, capacity - length, " | gpu");
+        for (int z = 0; z < profileZoneCount; ++z) {
+            if (pass == 1 && (z == ZonePack || z == ZoneSwap)) continue; // no GPU side
+            float ms = 0.0f;
+            for (size_t age = 0; age < frames; ++age) {
+                ms += (pass == 0 ? profiler.cpuMs(age, (ProfileZone)z) : profiler.gpuMs(age, (ProfileZone)z)) / frames;
+            }
+            length += snprintf(title + length, capacity - length, " %s %.2f", profileZoneNames[z], ms);
+            length = min(length, capacity - 1); // snprintf says what it would have written
+        }
+    }
+    float energyDrift = profiler.energyDrift(0), momentumDrift = profiler.momentumDrift(0);
+    if (energyDrift == energyDrift || momentumDrift == momentumDrift) { // nbody has no energy, only dL
+        snprintf(title + length, capacity - length, " | dE %.2e dL %.2e", energyDrift, momentumDrift);
     }
+    glfwSetWindowTitle(window, title);
+}
 
-    Vec2 a = gravity(p.pos, G, M); // create the acceleration vector
-    p.vel.x += a.x * dt; // add one unit of acceleration to velocities
-    p.vel.y += a.y * dt;
-    p.pos.x += p.vel.x * dt; // update positions using velocity
-    p.pos.y += p.vel.y * dt;
+// Mouse state between frames, scroll arrives through the callback
+struct ViewInput {
+    double scroll = 0.0;
+    bool dragging = false;
+    double lastX = 0.0, lastY = 0.0;
+};
 
-    p.temp = calcTemp(p);
+void onScroll(GLFWwindow* window, double, double yoffset) {
+    static_cast<ViewInput*>(glfwGetWindowUserPointer(window))->scroll += yoffset;
 }
 
+void updateView(GLFWwindow* window, ViewInput& input, View& view) {
+    if (glfwGetKey(window, GLFW_KEY_HOME) == GLFW_PRESS) view = View();
 
-// to do: get colour based on temp and distance to blackhole
+    int windowWidth, windowHeight;
+    glfwGetWindowSize(window, &windowWidth, &windowHeight);
+    if (windowWidth <= 0 || windowHeight <= 0) return;
+    double cx, cy;
+    glfwGetCursorPos(window, &cx, &cy);
+    // cursor in logical screen units, y up like the world
+    float sx = (float)(cx * width / windowWidth), sy = (float)(height - cy * height / windowHeight);
 
-Vec2 getParticleColour(float temp, float dist) {
-    Vec2 colour;
-    
-    // Accretion disk effect: particles close to black hole are very hot and bright
-    if (dist < accretionDiskRadius) {
-        // Very hot accretion disk particles: white to blue
-        float diskFactor = 1.0f - (dist / accretionDiskRadius);
-        colour.x = 0.8f + diskFactor * 0.2f;  // Red component
-        colour.y = 0.9f + diskFactor * 0.1f;  // Green component
-        return colour; // Blue will be 1.0 in shader
+    if (input.scroll != 0.0) {
+        // keep the world point under the cursor where it is
+        float wx = view.x + (sx - centerX) / view.zoom, wy = view.y + (sy - centerY) / view.zoom;
+        view.zoom = min(64.0f, max(0.05f, view.zoom * (float)pow(1.15, input.scroll)));
+        view.x = wx - (sx - centerX) / view.zoom;
+        view.y = wy - (sy - centerY) / view.zoom;
+        input.scroll = 0.0;
     }
-    
-    // Normal particles: color based on temperature
-    if (temp > 2.0f) {
-        // Very hot: white/blue
-        colour.x = 1.0f;
-        colour.y = 1.0f;
-    } else if (temp > 1.0f) {
-        // Hot: yellow/white
-        colour.x = 1.0f;
-        colour.y = 1.0f;
-    } else {
-        // Cool: red/orange
-        colour.x = 1.0f;
-        colour.y = 0.3f + temp * 0.4f;
+
+    bool down = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+    if (down && input.dragging) {
+        view.x -= (float)((cx - input.lastX) * width / windowWidth) / view.zoom;
+        view.y += (float)((cy - input.lastY) * height / windowHeight) / view.zoom;
     }
-    
-    return colour;
+    input.dragging = down;
+    input.lastX = cx;
+    input.lastY = cy;
+}
+
+double steadySeconds() {
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 // Shader sources
+// Particle colour comes from temperature and distance to the black hole, worked
+// out per vertex so the whole particle set draws in a single call
 const char* vertexShaderSrc = R"(
 #version 330 core
 layout(location = 0) in vec2 aPos;
+layout(location = 1) in float aTemp;
 uniform float uScreenWidth;
 uniform float uScreenHeight;
+uniform vec2 uCenter;
+uniform float uDiskRadius;
+uniform bool uFixedColor;                    // draw everything in uColor instead (black hole)
+uniform vec3 uColor;
+uniform float uPointScale;                   // render height / 600, keeps points the same size at any resolution
+uniform vec3 uView;                          // world x, y at the screen centre and zoom
+out vec3 vColor;
+
+vec3 particleColour(float temp, float dist) {
+    // Accretion disk effect: particles close to black hole are very hot and bright
+    if (dist < uDiskRadius) {
+        // Very hot accretion disk particles: white to blue
+        float diskFactor = 1.0 - (dist / uDiskRadius);
+        return vec3(0.8 + diskFactor * 0.2, 0.9 + diskFactor * 0.1, 1.0);
+    }
+
+    // Normal particles: color based on temperature
+    if (temp > 2.0) {
+        return vec3(1.0, 1.0, 0.2);              // Very hot: white/blue
+    } else if (temp > 1.0) {
+        return vec3(1.0, 1.0, 0.2);              // Hot: yellow/white
+    }
+    return vec3(1.0, 0.3 + temp * 0.4, 0.2);     // Cool: red/orange
+}
+
 void main() {
-    float x = (aPos.x / uScreenWidth) * 2.0 - 1.0;
-    float y = (aPos.y / uScreenHeight) * 2.0 - 1.0;
+    float x = (aPos.x - uView.x) * uView.z / uScreenWidth * 2.0;
+    float y = (aPos.y - uView.y) * uView.z / uScreenHeight * 2.0;
     gl_Position = vec4(x, y, 0.0, 1.0);
-    gl_PointSize = 10.0;
+    gl_PointSize = 10.0 * uPointScale;
+    vColor = uFixedColor ? uColor : particleColour(aTemp, distance(aPos, uCenter));
 }
 )";
 
 const char* fragmentShaderSrc = R"(
 #version 330 core
+in vec3 vColor;
 out vec4 FragColor;                          // Output color
-uniform vec3 uColor;                         // Input color from CPU
 
 void main() {
     // Create circular particles instead of square points
@@ -128,7 +225,7 @@ void main() {
     // Smooth falloff for glowing effect
     float alpha = 1.0 - smoothstep(0.0, 0.5, dist);
     
-    FragColor = vec4(uColor, alpha);         // Use calculated alpha for glow
+    FragColor = vec4(vColor, alpha);         // Use calculated alpha for glow
 }
 )";
 
@@ -139,11 +236,12 @@ layout(location = 0) in vec2 aPos;
 layout(location = 1) in float aAlpha;       // Trail fade factor
 uniform float uScreenWidth;
 uniform float uScreenHeight;
+uniform vec3 uView;
 out float vAlpha;
 
 void main() {
-    float x = (aPos.x / uScreenWidth) * 2.0 - 1.0;
-    float y = (aPos.y / uScreenHeight) * 2.0 - 1.0;
+    float x = (aPos.x - uView.x) * uView.z / uScreenWidth * 2.0;
+    float y = (aPos.y - uView.y) * uView.z / uScreenHeight * 2.0;
     gl_Position = vec4(x, y, 0.0, 1.0);
     vAlpha = aAlpha;
 }
@@ -161,44 +259,428 @@ void main() {
 }
 )";
 
-// Compile shader helper
-GLuint compileShader(GLenum type, const char* src) {
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &src, nullptr);
-    glCompileShader(shader);
-    GLint success;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        char info[512];
-        glGetShaderInfoLog(shader, 512, nullptr, info);
-        cerr << "Shader compilation error: " << info << endl;
-    }
-    return shader;
+// How the simulation thread steps and what it publishes
+struct SimThreadConfig {
+    const char* integrator = integrators[0].name;
+    ForceModel force = ForceModel::Central;
+    Precision precision = Precision::Float;
+    NBodyParams nbody;                  // N-body force model only
+    bool gas = false;                   // SPH pressure and viscosity on top of gravity
+    SphParams sph;
+    SnapshotInfo start;                 // step, time and seed the particles are at
+    const char* checkpointPath = nullptr;
+    uint64_t checkpointEvery = 0;       // steps between background checkpoints, 0 = only on exit
+    const char* trajectoryPath = nullptr;
+    TrajectoryOptions trajectory;
+    Profiler* profiler = nullptr;       // steps are timed into ZoneSim, drift goes to its overlay
+    uint64_t diagEvery = 0;             // steps between energy and angular momentum measurements, 0 = never
+    uint64_t sortEvery = defaultSortEvery; // steps between Morton sorts of the store, 0 = never
+    float dt = defaultDt;
+    double stepRate = 60.0;             // steps per second, 0 runs flat out
+    int stepsPerFrame = 0;              // recording: publish every this many steps, then wait for the frame. 0 = free running
+    const atomic<uint64_t>* renderedStep = nullptr; // recording: step of the newest snapshot the renderer has taken
+    float G = ::G, M = ::M;
+    InitDistribution initDist;          // where particles added by a config reload go
+    bool copyTrails = true;             // include trail rings in snapshots
+    bool buildGrid = true;              // index snapshot positions for view culling
+    bool retire = true;                 // run `lifecycle` after every step
+    Lifecycle lifecycle;
+    AttractorField attractors;          // attractors force model only
+};
+
+// Config reloads from the render thread, the sim thread takes them at its next step boundary
+struct ParamMailbox {
+    mutex m;
+    SimParams params;
+    atomic<bool> pending{false};
+
+    void post(const SimParams& p) {
+        lock_guard<mutex> lock(m);
+        params = p;
+        pending = true;
+    }
+    bool take(SimParams& p) {
+        if (!pending.load(memory_order_acquire)) return false;
+        lock_guard<mutex> lock(m);
+        p = params;
+        pending = false;
+        return true;
+    }
+};
+
+// A reloaded config between two steps. The particle store grows or shrinks in
+// place, new particles drawn the way the initial ones were and the last ones
+// dropped, trails keep their newest points, and the constants apply from the
+// next step on
+static void applyParams(const SimParams& p, ParticleSystem& particles, ThreadPool& pool, SimThreadConfig& config,
+                        Stepper& stepper, SnapshotInfo& run) {
+    size_t before = particles.size();
+    particles.setTrailLength(p.trailLength);
+    if (p.particles < particles.size()) {
+        particles.truncate(p.particles);
+    } else if (p.particles > particles.size()) {
+        InitDistribution dist = config.initDist;
+        dist.gm = p.G * p.M;
+        initParticles(particles, p.particles - particles.size(), particles.trailLength, run.seed, dist, &pool);
+    }
+    if (config.retire) {
+        config.lifecycle.capacity = max(config.lifecycle.capacity, particles.size());
+        config.lifecycle.gm = p.G * p.M;
+    }
+    // same disk mass spread over the new count
+    if (before > 0 && particles.size() > 0) {
+        stepper.context.nbody.particleMass *= (float)before / particles.size();
+        stepper.sph.particleMass *= (float)before / particles.size();
+    }
+    stepper.context.G = p.G;
+    stepper.context.M = p.M;
+    config.initDist.gm = p.G * p.M;
+    run.dt = p.dt;
+    config.stepRate = p.stepRate;
+    cout << "Config applied at step " << run.step << ": " << particles.size() << " particles, trail "
+         << particles.trailLength << ", dt " << p.dt << ", G " << p.G << ", M " << p.M << endl;
 }
 
-// Create shader program helper
-GLuint createProgram(const char* vertSrc, const char* fragSrc) {
-    GLuint vs = compileShader(GL_VERTEX_SHADER, vertSrc);
-    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragSrc);
-    GLuint prog = glCreateProgram();
-    glAttachShader(prog, vs);
-    glAttachShader(prog, fs);
-    glLinkProgram(prog);
-    glDeleteShader(vs);
-    glDeleteShader(fs);
-    return prog;
+// Simulation thread: advance at a fixed timestep, publishing a snapshot after every step
+void runSimulation(ParticleSystem& particles, ThreadPool& pool, SimThreadConfig config,
+                   StateExchange<SimSnapshot>& exchange, const atomic<bool>& running, ParamMailbox& mailbox) {
+    Stepper stepper;
+    stepper.select(config.integrator, config.force, config.precision);
+    stepper.context.nbody = config.nbody;
+    stepper.context.G = config.G;
+    stepper.context.M = config.M;
+    stepper.attractors = config.attractors;
+    stepper.gas = config.gas;
+    stepper.sph = config.sph;
+    SnapshotInfo run = config.start;
+    if (stepper.sph.smoothing == 0.0f) stepper.sph.smoothing = run.smoothing; // a resumed run keeps the h it picked
+    stepper.time = run.time;
+    Lifecycle& lifecycle = config.lifecycle;
+    SnapshotWriter checkpoints;
+    TrajectoryWriter trajectoryWriter;
+    if (config.trajectoryPath && !trajectoryWriter.open(config.trajectoryPath, particles.nextId, config.trajectory)) {
+        cerr << "Failed to open trajectory " << config.trajectoryPath << "\n";
+    }
+    float dt = config.dt;
+    run.dt = dt;
+    double period = config.stepRate > 0.0 ? 1.0 / config.stepRate : 0.0;
+    double next = steadySeconds();
+    DriftMonitor drift;
+    uint64_t reloads = 0, measuredReloads = 0; // a reload since the last measurement rebases the drift
+    MortonSorter sorter;
+    uint64_t layout = 0;
+
+    while (running.load(memory_order_relaxed)) {
+        SimParams reloaded;
+        if (mailbox.take(reloaded)) {
+            reloads++;
+            applyParams(reloaded, particles, pool, config, stepper, run);
+            dt = run.dt;
+            period = config.stepRate > 0.0 ? 1.0 / config.stepRate : 0.0;
+            next = steadySeconds();
+        }
+
+        uint64_t stepStart = Profiler::nowNs();
+        if (config.sortEvery > 0 && run.step % config.sortEvery == 0) {
+            sorter.sort(particles, &pool);
+            layout++;
+        }
+        Diagnostics measured;
+        bool measuring = config.diagEvery > 0 && (run.step + 1) % config.diagEvery == 0;
+        stepper.step(particles, pool, dt, measuring ? &measured : nullptr);
+        run.step++;
+        run.time += dt;
+        run.smoothing = stepper.hydro.smoothing();
+        if (measuring) {
+            drift.observe(run.step, measured, reloads != measuredReloads);
+            measuredReloads = reloads;
+            if (config.profiler) config.profiler->setDrift(drift.energyDrift(), drift.momentumDrift());
+        }
+        SimSnapshot& snap = exchange.back();
+        if (config.force == ForceModel::Attractors) stepper.attractors.positionsAt(run.time, snap.holes);
+        if (config.retire) {
+            if (config.force == ForceModel::Attractors) lifecycle.holes = snap.holes;
+            const ForceContext* measure = config.diagEvery > 0 ? &stepper.context : nullptr;
+            LifecycleStats changed = lifecycle.update(particles, run.step, dt, measure, config.force);
+            drift.exchange(changed.retiredSum, changed.spawnedSum);
+        }
+
+        // Recording runs in lockstep with the video: a snapshot every
+        // stepsPerFrame steps, and nothing more until the renderer took it
+        bool lockstep = config.stepsPerFrame > 0;
+        bool publishing = !lockstep || run.step % config.stepsPerFrame == 0;
+        if (publishing) {
+            copyRenderState(particles, snap.particles, config.copyTrails);
+            if (config.buildGrid) snap.grid.build(particles, &pool);
+        }
+        if (config.profiler) config.profiler->add(ZoneSim, stepStart, Profiler::nowNs());
+        if (publishing) {
+            snap.step = run.step;
+            snap.time = steadySeconds();
+            snap.layout = layout;
+            exchange.publish();
+        }
+        trajectoryWriter.record(run.step, run.time, particles, &drift);
+
+        if (config.checkpointPath && config.checkpointEvery > 0 && run.step % config.checkpointEvery == 0) {
+            checkpoints.submit(config.checkpointPath, particles, run); // skipped if the last one is still writing
+        }
+
+        if (lockstep) {
+            while (publishing && running.load(memory_order_relaxed) &&
+                   config.renderedStep->load(memory_order_acquire) < run.step) {
+                this_thread::sleep_for(chrono::microseconds(200));
+            }
+        } else if (period > 0.0) {
+            next += period;
+            double now = steadySeconds();
+            if (now < next) {
+                this_thread::sleep_for(chrono::duration<double>(next - now));
+            } else if (now - next > 0.25) {
+                next = now; // fell far behind (e.g. debugger), don't try to catch up
+            }
+        }
+    }
+
+    if (config.retire) {
+        const LifecycleStats& t = lifecycle.totals();
+        cout << "Lifecycle: " << t.captured << " captured, " << t.escaped << " escaped, " << t.spawned
+             << " spawned, " << particles.size() << " live" << endl;
+    }
+
+    if (drift.measured()) {
+        cout << "Diagnostics at step " << drift.step() << ": energy drift " << drift.energyDrift()
+             << ", angular momentum drift " << drift.momentumDrift() << endl;
+    }
+
+    if (trajectoryWriter.isOpen()) {
+        trajectoryWriter.close();
+        cout << "Trajectory: " << trajectoryWriter.framesWritten() << " frames written, "
+             << trajectoryWriter.framesDropped() << " dropped" << endl;
+    }
+
+    if (config.checkpointPath) {
+        checkpoints.wait();
+        if (writeSnapshot(config.checkpointPath, particles, run)) {
+            cout << "Checkpoint written to " << config.checkpointPath << " at step " << run.step << endl;
+        } else {
+            cerr << "Failed to write checkpoint " << config.checkpointPath << "\n";
+        }
+    }
 }
 
-int main() {
-    srand(time(nullptr));
+int main(int argc, char** argv) {
+    unsigned numThreads = 0; // 0 = one per hardware thread
+    const char* configPath = nullptr;     // --config, watched and re-applied at the next step when it changes
+    ParamOverrides overrides;             // --set KEY=VALUE, --sim-rate; on top of the file
+    bool useGpu = false;     // --backend gpu runs the physics in a compute shader
+    ForceModel force = ForceModel::Central; // --force picks the gravity model, --nbody = --force nbody
+    Precision precision = Precision::Float;
+    NBodyParams nbody;
+    float diskMass = defaultDiskMass;
+    bool gas = false;                     // --sph adds gas pressure, CPU backend only
+    SphParams sph;
+    TrailMode trailMode = TrailMode::Cpu;
+    const IntegratorInfo* integrator = &integrators[0];
+    bool trailModeSet = false;
+    unsigned seed = (unsigned)time(nullptr);
+    const char* checkpointPath = nullptr; // written on exit, and every --checkpoint-every steps
+    uint64_t checkpointEvery = 0;
+    const char* resumePath = nullptr;
+    const char* trajectoryPath = nullptr;
+    TrajectoryOptions trajectory;
+    uint64_t diagEvery = 0;               // --diag-every K measures energy and angular momentum every K steps
+    uint64_t sortEvery = defaultSortEvery; // --sort-every K puts the store in Morton order every K steps
+    const char* recordPath = nullptr;     // --record writes a video through the offscreen FBO
+    int recordWidth = 1920, recordHeight = 1440;
+    int recordFps = 60;
+    uint64_t recordFrames = 0;            // stop after this many frames, 0 = when the window closes
+    const char* encoderCommand = nullptr; // replaces the ffmpeg command line, reads raw RGBA on stdin
+    bool offscreen = false;               // hidden window, nothing drawn to the screen
+    bool showProfiler = false;            // P toggles the frame profiler overlay
+    bool cull = true;                     // --no-cull packs and draws everything, for comparison
+    bool retire = true;                   // capture, escape and respawn, --no-retire keeps every particle
+    vector<Emitter> emitters;             // --emit, none = refill from a ring like the initial disk
+    size_t maxParticles = 0;
+    float escapeRadius = 2.0f * width;
+    AttractorField scene;                 // --attractor, --binary, --halo, --uniform-field, they imply --force attractors
+    InitDistribution initDist;            // --init, how the starting particles are spread
+    const char* tracePath = nullptr;      // Chrome trace of the first --trace-frames frames, written on exit
+    size_t traceFrames = 300;
+    bool allocCheck = false;              // abort on the first heap allocation in a frame after warm-up
+    bool hdr = true;                      // additive float target, bloom and tonemap. --no-hdr alpha blends straight to the screen
+    HdrBloom bloom;                       // --bloom, --bloom-threshold, --exposure
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            numThreads = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sim-rate") == 0 && i + 1 < argc && parseOverride((string("rate=") + argv[i + 1]).c_str(), overrides)) {
+            ++i;
+        } else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            configPath = argv[++i];
+        } else if (strcmp(argv[i], "--set") == 0 && i + 1 < argc && parseOverride(argv[i + 1], overrides)) {
+            ++i;
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc && (strcmp(argv[i + 1], "cpu") == 0 || strcmp(argv[i + 1], "gpu") == 0)) {
+            useGpu = strcmp(argv[++i], "gpu") == 0;
+        } else if (strcmp(argv[i], "--trails") == 0 && i + 1 < argc) {
+            const char* mode = argv[++i];
+            trailModeSet = true;
+            if (strcmp(mode, "cpu") == 0) trailMode = TrailMode::Cpu;
+            else if (strcmp(mode, "gpu") == 0) trailMode = TrailMode::Gpu;
+            else if (strcmp(mode, "off") == 0) trailMode = TrailMode::Off;
+            else { cerr << "Unknown trail mode " << mode << "\n"; return -1; }
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            checkpointPath = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            checkpointEvery = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+            resumePath = argv[++i];
+        } else if (strcmp(argv[i], "--trajectory") == 0 && i + 1 < argc) {
+            trajectoryPath = argv[++i];
+        } else if (strcmp(argv[i], "--traj-stride") == 0 && i + 1 < argc) {
+            trajectory.stride = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--traj-subset") == 0 && i + 1 < argc && parseTrajectorySubset(argv[i + 1], trajectory)) {
+            ++i;
+        } else if (strcmp(argv[i], "--diag-every") == 0 && i + 1 < argc) {
+            diagEvery = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--sort-every") == 0 && i + 1 < argc) {
+            sortEvery = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--sph") == 0 && i + 1 < argc && parseSph(argv[i + 1], sph)) {
+            gas = true;
+            ++i;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--record-size") == 0 && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &recordWidth, &recordHeight) == 2) {
+            ++i;
+        } else if (strcmp(argv[i], "--record-fps") == 0 && i + 1 < argc) {
+            recordFps = max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--record-frames") == 0 && i + 1 < argc) {
+            recordFrames = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--encoder") == 0 && i + 1 < argc) {
+            encoderCommand = argv[++i];
+        } else if (strcmp(argv[i], "--offscreen") == 0) {
+            offscreen = true;
+        } else if (strcmp(argv[i], "--emit") == 0 && i + 1 < argc) {
+            Emitter e;
+            if (!parseEmitter(argv[++i], e)) {
+                cerr << "Bad emitter " << argv[i] << "\n";
+                return -1;
+            }
+            emitters.push_back(e);
+        } else if (strcmp(argv[i], "--max-particles") == 0 && i + 1 < argc) {
+            maxParticles = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--escape-radius") == 0 && i + 1 < argc) {
+            escapeRadius = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--no-retire") == 0) {
+            retire = false;
+        } else if (strcmp(argv[i], "--attractor") == 0 && i + 1 < argc) {
+            Attractor a;
+            if (!parseAttractor(argv[++i], a)) {
+                cerr << "Bad attractor " << argv[i] << "\n";
+                return -1;
+            }
+            scene.bodies.push_back(a);
+            force = ForceModel::Attractors;
+        } else if (strcmp(argv[i], "--binary") == 0 && i + 1 < argc) {
+            if (!parseBinary(argv[++i], scene.bodies)) {
+                cerr << "Bad binary " << argv[i] << "\n";
+                return -1;
+            }
+            force = ForceModel::Attractors;
+        } else if (strcmp(argv[i], "--halo") == 0 && i + 1 < argc && parseHalo(argv[i + 1], scene.external)) {
+            ++i;
+            force = ForceModel::Attractors;
+        } else if (strcmp(argv[i], "--uniform-field") == 0 && i + 1 < argc && parseUniformField(argv[i + 1], scene.external)) {
+            ++i;
+            force = ForceModel::Attractors;
+        } else if (strcmp(argv[i], "--field-grid") == 0 && i + 1 < argc && parseFieldGrid(argv[i + 1], scene.gridMode)) {
+            ++i;
+        } else if (strcmp(argv[i], "--init") == 0 && i + 1 < argc && parseInitDistribution(argv[i + 1], initDist)) {
+            ++i;
+        } else if (strcmp(argv[i], "--no-cull") == 0) {
+            cull = false;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            showProfiler = true;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (strcmp(argv[i], "--trace-frames") == 0 && i + 1 < argc) {
+            traceFrames = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--alloc-check") == 0) {
+            allocCheck = true;
+        } else if (strcmp(argv[i], "--no-hdr") == 0) {
+            hdr = false;
+        } else if (strcmp(argv[i], "--bloom") == 0 && i + 1 < argc) {
+            bloom.strength = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--bloom-threshold") == 0 && i + 1 < argc) {
+            bloom.threshold = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--exposure") == 0 && i + 1 < argc) {
+            bloom.exposure = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--integrator") == 0 && i + 1 < argc && findIntegrator(argv[i + 1])) {
+            integrator = findIntegrator(argv[++i]);
+        } else if (strcmp(argv[i], "--force") == 0 && i + 1 < argc && parseForceModel(argv[i + 1], force)) {
+            ++i;
+        } else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc && parsePrecision(argv[i + 1], precision)) {
+            ++i;
+        } else if (strcmp(argv[i], "--nbody") == 0) {
+            force = ForceModel::NBody;
+        } else if (strcmp(argv[i], "--theta") == 0 && i + 1 < argc) {
+            nbody.theta = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--disk-mass") == 0 && i + 1 < argc) {
+            diskMass = (float)atof(argv[++i]);
+        } else {
+            cerr << "Usage: " << argv[0] << " [--threads N] [--sim-rate HZ] [--backend cpu|gpu]"
+                 << " [--config FILE] [--set particles|trail|dt|G|M|rate=VALUE]..."
+                 << " [--nbody] [--theta T] [--disk-mass MASS] [--trails cpu|gpu|off] [--integrator NAME]"
+                 << " [--force central|pw|geodesic|nbody|attractors] [--precision float|double]"
+                 << " [--seed SEED] [--checkpoint FILE] [--checkpoint-every S] [--resume FILE]"
+                 << " [--trajectory FILE] [--traj-stride S] [--traj-subset BEGIN:END[:EVERY]] [--diag-every K] [--sort-every K]"
+                 << " [--sph H[:ALPHA[:ENERGY[:COOLING]]]]"
+                 << " [--record FILE] [--record-size WxH] [--record-fps N] [--record-frames N] [--encoder CMD] [--offscreen]"
+                 << " [--profile] [--trace FILE] [--trace-frames N] [--no-cull] [--alloc-check]"
+                 << " [--no-hdr] [--bloom STRENGTH] [--bloom-threshold T] [--exposure E]"
+                 << " [--emit ring:RMIN:RMAX[:RATE] | jet:X:Y:VX:VY:SPREAD:RATE]... [--max-particles N]"
+                 << " [--escape-radius R] [--no-retire]"
+                 << " [--attractor X:Y:MASS[:RADIUS:PERIOD[:PHASE]]]... [--binary SEP[:Q]] [--halo V0[:CORE]]"
+                 << " [--uniform-field AX:AY] [--field-grid auto|on|off]"
+                 << " [--init disk[:RMIN:RMAX] | ring:RADIUS:WIDTH | kepler:RMIN:RMAX[:SIGMA]]\n";
+            cerr << "Integrators:\n";
+            for (size_t k = 0; k < integratorCount; ++k) {
+                cerr << "  " << integrators[k].name << " - " << integrators[k].description << "\n";
+            }
+            return -1;
+        }
+    }
+
+    // Compiled-in defaults, then the config file, then the command line
+    SimParams params;
+    if (!loadParams(configPath, overrides, params)) return -1;
+    double simRate = params.stepRate; // physics steps per second, 0 = as fast as possible
+    initDist.gm = params.G * params.M;
+    ConfigWatcher configWatcher;
+    if (configPath) configWatcher.open(configPath);
+
 
     // Initialize GLFW
     if (!glfwInit()) return -1;
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    // compute shaders need 4.3, everything else runs on 3.3
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, useGpu ? 4 : 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    bool recording = recordPath || encoderCommand;
+    if (offscreen && (!recording || recordFrames == 0)) {
+        cerr << "--offscreen needs --record (or --encoder) and --record-frames, there's no window to close\n";
+        return -1;
+    }
+    if (offscreen) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE); // still need a window for the context
 
-    GLFWwindow* window = glfwCreateWindow(width, height, "Black Hole OpenGL", nullptr, nullptr);
+    GLFWwindow* window = glfwCreateWindow(width, height, windowTitle, nullptr, nullptr);
+    if (!window && useGpu) {
+        cerr << "No OpenGL 4.3 context for the GPU backend, falling back to 3.3 and the CPU\n";
+        useGpu = false;
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        window = glfwCreateWindow(width, height, windowTitle, nullptr, nullptr);
+    }
     if (!window) { glfwTerminate(); return -1; }
     glfwMakeContextCurrent(window);
 
@@ -207,52 +689,110 @@ int main() {
         return -1;
     }
 
+    if (useGpu && !GpuPhysics::supported()) {
+        cerr << "GPU backend needs OpenGL 4.3, falling back to the CPU\n";
+        useGpu = false;
+    }
+    if (useGpu && (force != ForceModel::Central || precision != Precision::Float)) {
+        cerr << "GPU backend only does central gravity in float, ignoring --force and --precision\n";
+        force = ForceModel::Central;
+        precision = Precision::Float;
+    }
+    if (useGpu && gas) {
+        cerr << "GPU backend has no SPH, ignoring --sph\n";
+        gas = false;
+    }
+    // the compute backend has no CPU-side trails to pack
+    if (useGpu && trailMode == TrailMode::Cpu) {
+        if (trailModeSet) cerr << "GPU backend draws trails from GPU history, using --trails gpu\n";
+        trailMode = TrailMode::Gpu;
+    }
+
     glEnable(GL_PROGRAM_POINT_SIZE);
     
-    // Enable blending for transparency effects
+    // Enable blending for transparency effects. With HDR the scene blends
+    // additively into a float target instead, see HdrBloom
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    if (hdr) bloom.create();
 
-    // Initialize particles
-    vector<Particle> particles;
-    for (int i = 0; i < numParticles; ++i) {
-        float angle = (rand() % 360) * 3.14159f / 180.0f; // random angle on circle around blackhole
-        float radius = 50 + rand() % 250; // random dist from blackhole
-
-        // stable orbit velocity: = sqrt(GM/r)
-        float orbitalSpeed = sqrt((G * M) / radius) * 0.9f;
-        float xVel = -1 * sin(angle) * orbitalSpeed;
-        float yVel = cos(angle) * orbitalSpeed;
+    const char* kernelName;
+    selectStepKernel(&kernelName);
+    cout << "Physics kernel: " << kernelName << endl;
 
-        Particle p;
-        p.pos = { width/2 + radius * cos(angle), height/2 + radius * sin(angle) };
-        p.vel = { xVel, yVel };
-        p.temp = 1.0f;
+    ThreadPool pool(numThreads);
+    cout << "Physics threads: " << pool.size() << endl;
 
-        particles.push_back(p);
+    // Initialize particles, or pick up where a checkpoint left off
+    ParticleSystem particles;
+    SnapshotInfo runStart;
+    if (resumePath) {
+        MappedSnapshot snapshot;
+        if (!snapshot.open(resumePath)) return -1;
+        snapshot.load(particles, &pool);
+        runStart = snapshot.info();
+        cout << "Resumed " << resumePath << " at step " << runStart.step << ", seed " << runStart.seed << endl;
+        // the checkpoint's count, trail and timestep stand until the config file changes
+        params.particles = particles.size();
+        params.trailLength = particles.trailLength;
+        params.dt = runStart.dt;
+    } else {
+        initParticles(particles, params.particles, params.trailLength, seed, initDist, &pool);
+        runStart.seed = seed;
+        runStart.dt = params.dt;
+        cout << "Seed: " << seed << endl;
+    }
+    nbody.particleMass = particles.size() > 0 ? diskMass / particles.size() : 0.0f;
+    sph.particleMass = particles.size() > 0 ? diskMass / particles.size() : 1.0f;
+    if (useGpu && (checkpointPath || trajectoryPath)) {
+        cerr << "Checkpoints and trajectories need the CPU backend, ignoring --checkpoint and --trajectory\n";
+        checkpointPath = trajectoryPath = nullptr;
     }
+    if (useGpu && diagEvery > 0) {
+        cerr << "Diagnostics need the CPU backend, ignoring --diag-every\n";
+        diagEvery = 0;
+    }
+    if (useGpu && retire) {
+        if (!emitters.empty()) cerr << "Respawning needs the CPU backend, ignoring --emit\n";
+        retire = false;
+    }
+    // Buffers are sized for the most particles that can ever be alive
+    Lifecycle lifecycle;
+    if (retire) {
+        lifecycle.gm = params.G * params.M;
+        lifecycle.configure(particles, runStart.seed, emitters, maxParticles);
+        lifecycle.escapeRadius = escapeRadius;
+    }
+    const size_t particleCount = retire ? lifecycle.capacity : particles.size();
+    vector<Vec2> startHoles(1, Vec2{ centerX, centerY });
+    if (force == ForceModel::Attractors) scene.positionsAt(runStart.time, startHoles);
 
     // Set up OpenGL buffers for rendering particles
-    GLuint particleVBO, particleVAO;
-    glGenBuffers(1, &particleVBO);
+    // Both vertex streams are ring buffers of StreamBuffer::defaultRegions frames,
+    // so the CPU fills one region while the GPU is still drawing the others
+    const size_t vertexStride = 3 * sizeof(float);
+    GLuint particleVAO;
     glGenVertexArrays(1, &particleVAO);
     
     // Configure particle vertex array object
     glBindVertexArray(particleVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
-    glBufferData(GL_ARRAY_BUFFER, numParticles * 2 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    // Each particle has 3 floats: x, y, temp. Extra slots at the end hold the black holes
+    StreamBuffer particleStream;
+    particleStream.create(GL_ARRAY_BUFFER, (particleCount + startHoles.size()) * vertexStride);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(2 * sizeof(float)));
+    glEnableVertexAttribArray(1);
     
     // Set up OpenGL buffers for rendering trails
-    GLuint trailVBO, trailVAO;
-    glGenBuffers(1, &trailVBO);
+    GLuint trailVAO;
     glGenVertexArrays(1, &trailVAO);
     
     // Configure trail vertex array object (position + alpha for fading)
     glBindVertexArray(trailVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, trailVBO);
-    // Each trail point has 3 floats: x, y, alpha
+    // Each trail point has 3 floats: x, y, alpha, sized for every trail being full
+    StreamBuffer trailStream;
+    trailStream.create(GL_ARRAY_BUFFER, particleCount * particles.trailLength * vertexStride);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(2 * sizeof(float)));
@@ -266,106 +806,395 @@ int main() {
     GLint particleColorLoc = glGetUniformLocation(particleProgram, "uColor");
     GLint particleWidthLoc = glGetUniformLocation(particleProgram, "uScreenWidth");
     GLint particleHeightLoc = glGetUniformLocation(particleProgram, "uScreenHeight");
+    GLint particleCenterLoc = glGetUniformLocation(particleProgram, "uCenter");
+    GLint particleDiskRadiusLoc = glGetUniformLocation(particleProgram, "uDiskRadius");
+    GLint particleFixedColorLoc = glGetUniformLocation(particleProgram, "uFixedColor");
+    GLint particlePointScaleLoc = glGetUniformLocation(particleProgram, "uPointScale");
+    GLint particleViewLoc = glGetUniformLocation(particleProgram, "uView");
     
     // Get uniform locations for trail shader
     GLint trailColorLoc = glGetUniformLocation(trailProgram, "uColor");
     GLint trailWidthLoc = glGetUniformLocation(trailProgram, "uScreenWidth");
     GLint trailHeightLoc = glGetUniformLocation(trailProgram, "uScreenHeight");
+    GLint trailViewLoc = glGetUniformLocation(trailProgram, "uView");
     
     // Set screen dimensions in both shaders
     glUseProgram(particleProgram);
     glUniform1f(particleWidthLoc, (float)width);
     glUniform1f(particleHeightLoc, (float)height);
+    glUniform2f(particleCenterLoc, centerX, centerY);
+    glUniform1f(particleDiskRadiusLoc, accretionDiskRadius);
+    glUniform1f(particlePointScaleLoc, 1.0f);
+
+    // Video goes through its own framebuffer at its own size, the window just previews it
+    VideoRecorder recorder;
+    if (recording) {
+        string command = encoderCommand ? string(encoderCommand)
+                                        : VideoRecorder::ffmpegCommand(recordWidth, recordHeight, recordFps, recordPath);
+        if (!recorder.create(recordWidth, recordHeight, command)) return -1;
+        glUseProgram(particleProgram);
+        glUniform1f(particlePointScaleLoc, (float)recordHeight / height);
+        if (offscreen) glfwSwapInterval(0);
+        cout << "Recording " << recordWidth << "x" << recordHeight << " at " << recordFps << " fps" << endl;
+    }
     
     glUseProgram(trailProgram);
     glUniform1f(trailWidthLoc, (float)width);
     glUniform1f(trailHeightLoc, (float)height);
 
+    // Seed every slot with the initial state so the first frames have something to draw
+    StateExchange<SimSnapshot> exchange;
+    for (int i = 0; i < StateExchange<SimSnapshot>::slotCount; ++i) {
+        exchange.slot(i).particles.reserve(particleCount, particles.trailLength);
+        copyRenderState(particles, exchange.slot(i).particles);
+        exchange.slot(i).grid.build(particles, &pool);
+        exchange.slot(i).holes = startHoles;
+        exchange.slot(i).time = steadySeconds();
+    }
+
+    GpuPhysics gpuPhysics;
+    if (useGpu) gpuPhysics.init(particles);
+
+    TrailHistory trailHistory;
+    if (trailMode == TrailMode::Gpu) trailHistory.create(particleCount, particles.trailLength);
+    uint64_t historyStep = 0; // last snapshot pushed into trailHistory
+
+    // Frame profiler: CPU scopes are always on, GPU timer queries are read back a few frames late
+    Profiler profiler;
+    GpuTimers gpuTimers;
+    gpuTimers.create();
+    ProfilerOverlay profilerOverlay;
+    profilerOverlay.create();
+    if (tracePath) profiler.startTrace(traceFrames);
+    bool profilerKeyDown = false;
+    double lastTitleUpdate = 0.0;
+
+    // CPU physics runs on its own thread from here on and owns `particles`
+    atomic<bool> simRunning(true);
+    atomic<uint64_t> renderedStep(0); // recording: the sim waits for each frame to be taken
+    ParamMailbox mailbox;
+    thread simThread;
+    if (!useGpu) {
+        SimThreadConfig config;
+        config.integrator = integrator->name;
+        config.force = force;
+        config.precision = precision;
+        config.nbody = nbody;
+        config.gas = gas;
+        config.sph = sph;
+        config.stepRate = simRate;
+        config.dt = runStart.dt;
+        config.G = params.G;
+        config.M = params.M;
+        config.initDist = initDist;
+        config.start = runStart;
+        config.checkpointPath = checkpointPath;
+        config.checkpointEvery = checkpointEvery;
+        config.trajectoryPath = trajectoryPath;
+        config.trajectory = trajectory;
+        config.copyTrails = trailMode == TrailMode::Cpu;
+        config.profiler = &profiler;
+        config.diagEvery = diagEvery;
+        config.sortEvery = sortEvery;
+        config.buildGrid = cull;
+        config.retire = retire;
+        config.lifecycle = lifecycle;
+        config.attractors = scene;
+        if (recording) {
+            // video time, not wall time, like the GPU path: every frame covers the same number of steps
+            config.stepsPerFrame = simRate > 0.0 ? max(1, (int)lround(simRate / recordFps)) : 1;
+            config.renderedStep = &renderedStep;
+        }
+        simThread = thread(runSimulation, ref(particles), ref(pool), config, ref(exchange), cref(simRunning), ref(mailbox));
+    }
+
+    double lastFrame = steadySeconds();
+    double gpuStepDebt = 0.0;
+
+    // Scroll zooms about the cursor, left drag pans, Home resets
+    View view;
+    ViewInput viewInput;
+    glfwSetWindowUserPointer(window, &viewInput);
+    glfwSetScrollCallback(window, onScroll);
+
+    // Scratch that only lives for one frame comes from here: culling candidates
+    // (at most an eighth of the particles), overlay vertices, the title. Frames
+    // after warm-up shouldn't touch the heap at all, the check counts any that do
+    FrameArena frameArena(particleCount * sizeof(uint32_t) / 8 + (256 << 10));
+    AllocationCheck frameAllocations;
+    frameAllocations.fatal = allocCheck;
+
     // Main loop
     while (!glfwWindowShouldClose(window)) {
+        frameArena.reset();
+        frameAllocations.begin();
+        int fbWidth, fbHeight;
+        glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+
         // Clear screen to black
-        glClearColor(0.05f, 0.05f, 0.1f, 1.0f);  // Dark blue background for space effect
-        glClear(GL_COLOR_BUFFER_BIT);
-        
-        // Update all particle positions using physics simulation
-        vector<float> particleData(numParticles * 2);  // Array for particle positions
-        vector<float> trailData;                        // Dynamic array for all trail points
-        
-        for (int i = 0; i < numParticles; ++i) {
-            // Update particle physics (smaller timestep for stability)
-            updateParticle(particles[i], 0.008f, G, M);
-            
-            // Store particle position data for rendering
-            particleData[2*i] = particles[i].pos.x;     // X coordinate
-            particleData[2*i+1] = particles[i].pos.y;   // Y coordinate
-            
-            // Add trail points to trail data array
-            for (size_t j = 0; j < particles[i].trail.size(); ++j) {
-                trailData.push_back(particles[i].trail[j].x);  // X position
-                trailData.push_back(particles[i].trail[j].y);  // Y position
-                
-                // Calculate alpha for fading effect (newer points are more opaque)
-                float alpha = (float)j / particles[i].trail.size();
-                trailData.push_back(alpha);
+        if (hdr) {
+            bloom.begin(recording ? recordWidth : fbWidth, recording ? recordHeight : fbHeight, 0.05f, 0.05f, 0.1f);
+        } else {
+            if (recording) recorder.bind();
+            glClearColor(0.05f, 0.05f, 0.1f, 1.0f);  // Dark blue background for space effect
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+
+        double now = steadySeconds();
+        double frameTime = now - lastFrame;
+        lastFrame = now;
+        updateView(window, viewInput, view);
+        glUseProgram(particleProgram);
+        glUniform3f(particleViewLoc, view.x, view.y, view.zoom);
+        glUseProgram(trailProgram);
+        glUniform3f(trailViewLoc, view.x, view.y, view.zoom);
+
+        size_t n;                 // particles to draw
+        GLuint drawVAO;           // and where they come from
+        GLint first, blackHoleFirst;
+        size_t holeCount = 1;
+        size_t trailVertices = 0;
+        float* particleData = (float*)particleStream.beginWrite();
+
+        if (useGpu) {
+            // Advance on the GPU at the requested rate, state never leaves VRAM
+            int steps = maxGpuStepsPerFrame;
+            if (recording) {
+                // video time, not wall time: every frame covers the same number of steps
+                steps = simRate > 0.0 ? max(1, (int)lround(simRate / recordFps)) : maxGpuStepsPerFrame;
+            } else if (simRate > 0.0) {
+                gpuStepDebt += frameTime * simRate;
+                steps = (int)min(gpuStepDebt, (double)maxGpuStepsPerFrame);
+                gpuStepDebt = min(gpuStepDebt - steps, 1.0);
+            }
+            uint64_t simStart = Profiler::nowNs();
+            gpuTimers.begin(ZoneSim);
+            gpuPhysics.step(steps, params.dt, params.G, params.M, trailMode == TrailMode::Gpu ? &trailHistory : nullptr);
+            gpuTimers.end();
+            profiler.add(ZoneSim, simStart, Profiler::nowNs());
+
+            n = gpuPhysics.size();
+            drawVAO = gpuPhysics.vao();
+            first = 0;
+
+            // Only the black hole goes through the stream buffer
+            particleData[0] = centerX;
+            particleData[1] = centerY;
+            particleData[2] = 0.0f;
+            uint64_t uploadStart = Profiler::nowNs();
+            gpuTimers.begin(ZoneUpload);
+            particleStream.endWrite(vertexStride);
+            gpuTimers.end();
+            profiler.add(ZoneUpload, uploadStart, Profiler::nowNs());
+            blackHoleFirst = particleStream.firstVertex(vertexStride);
+        } else {
+            // Pick up the newest simulation state, we draw one step behind it and
+            // blend from the previous snapshot towards it as wall time advances
+            // When recording, every new snapshot is one video frame drawn as is, no
+            // blending, and the sim waits for it to be taken before stepping on
+            uint64_t packStart = Profiler::nowNs();
+            bool fresh = exchange.acquire();
+            while (recording && !fresh && !glfwWindowShouldClose(window)) {
+                this_thread::sleep_for(chrono::microseconds(200));
+                fresh = exchange.acquire();
+            }
+            if (recording) renderedStep.store(exchange.current().step, memory_order_release);
+            const ParticleSystem& prev = exchange.previous().particles;
+            const ParticleSystem& curr = exchange.current().particles;
+            double stepTime = exchange.current().time - exchange.previous().time;
+            float alpha = 1.0f;
+            if (!recording && exchange.current().step > exchange.previous().step && stepTime > 0.0 &&
+                prev.size() == curr.size()) {
+                alpha = (float)min(1.0, (now - exchange.current().time) / stepTime);
+            }
+
+            // A config reload can hand over a snapshot the buffers weren't sized for
+            if (growStream(particleStream, particleVAO, (curr.size() + exchange.current().holes.size()) * vertexStride)) {
+                particleData = (float*)particleStream.beginWrite();
+                frameAllocations.rewarm();
+            }
+            if (trailMode == TrailMode::Cpu && growStream(trailStream, trailVAO, curr.size() * curr.trailLength * vertexStride)) {
+                frameAllocations.rewarm();
+            }
+            if (trailMode == TrailMode::Gpu &&
+                (curr.size() > trailHistory.particles() || curr.trailLength != trailHistory.trailLength())) {
+                size_t capacity = max(curr.size(), trailHistory.particles());
+                trailHistory.destroy(); // starts over empty
+                trailHistory.create(capacity, curr.trailLength);
+                frameAllocations.rewarm();
+            }
+
+            // Pack straight into this frame's region of the GPU buffers
+            float* trailData = trailMode == TrailMode::Cpu ? (float*)trailStream.beginWrite() : nullptr;
+            // Cull against the view, the grid narrows it down to particles whose
+            // blended position or trail can reach the screen when that pays off
+            PackView packView;
+            PackView* culling = nullptr;
+            if (cull) {
+                float pixel = (float)height / (recording ? recordHeight : fbHeight) / view.zoom; // one render pixel in world units
+                packView.visible = view.visible().padded(5.0f / view.zoom);                  // points are 10 px across
+                packView.trailSpacing = pixel;
+                gatherCandidates(packView, exchange.current().grid, curr, params.dt, frameArena);
+                culling = &packView;
             }
+            PackCounts packed = packFrame(prev, curr, alpha, particleData, trailData, culling);
+            trailVertices = packed.trailVertices;
+            uint64_t uploadStart = Profiler::nowNs();
+            profiler.add(ZonePack, packStart, uploadStart);
+            gpuTimers.begin(ZoneUpload);
+
+            // GPU trails only need the newest point per new snapshot: where the
+            // particle was before its latest step, i.e. the previous snapshot. A sort
+            // in between moved particles to other slots, the history starts over.
+            // Retires and spawns only move a few, push restarts those slots by id and generation
+            if (trailMode == TrailMode::Gpu && exchange.current().step != historyStep) {
+                if (exchange.previous().layout != exchange.current().layout) trailHistory.clear();
+                else trailHistory.push(prev.posX.data(), prev.posY.data(), prev.id.data(), prev.generation.data(), prev.size());
+                historyStep = exchange.current().step;
+            }
+
+            n = packed.particles;
+            const vector<Vec2>& holes = exchange.current().holes;
+            holeCount = holes.size();
+            for (size_t h = 0; h < holeCount; ++h) {
+                particleData[3*(n+h)] = holes[h].x;
+                particleData[3*(n+h)+1] = holes[h].y;
+                particleData[3*(n+h)+2] = 0.0f;
+            }
+
+            // Hand the data to the GPU, a no-op when the buffers are persistently mapped
+            if (trailData) trailStream.endWrite(trailVertices * vertexStride);
+            particleStream.endWrite((n + holeCount) * vertexStride);
+            gpuTimers.end();
+            profiler.add(ZoneUpload, uploadStart, Profiler::nowNs());
+
+            drawVAO = particleVAO;
+            first = particleStream.firstVertex(vertexStride);
+            blackHoleFirst = first + (GLint)n;
         }
-        
+
         // Render particle trails first (so they appear behind particles)
-        if (!trailData.empty()) {
+        uint64_t trailStart = Profiler::nowNs();
+        gpuTimers.begin(ZoneTrailDraw);
+        if (trailVertices > 0) {
             glUseProgram(trailProgram);
             glBindVertexArray(trailVAO);
-            glBindBuffer(GL_ARRAY_BUFFER, trailVBO);
-            
-            // Upload trail data to GPU
-            glBufferData(GL_ARRAY_BUFFER, trailData.size() * sizeof(float), 
-                        trailData.data(), GL_DYNAMIC_DRAW);
             
             // Set trail colour (dim white)
             glUniform3f(trailColorLoc, 0.8f, 0.8f, 1.0f);
             
             // Draw all trail points as lines
-            glDrawArrays(GL_POINTS, 0, trailData.size() / 3);
+            glDrawArrays(GL_POINTS, trailStream.firstVertex(vertexStride), (GLsizei)trailVertices);
+            trailStream.fence();
+        } else if (trailMode == TrailMode::Gpu) {
+            trailHistory.draw(0.8f, 0.8f, 1.0f, view);
         }
+        gpuTimers.end();
+        uint64_t drawStart = Profiler::nowNs();
+        profiler.add(ZoneTrailDraw, trailStart, drawStart);
         
         // Render particles with temperature-based coloring
+        gpuTimers.begin(ZoneParticleDraw);
         glUseProgram(particleProgram);
-        glBindVertexArray(particleVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
         
-        // Upload particle positions to GPU
-        glBufferSubData(GL_ARRAY_BUFFER, 0, particleData.size() * sizeof(float), particleData.data());
-        
-        // Draw each particle with individual color based on temperature and distance
-        for (int i = 0; i < numParticles; ++i) {
-            float distanceFromCenter = sqrt((particles[i].pos.x - centerX) * (particles[i].pos.x - centerX) + 
-                                           (particles[i].pos.y - centerY) * (particles[i].pos.y - centerY));
-            
-            Vec2 colour = getParticleColour(particles[i].temp, distanceFromCenter);
-            
-            // Special bright coloring for accretion disk particles
-            if (distanceFromCenter < accretionDiskRadius) {
-                glUniform3f(particleColorLoc, colour.x, colour.y, 1.0f);  // Bright blue-white
-            } else {
-                glUniform3f(particleColorLoc, colour.x, colour.y, 0.2f);  // Apply calculated color
-            }
-            
-            // Draw single particle
-            glDrawArrays(GL_POINTS, i, 1);
-        }
+        // Draw every particle in one call, colour is worked out in the vertex shader
+        glBindVertexArray(drawVAO);
+        glUniform1i(particleFixedColorLoc, GL_FALSE);
+        glDrawArrays(GL_POINTS, first, (GLsizei)n);
 
-        float blackHole[2] = { centerX, centerY };
-        glBufferSubData(GL_ARRAY_BUFFER, 0, 2 * sizeof(float), blackHole);
+        glBindVertexArray(particleVAO);
+        glUniform1i(particleFixedColorLoc, GL_TRUE);
         glUniform3f(particleColorLoc, 0.8f, 0.2f, 0.0f);  // Orange-red black hole
-        glDrawArrays(GL_POINTS, 0, 1);
-        
+        glDrawArrays(GL_POINTS, blackHoleFirst, (GLsizei)holeCount);
+
+        // Regions for this frame can't be reused until these draws have finished
+        particleStream.fence();
+        gpuTimers.end();
+        uint64_t bloomStart = Profiler::nowNs();
+        profiler.add(ZoneParticleDraw, drawStart, bloomStart);
+
+        // Bloom and tonemap into the video frame or the window
+        if (hdr) {
+            gpuTimers.begin(ZoneBloom);
+            if (recording) recorder.bind();
+            else glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            bloom.resolve();
+            gpuTimers.end();
+            profiler.add(ZoneBloom, bloomStart, Profiler::nowNs());
+        }
+
+        if (recording) {
+            recorder.capture();
+            if (recordFrames > 0 && recorder.framesCaptured() >= recordFrames) glfwSetWindowShouldClose(window, GLFW_TRUE);
+            if (!offscreen) recorder.blitToScreen(fbWidth, fbHeight);
+        }
+
+        // Overlay goes on the screen only, never into the recording
+        if (showProfiler && !offscreen) profilerOverlay.draw(profiler, fbWidth, fbHeight, frameArena);
+
         // Present rendered frame and handle window events
-        glfwSwapBuffers(window);
+        uint64_t swapStart = Profiler::nowNs();
+        if (!offscreen) glfwSwapBuffers(window);
+        profiler.add(ZoneSwap, swapStart, Profiler::nowNs());
         glfwPollEvents();
+
+        gpuTimers.endFrame(profiler);
+        profiler.endFrame();
+
+        bool keyDown = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+        if (keyDown && !profilerKeyDown) showProfiler = !showProfiler;
+        profilerKeyDown = keyDown;
+        if (showProfiler && now - lastTitleUpdate > 0.5) {
+            setProfilerTitle(window, profiler, frameArena);
+            lastTitleUpdate = now;
+        } else if (!showProfiler && lastTitleUpdate > 0.0) {
+            glfwSetWindowTitle(window, windowTitle);
+            lastTitleUpdate = 0.0;
+        }
+
+        // Config file saved: the sim thread applies it before its next step, the
+        // buffers above grow when the first snapshot that needs it arrives
+        if (configPath && configWatcher.changed()) {
+            SimParams reloaded; // from the defaults, a key taken out of the file goes back to its default
+            if (loadParams(configPath, overrides, reloaded)) {
+                cout << "Reloaded " << configPath << endl;
+                if (useGpu && (reloaded.particles != params.particles || reloaded.trailLength != params.trailLength)) {
+                    cerr << "GPU backend can't resize its particles, keeping count and trail length\n";
+                    reloaded.particles = params.particles;
+                    reloaded.trailLength = params.trailLength;
+                }
+                if (!useGpu) mailbox.post(reloaded);
+                params = reloaded;
+                simRate = params.stepRate;
+            }
+            frameAllocations.rewarm(); // reading and parsing the file allocates
+        }
+        frameAllocations.end();
+    }
+    if (frameAllocations.allocations() > 0) {
+        cerr << frameAllocations.allocations() << " heap allocations in " << frameAllocations.frames()
+             << " frames after warm-up, --alloc-check stops at the first\n";
+    }
+
+    simRunning = false;
+    if (simThread.joinable()) simThread.join();
+    gpuPhysics.destroy();
+    trailHistory.destroy();
+    gpuTimers.destroy();
+    profilerOverlay.destroy();
+    if (hdr) bloom.destroy();
+    if (tracePath) {
+        if (profiler.writeTrace(tracePath)) cout << "Trace written to " << tracePath << endl;
+        else cerr << "Failed to write trace " << tracePath << "\n";
+    }
+    if (recording) {
+        recorder.destroy();
+        cout << "Recorded " << recorder.framesCaptured() << " frames" << endl;
     }
 
-    glDeleteBuffers(1, &particleVBO);
+    particleStream.destroy();
     glDeleteVertexArrays(1, &particleVAO);
-    glDeleteBuffers(1, &trailVBO);
+    trailStream.destroy();
     glDeleteVertexArrays(1, &trailVAO);
     glDeleteProgram(particleProgram);
     glDeleteProgram(trailProgram);
@@ -0,0 +1,395 @@
+#include "physics.h"
+#include "thread_pool.h"
+#include <cmath>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+// Gravitational acceleration toward origin (black hole at center), for n particles at once
+void gravity(const float* posX, const float* posY, float* accX, float* accY, size_t n, float G, float M) {
+    for (size_t i = 0; i < n; ++i) {
+        centralAcceleration(posX[i], posY[i], G, M, accX[i], accY[i]);
+    }
+}
+
+void calcTemp(const float* posX, const float* posY, const float* velX, const float* velY, float* temp, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        float speed = sqrt(velX[i] * velX[i] + velY[i] * velY[i]);
+        float dist = sqrt((posX[i] - centerX) * (posX[i] - centerX) + (posY[i] - centerY) * (posY[i] - centerY));
+
+        float t = speed * 0.01f + (200.0f / max(dist, 10.0f));
+
+        temp[i] = min(t, 3.0f);
+    }
+}
+
+// Push the current position of particles [begin, end) onto their trails,
+// once a ring is full the newest point overwrites the oldest
+void recordTrails(ParticleSystem &ps, size_t begin, size_t end) {
+    if (ps.trailLength == 0) return;
+    uint32_t len = (uint32_t)ps.trailLength;
+    for (size_t i = begin; i < end; ++i) {
+        uint32_t head = ps.trailHead[i];
+        ps.trailPool[i * len + head] = { ps.posX[i], ps.posY[i] };
+        ps.trailHead[i] = (head + 1 == len) ? 0 : head + 1;
+        if (ps.trailCount[i] < len) ps.trailCount[i]++;
+    }
+}
+
+void ParticleSystem::setTrailLength(size_t length) {
+    if (length == trailLength) return;
+    vector<Vec2> pool(size() * length);
+    for (size_t i = 0; i < size(); ++i) {
+        TrailSpan first = { nullptr, 0 }, second = { nullptr, 0 };
+        if (trailLength > 0) trailSpans(i, first, second);
+        size_t count = first.size + second.size, keep = min(count, length);
+        Vec2* out = pool.data() + i * length;
+        for (size_t k = count - keep; k < count; ++k) *out++ = k < first.size ? first.data[k] : second.data[k - first.size];
+        trailCount[i] = (uint32_t)keep;
+        trailHead[i] = keep < length ? (uint32_t)keep : 0;
+    }
+    trailPool.swap(pool);
+    trailLength = length;
+}
+
+void integrate(float* px, float* py, float* vx, float* vy, const float* ax, const float* ay,
+               float* temp, size_t n, float dt) {
+    for (size_t i = 0; i < n; ++i) {
+        vx[i] += ax[i] * dt; // add one unit of acceleration to velocities
+        vy[i] += ay[i] * dt;
+        px[i] += vx[i] * dt; // update positions using velocity
+        py[i] += vy[i] * dt;
+    }
+
+    calcTemp(px, py, vx, vy, temp, n);
+}
+
+void stepScalar(float* px, float* py, float* vx, float* vy, float* ax, float* ay,
+                float* temp, size_t n, float dt, float G, float M) {
+    gravity(px, py, ax, ay, n, G, M); // create the acceleration vectors
+    integrate(px, py, vx, vy, ax, ay, temp, n, dt);
+}
+
+void holeStepScalar(float* px, float* py, float* vx, float* vy, float* ax, float* ay,
+                    float* temp, size_t n, float dt, float gm, float shift, float geodesicTerm) {
+    for (size_t i = 0; i < n; ++i) {
+        float dx = px[i] - centerX, dy = py[i] - centerY;
+        float s = max(sqrt(dx * dx + dy * dy), 5.0f);
+        float g = max(s - shift, 5.0f);
+        float L = dx * vy[i] - dy * vx[i];
+        float k = gm / (g * g * s) + geodesicTerm * L * L / (s * s * s * s * s);
+        ax[i] = -k * dx;
+        ay[i] = -k * dy;
+    }
+    integrate(px, py, vx, vy, ax, ay, temp, n, dt);
+}
+
+// The vector kernels below do the same maths as stepScalar but replace sqrt/divide
+// with rsqrt plus one Newton-Raphson step. The softening clamp r >= 5 becomes
+// 1/r <= 0.2 and max(dist, 10) becomes 1/dist <= 0.1. Leftover particles that do
+// not fill a whole register go through stepScalar. The hole kernels also divide
+// by g^2 with rcp plus a Newton-Raphson step
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2,fma")))
+static inline __m256 rsqrtAVX2(__m256 x) {
+    __m256 y = _mm256_rsqrt_ps(x);
+    // y * (1.5 - 0.5 * x * y * y)
+    __m256 hx = _mm256_mul_ps(x, _mm256_set1_ps(0.5f));
+    return _mm256_mul_ps(y, _mm256_fnmadd_ps(hx, _mm256_mul_ps(y, y), _mm256_set1_ps(1.5f)));
+}
+
+__attribute__((target("avx2,fma")))
+void stepAVX2(float* px, float* py, float* vx, float* vy, float* ax, float* ay,
+              float* temp, size_t n, float dt, float G, float M) {
+    const __m256 cx = _mm256_set1_ps(centerX), cy = _mm256_set1_ps(centerY);
+    const __m256 gm = _mm256_set1_ps(G * M), vdt = _mm256_set1_ps(dt);
+    const __m256 invSoft = _mm256_set1_ps(1.0f / 5.0f), invMinDist = _mm256_set1_ps(1.0f / 10.0f);
+    const __m256 speedScale = _mm256_set1_ps(0.01f), distScale = _mm256_set1_ps(200.0f);
+    const __m256 maxTemp = _mm256_set1_ps(3.0f);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(px + i), y = _mm256_loadu_ps(py + i);
+        __m256 dx = _mm256_sub_ps(x, cx), dy = _mm256_sub_ps(y, cy);
+        __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+        __m256 invR = rsqrtAVX2(r2);
+        __m256 F = _mm256_mul_ps(gm, _mm256_mul_ps(invR, invR)); // G * M / r2
+        __m256 k = _mm256_mul_ps(F, _mm256_min_ps(invR, invSoft));
+        __m256 accX = _mm256_mul_ps(_mm256_sub_ps(_mm256_setzero_ps(), k), dx);
+        __m256 accY = _mm256_mul_ps(_mm256_sub_ps(_mm256_setzero_ps(), k), dy);
+
+        __m256 velX = _mm256_fmadd_ps(accX, vdt, _mm256_loadu_ps(vx + i));
+        __m256 velY = _mm256_fmadd_ps(accY, vdt, _mm256_loadu_ps(vy + i));
+        x = _mm256_fmadd_ps(velX, vdt, x);
+        y = _mm256_fmadd_ps(velY, vdt, y);
+
+        __m256 speed = _mm256_sqrt_ps(_mm256_fmadd_ps(velX, velX, _mm256_mul_ps(velY, velY)));
+        dx = _mm256_sub_ps(x, cx);
+        dy = _mm256_sub_ps(y, cy);
+        __m256 invDist = _mm256_min_ps(rsqrtAVX2(_mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy))), invMinDist);
+        __m256 t = _mm256_fmadd_ps(speed, speedScale, _mm256_mul_ps(distScale, invDist));
+
+        _mm256_storeu_ps(px + i, x);
+        _mm256_storeu_ps(py + i, y);
+        _mm256_storeu_ps(vx + i, velX);
+        _mm256_storeu_ps(vy + i, velY);
+        _mm256_storeu_ps(ax + i, accX);
+        _mm256_storeu_ps(ay + i, accY);
+        _mm256_storeu_ps(temp + i, _mm256_min_ps(t, maxTemp));
+    }
+    stepScalar(px + i, py + i, vx + i, vy + i, ax + i, ay + i, temp + i, n - i, dt, G, M);
+}
+
+__attribute__((target("avx2,fma")))
+void holeStepAVX2(float* px, float* py, float* vx, float* vy, float* ax, float* ay,
+                  float* temp, size_t n, float dt, float gm, float shift, float geodesicTerm) {
+    const __m256 cx = _mm256_set1_ps(centerX), cy = _mm256_set1_ps(centerY);
+    const __m256 vgm = _mm256_set1_ps(gm), vdt = _mm256_set1_ps(dt);
+    const __m256 vshift = _mm256_set1_ps(shift), vterm = _mm256_set1_ps(geodesicTerm);
+    const __m256 soft = _mm256_set1_ps(5.0f), invSoft = _mm256_set1_ps(1.0f / 5.0f), two = _mm256_set1_ps(2.0f);
+    const __m256 invMinDist = _mm256_set1_ps(1.0f / 10.0f);
+    const __m256 speedScale = _mm256_set1_ps(0.01f), distScale = _mm256_set1_ps(200.0f);
+    const __m256 maxTemp = _mm256_set1_ps(3.0f);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(px + i), y = _mm256_loadu_ps(py + i);
+        __m256 u = _mm256_loadu_ps(vx + i), v = _mm256_loadu_ps(vy + i);
+        __m256 dx = _mm256_sub_ps(x, cx), dy = _mm256_sub_ps(y, cy);
+        __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+        __m256 invS = _mm256_min_ps(rsqrtAVX2(r2), invSoft);
+        __m256 g = _mm256_max_ps(_mm256_sub_ps(_mm256_max_ps(_mm256_mul_ps(r2, invS), soft), vshift), soft);
+        __m256 g2 = _mm256_mul_ps(g, g);
+        __m256 invG2 = _mm256_rcp_ps(g2);
+        invG2 = _mm256_mul_ps(invG2, _mm256_fnmadd_ps(g2, invG2, two));
+        __m256 L = _mm256_fmsub_ps(dx, v, _mm256_mul_ps(dy, u));
+        __m256 invS2 = _mm256_mul_ps(invS, invS);
+        __m256 extra = _mm256_mul_ps(_mm256_mul_ps(vterm, _mm256_mul_ps(L, L)), _mm256_mul_ps(invS2, invS2));
+        __m256 k = _mm256_mul_ps(_mm256_fmadd_ps(vgm, invG2, extra), invS);
+        __m256 accX = _mm256_mul_ps(_mm256_sub_ps(_mm256_setzero_ps(), k), dx);
+        __m256 accY = _mm256_mul_ps(_mm256_sub_ps(_mm256_setzero_ps(), k), dy);
+
+        __m256 velX = _mm256_fmadd_ps(accX, vdt, u);
+        __m256 velY = _mm256_fmadd_ps(accY, vdt, v);
+        x = _mm256_fmadd_ps(velX, vdt, x);
+        y = _mm256_fmadd_ps(velY, vdt, y);
+
+        __m256 speed = _mm256_sqrt_ps(_mm256_fmadd_ps(velX, velX, _mm256_mul_ps(velY, velY)));
+        dx = _mm256_sub_ps(x, cx);
+        dy = _mm256_sub_ps(y, cy);
+        __m256 invDist = _mm256_min_ps(rsqrtAVX2(_mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy))), invMinDist);
+        __m256 t = _mm256_fmadd_ps(speed, speedScale, _mm256_mul_ps(distScale, invDist));
+
+        _mm256_storeu_ps(px + i, x);
+        _mm256_storeu_ps(py + i, y);
+        _mm256_storeu_ps(vx + i, velX);
+        _mm256_storeu_ps(vy + i, velY);
+        _mm256_storeu_ps(ax + i, accX);
+        _mm256_storeu_ps(ay + i, accY);
+        _mm256_storeu_ps(temp + i, _mm256_min_ps(t, maxTemp));
+    }
+    holeStepScalar(px + i, py + i, vx + i, vy + i, ax + i, ay + i, temp + i, n - i, dt, gm, shift, geodesicTerm);
+}
+
+// GCC 12 warns about the _mm512_undefined_ps() passthrough inside its own intrinsic headers
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+static inline __m512 rsqrtAVX512(__m512 x) {
+    __m512 y = _mm512_rsqrt14_ps(x);
+    __m512 hx = _mm512_mul_ps(x, _mm512_set1_ps(0.5f));
+    return _mm512_mul_ps(y, _mm512_fnmadd_ps(hx, _mm512_mul_ps(y, y), _mm512_set1_ps(1.5f)));
+}
+
+__attribute__((target("avx512f")))
+void stepAVX512(float* px, float* py, float* vx, float* vy, float* ax, float* ay,
+                float* temp, size_t n, float dt, float G, float M) {
+    const __m512 cx = _mm512_set1_ps(centerX), cy = _mm512_set1_ps(centerY);
+    const __m512 gm = _mm512_set1_ps(G * M), vdt = _mm512_set1_ps(dt);
+    const __m512 invSoft = _mm512_set1_ps(1.0f / 5.0f), invMinDist = _mm512_set1_ps(1.0f / 10.0f);
+    const __m512 speedScale = _mm512_set1_ps(0.01f), distScale = _mm512_set1_ps(200.0f);
+    const __m512 maxTemp = _mm512_set1_ps(3.0f);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 x = _mm512_loadu_ps(px + i), y = _mm512_loadu_ps(py + i);
+        __m512 dx = _mm512_sub_ps(x, cx), dy = _mm512_sub_ps(y, cy);
+        __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+        __m512 invR = rsqrtAVX512(r2);
+        __m512 F = _mm512_mul_ps(gm, _mm512_mul_ps(invR, invR));
+        __m512 k = _mm512_mul_ps(F, _mm512_min_ps(invR, invSoft));
+        __m512 accX = _mm512_mul_ps(_mm512_sub_ps(_mm512_setzero_ps(), k), dx);
+        __m512 accY = _mm512_mul_ps(_mm512_sub_ps(_mm512_setzero_ps(), k), dy);
+
+        __m512 velX = _mm512_fmadd_ps(accX, vdt, _mm512_loadu_ps(vx + i));
+        __m512 velY = _mm512_fmadd_ps(accY, vdt, _mm512_loadu_ps(vy + i));
+        x = _mm512_fmadd_ps(velX, vdt, x);
+        y = _mm512_fmadd_ps(velY, vdt, y);
+
+        __m512 speed = _mm512_sqrt_ps(_mm512_fmadd_ps(velX, velX, _mm512_mul_ps(velY, velY)));
+        dx = _mm512_sub_ps(x, cx);
+        dy = _mm512_sub_ps(y, cy);
+        __m512 invDist = _mm512_min_ps(rsqrtAVX512(_mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy))), invMinDist);
+        __m512 t = _mm512_fmadd_ps(speed, speedScale, _mm512_mul_ps(distScale, invDist));
+
+        _mm512_storeu_ps(px + i, x);
+        _mm512_storeu_ps(py + i, y);
+        _mm512_storeu_ps(vx + i, velX);
+        _mm512_storeu_ps(vy + i, velY);
+        _mm512_storeu_ps(ax + i, accX);
+        _mm512_storeu_ps(ay + i, accY);
+        _mm512_storeu_ps(temp + i, _mm512_min_ps(t, maxTemp));
+    }
+    stepScalar(px + i, py + i, vx + i, vy + i, ax + i, ay + i, temp + i, n - i, dt, G, M);
+}
+
+__attribute__((target("avx512f")))
+void holeStepAVX512(float* px, float* py, float* vx, float* vy, float* ax, float* ay,
+                    float* temp, size_t n, float dt, float gm, float shift, float geodesicTerm) {
+    const __m512 cx = _mm512_set1_ps(centerX), cy = _mm512_set1_ps(centerY);
+    const __m512 vgm = _mm512_set1_ps(gm), vdt = _mm512_set1_ps(dt);
+    const __m512 vshift = _mm512_set1_ps(shift), vterm = _mm512_set1_ps(geodesicTerm);
+    const __m512 soft = _mm512_set1_ps(5.0f), invSoft = _mm512_set1_ps(1.0f / 5.0f), two = _mm512_set1_ps(2.0f);
+    const __m512 invMinDist = _mm512_set1_ps(1.0f / 10.0f);
+    const __m512 speedScale = _mm512_set1_ps(0.01f), distScale = _mm512_set1_ps(200.0f);
+    const __m512 maxTemp = _mm512_set1_ps(3.0f);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 x = _mm512_loadu_ps(px + i), y = _mm512_loadu_ps(py + i);
+        __m512 u = _mm512_loadu_ps(vx + i), v = _mm512_loadu_ps(vy + i);
+        __m512 dx = _mm512_sub_ps(x, cx), dy = _mm512_sub_ps(y, cy);
+        __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+        __m512 invS = _mm512_min_ps(rsqrtAVX512(r2), invSoft);
+        __m512 g = _mm512_max_ps(_mm512_sub_ps(_mm512_max_ps(_mm512_mul_ps(r2, invS), soft), vshift), soft);
+        __m512 g2 = _mm512_mul_ps(g, g);
+        __m512 invG2 = _mm512_rcp14_ps(g2);
+        invG2 = _mm512_mul_ps(invG2, _mm512_fnmadd_ps(g2, invG2, two));
+        __m512 L = _mm512_fmsub_ps(dx, v, _mm512_mul_ps(dy, u));
+        __m512 invS2 = _mm512_mul_ps(invS, invS);
+        __m512 extra = _mm512_mul_ps(_mm512_mul_ps(vterm, _mm512_mul_ps(L, L)), _mm512_mul_ps(invS2, invS2));
+        __m512 k = _mm512_mul_ps(_mm512_fmadd_ps(vgm, invG2, extra), invS);
+        __m512 accX = _mm512_mul_ps(_mm512_sub_ps(_mm512_setzero_ps(), k), dx);
+        __m512 accY = _mm512_mul_ps(_mm512_sub_ps(_mm512_setzero_ps(), k), dy);
+
+        __m512 velX = _mm512_fmadd_ps(accX, vdt, u);
+        __m512 velY = _mm512_fmadd_ps(accY, vdt, v);
+        x = _mm512_fmadd_ps(velX, vdt, x);
+        y = _mm512_fmadd_ps(velY, vdt, y);
+
+        __m512 speed = _mm512_sqrt_ps(_mm512_fmadd_ps(velX, velX, _mm512_mul_ps(velY, velY)));
+        dx = _mm512_sub_ps(x, cx);
+        dy = _mm512_sub_ps(y, cy);
+        __m512 invDist = _mm512_min_ps(rsqrtAVX512(_mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy))), invMinDist);
+        __m512 t = _mm512_fmadd_ps(speed, speedScale, _mm512_mul_ps(distScale, invDist));
+
+        _mm512_storeu_ps(px + i, x);
+        _mm512_storeu_ps(py + i, y);
+        _mm512_storeu_ps(vx + i, velX);
+        _mm512_storeu_ps(vy + i, velY);
+        _mm512_storeu_ps(ax + i, accX);
+        _mm512_storeu_ps(ay + i, accY);
+        _mm512_storeu_ps(temp + i, _mm512_min_ps(t, maxTemp));
+    }
+    holeStepScalar(px + i, py + i, vx + i, vy + i, ax + i, ay + i, temp + i, n - i, dt, gm, shift, geodesicTerm);
+}
+
+#pragma GCC diagnostic pop
+
+#elif defined(__ARM_NEON)
+
+static inline float32x4_t rsqrtNEON(float32x4_t x) {
+    float32x4_t y = vrsqrteq_f32(x);
+    y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(x, y), y)); // estimate is only ~8 bits,
+    y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(x, y), y)); // so refine twice
+    return y;
+}
+
+void stepNEON(float* px, float* py, float* vx, float* vy, float* ax, float* ay,
+              float* temp, size_t n, float dt, float G, float M) {
+    const float32x4_t cx = vdupq_n_f32(centerX), cy = vdupq_n_f32(centerY);
+    const float32x4_t gm = vdupq_n_f32(G * M), vdt = vdupq_n_f32(dt);
+    const float32x4_t invSoft = vdupq_n_f32(1.0f / 5.0f), invMinDist = vdupq_n_f32(1.0f / 10.0f);
+    const float32x4_t speedScale = vdupq_n_f32(0.01f), distScale = vdupq_n_f32(200.0f);
+    const float32x4_t maxTemp = vdupq_n_f32(3.0f);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t x = vld1q_f32(px + i), y = vld1q_f32(py + i);
+        float32x4_t dx = vsubq_f32(x, cx), dy = vsubq_f32(y, cy);
+        float32x4_t r2 = vmlaq_f32(vmulq_f32(dy, dy), dx, dx);
+        float32x4_t invR = rsqrtNEON(r2);
+        float32x4_t F = vmulq_f32(gm, vmulq_f32(invR, invR));
+        float32x4_t k = vnegq_f32(vmulq_f32(F, vminq_f32(invR, invSoft)));
+        float32x4_t accX = vmulq_f32(k, dx);
+        float32x4_t accY = vmulq_f32(k, dy);
+
+        float32x4_t velX = vmlaq_f32(vld1q_f32(vx + i), accX, vdt);
+        float32x4_t velY = vmlaq_f32(vld1q_f32(vy + i), accY, vdt);
+        x = vmlaq_f32(x, velX, vdt);
+        y = vmlaq_f32(y, velY, vdt);
+
+        float32x4_t speed = vsqrtq_f32(vmlaq_f32(vmulq_f32(velY, velY), velX, velX));
+        dx = vsubq_f32(x, cx);
+        dy = vsubq_f32(y, cy);
+        float32x4_t invDist = vminq_f32(rsqrtNEON(vmlaq_f32(vmulq_f32(dy, dy), dx, dx)), invMinDist);
+        float32x4_t t = vmlaq_f32(vmulq_f32(distScale, invDist), speed, speedScale);
+
+        vst1q_f32(px + i, x);
+        vst1q_f32(py + i, y);
+        vst1q_f32(vx + i, velX);
+        vst1q_f32(vy + i, velY);
+        vst1q_f32(ax + i, accX);
+        vst1q_f32(ay + i, accY);
+        vst1q_f32(temp + i, vminq_f32(t, maxTemp));
+    }
+    stepScalar(px + i, py + i, vx + i, vy + i, ax + i, ay + i, temp + i, n - i, dt, G, M);
+}
+
+#endif
+
+// Pick the widest kernel the CPU we are running on supports
+StepKernel selectStepKernel(const char** name) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) { *name = "AVX-512"; return stepAVX512; }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) { *name = "AVX2"; return stepAVX2; }
+#elif defined(__ARM_NEON)
+    *name = "NEON"; return stepNEON;
+#endif
+    *name = "scalar";
+    return stepScalar;
+}
+
+// No NEON version yet, pw and geodesic fall back to the scalar loop there
+HoleKernel selectHoleKernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return holeStepAVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return holeStepAVX2;
+#endif
+    return holeStepScalar;
+}
+
+// Update particles [begin, end)
+void updateParticles(ParticleSystem &ps, size_t begin, size_t end, float dt, float G, float M,
+                     StepKernel kernel) {
+    recordTrails(ps, begin, end);
+
+    kernel(ps.posX.data() + begin, ps.posY.data() + begin,
+           ps.velX.data() + begin, ps.velY.data() + begin,
+           ps.accX.data() + begin, ps.accY.data() + begin,
+           ps.temp.data() + begin, end - begin, dt, G, M);
+}
+
+void stepParticles(ParticleSystem &ps, ThreadPool &pool, float dt, StepKernel kernel) {
+    pool.parallelFor(ps.size(), physicsChunkSize, [&](size_t begin, size_t end) {
+        updateParticles(ps, begin, end, dt, G, M, kernel);
+    });
+}
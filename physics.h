@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class ThreadPool;
+
+// Simple 2D vector
+struct Vec2 {
+    float x, y;
+};
+
+// Contiguous run of trail points
+struct TrailSpan {
+    const Vec2* data;
+    size_t size;
+};
+
+const int width = 800, height = 600;
+const float G = 200.0f, M = 2000.0f;
+const int numParticles = 100;
+const size_t maxTrailLength = 50;
+const float defaultDt = 0.008f; // small timestep for stability
+const float centerX = (float)width / 2;
+const float centerY = (float)height / 2;
+const float blackHoleRadius = 15.0f;
+const float accretionDiskRadius = 80.0f;
+const size_t physicsChunkSize = 4096; // particles per thread pool task, ~160KB of state so it sits in L2
+
+// Particle store laid out as structure-of-arrays: every field lives in its own
+// contiguous array so the batch kernels stream straight through memory
+struct ParticleSystem {
+    std::vector<float> posX, posY;
+    std::vector<float> velX, velY;
+    std::vector<float> accX, accY; // scratch filled by gravity() each step
+    std::vector<float> temp;
+    std::vector<float> stepSize; // adaptive integrators carry each particle's last substep here
+    std::vector<float> internalEnergy; // SPH gas only, per unit mass. 0 elsewhere
+
+    // trail history of every particle shares one pool, particle i owns the
+    // ring of slots [i * trailLength, (i + 1) * trailLength). trailHead[i] is the
+    // slot the next point is written to, trailCount[i] how many slots are in use
+    size_t trailLength = 0;
+    std::vector<Vec2> trailPool;
+    std::vector<uint32_t> trailHead;
+    std::vector<uint32_t> trailCount;
+
+    // id[i] names the particle in slot i for as long as it lives, slots get
+    // reused by swapRemove() and shuffled by MortonSorter. slotOf is the other
+    // way round, indexed by id, noSlot while the id is free, so anything written
+    // out can follow particles rather than slots. Retired ids go on freeIds and
+    // the smallest free one is handed out first, nextId only grows when none is
+    // free. So the tables stay as big as the most particles ever alive at once,
+    // and which id a spawn gets depends only on which ids are live, not on the
+    // order they died in, and a resumed run hands out the same ones. An id on its
+    // own names a different particle after a reuse, id plus generation never does
+    std::vector<uint32_t> id;
+    uint32_t nextId = 0;
+    std::vector<uint32_t> slotOf;
+    std::vector<uint32_t> generation; // by id, how many particles held it before the current one
+    std::vector<uint32_t> freeIds; // min-heap
+    static constexpr uint32_t noSlot = UINT32_MAX;
+
+    size_t size() const { return posX.size(); }
+
+    void reserve(size_t n, size_t maxTrail) {
+        posX.reserve(n); posY.reserve(n);
+        velX.reserve(n); velY.reserve(n);
+        accX.reserve(n); accY.reserve(n);
+        temp.reserve(n);
+        stepSize.reserve(n);
+        internalEnergy.reserve(n);
+        trailLength = maxTrail;
+        trailPool.reserve(n * maxTrail);
+        trailHead.reserve(n);
+        trailCount.reserve(n);
+        id.reserve(n);
+        slotOf.reserve(n);
+        generation.reserve(n);
+        freeIds.reserve(n);
+    }
+
+    // An id for a new particle in `slot`
+    uint32_t takeId(size_t slot) {
+        uint32_t k;
+        if (!freeIds.empty()) {
+            std::pop_heap(freeIds.begin(), freeIds.end(), std::greater<uint32_t>());
+            k = freeIds.back();
+            freeIds.pop_back();
+            generation[k]++;
+        } else {
+            k = nextId++;
+            slotOf.push_back(noSlot);
+            generation.push_back(0);
+        }
+        slotOf[k] = (uint32_t)slot;
+        return k;
+    }
+
+    void releaseId(uint32_t k) {
+        slotOf[k] = noSlot;
+        freeIds.push_back(k);
+        std::push_heap(freeIds.begin(), freeIds.end(), std::greater<uint32_t>());
+    }
+
+    void add(Vec2 pos, Vec2 vel, float t) {
+        posX.push_back(pos.x); posY.push_back(pos.y);
+        velX.push_back(vel.x); velY.push_back(vel.y);
+        accX.push_back(0.0f); accY.push_back(0.0f);
+        temp.push_back(t);
+        stepSize.push_back(0.0f);
+        internalEnergy.push_back(0.0f);
+        trailPool.resize(trailPool.size() + trailLength);
+        trailHead.push_back(0);
+        trailCount.push_back(0);
+        id.push_back(takeId(size() - 1));
+    }
+
+    // Drop particle i by moving the last one into its slot, so the live ones
+    // stay packed at the front. Capacity is kept, re-adding doesn't allocate
+    void swapRemove(size_t i) {
+        size_t last = size() - 1;
+        releaseId(id[i]);
+        if (i != last) {
+            slotOf[id[last]] = (uint32_t)i;
+            posX[i] = posX[last]; posY[i] = posY[last];
+            velX[i] = velX[last]; velY[i] = velY[last];
+            accX[i] = accX[last]; accY[i] = accY[last];
+            temp[i] = temp[last];
+            stepSize[i] = stepSize[last];
+            internalEnergy[i] = internalEnergy[last];
+            const Vec2* trail = trailPool.data() + last * trailLength; // trailPool is empty with no trails
+            std::copy(trail, trail + trailLength, trailPool.data() + i * trailLength);
+            trailHead[i] = trailHead[last];
+            trailCount[i] = trailCount[last];
+            id[i] = id[last];
+        }
+        posX.pop_back(); posY.pop_back();
+        velX.pop_back(); velY.pop_back();
+        accX.pop_back(); accY.pop_back();
+        temp.pop_back();
+        stepSize.pop_back();
+        internalEnergy.pop_back();
+        trailPool.resize(last * trailLength);
+        trailHead.pop_back();
+        trailCount.pop_back();
+        id.pop_back();
+    }
+
+    // Keep the first n particles and drop the rest, capacity is kept
+    void truncate(size_t n) {
+        if (n >= size()) return;
+        for (size_t i = n; i < size(); ++i) releaseId(id[i]);
+        posX.resize(n); posY.resize(n);
+        velX.resize(n); velY.resize(n);
+        accX.resize(n); accY.resize(n);
+        temp.resize(n);
+        stepSize.resize(n);
+        internalEnergy.resize(n);
+        trailPool.resize(n * trailLength);
+        trailHead.resize(n);
+        trailCount.resize(n);
+        id.resize(n);
+    }
+
+    // slotOf and freeIds from scratch out of id and nextId, after id (and
+    // generation, nextId long) were filled in bulk. Every id has to be below
+    // nextId and appear once, see MappedSnapshot::open
+    void rebuildSlots() {
+        slotOf.assign(nextId, noSlot);
+        for (size_t i = 0; i < size(); ++i) slotOf[id[i]] = (uint32_t)i;
+        freeIds.clear();
+        for (uint32_t k = 0; k < nextId; ++k) {
+            if (slotOf[k] == noSlot) freeIds.push_back(k); // ascending, already a min-heap
+        }
+    }
+
+    // Re-lay the trail pool as rings of `length`, every particle keeps its newest points
+    void setTrailLength(size_t length);
+
+    // Trail of particle i oldest to newest, split into at most two contiguous runs
+    // (the ring wraps once), second run is empty when it does not wrap
+    void trailSpans(size_t i, TrailSpan &first, TrailSpan &second) const {
+        const Vec2* ring = &trailPool[i * trailLength];
+        size_t count = trailCount[i];
+        size_t start = (trailHead[i] + trailLength - count) % trailLength;
+        size_t firstSize = std::min(count, trailLength - start);
+        first = { ring + start, firstSize };
+        second = { ring, count - firstSize };
+    }
+};
+
+// Gravitational acceleration toward origin (black hole at center) for one particle
+inline void centralAcceleration(float x, float y, float G, float M, float& ax, float& ay) {
+    float dx = x - centerX; // computer x displacement
+    float dy = y - centerY; // computer y displacement
+    float r2 = dx*dx + dy*dy;
+    float r = std::sqrt(r2);
+    if (r < 5.0f) r = 5.0f; // prevent singularity
+    float F = G * M / r2; // F = magnitude of acceleration
+    ax = -F * dx / r; // we create an acceleration vecotr towards the blackhole
+    ay = -F * dy / r;
+}
+
+// Batch kernels over n particles, see physics.cpp
+void gravity(const float* posX, const float* posY, float* accX, float* accY, size_t n, float G, float M);
+void calcTemp(const float* posX, const float* posY, const float* velX, const float* velY, float* temp, size_t n);
+void recordTrails(ParticleSystem &ps, size_t begin, size_t end);
+
+// Semi-implicit Euler with precomputed accelerations, then calcTemp
+void integrate(float* px, float* py, float* vx, float* vy, const float* ax, const float* ay,
+               float* temp, size_t n, float dt);
+
+// Fused gravity + integration + temperature pass over n particles
+typedef void (*StepKernel)(float* px, float* py, float* vx, float* vy, float* ax, float* ay,
+                           float* temp, size_t n, float dt, float G, float M);
+
+void stepScalar(float* px, float* py, float* vx, float* vy, float* ax, float* ay,
+                float* temp, size_t n, float dt, float G, float M);
+
+// Pick the widest kernel the CPU we are running on supports
+StepKernel selectStepKernel(const char** name);
+
+// The same fused pass around a hole with a relativistic term, for pw and
+// geodesic. With s = max(r, 5), g = max(s - shift, 5) and L = dx vy - dy vx:
+//   a = -(GM / (g^2 s) + geodesicTerm L^2 / s^5) (dx, dy)
+// pw is shift = rs and no L term, geodesic is shift 0 and geodesicTerm = 1.5 rs
+typedef void (*HoleKernel)(float* px, float* py, float* vx, float* vy, float* ax, float* ay,
+                           float* temp, size_t n, float dt, float gm, float shift, float geodesicTerm);
+
+void holeStepScalar(float* px, float* py, float* vx, float* vy, float* ax, float* ay,
+                    float* temp, size_t n, float dt, float gm, float shift, float geodesicTerm);
+
+// Same choice as selectStepKernel
+HoleKernel selectHoleKernel();
+
+// Update particles [begin, end)
+void updateParticles(ParticleSystem &ps, size_t begin, size_t end, float dt, float G, float M,
+                     StepKernel kernel = stepScalar);
+
+// One full step of every particle, split across the pool in physicsChunkSize chunks
+void stepParticles(ParticleSystem &ps, ThreadPool &pool, float dt, StepKernel kernel);
@@ -0,0 +1,98 @@
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+using namespace std;
+
+const char* const profileZoneNames[profileZoneCount] = {
+    "sim", "pack", "upload", "trail draw", "particle draw", "bloom", "swap",
+};
+
+// Small stable id per thread for the trace, in order of first use
+static uint32_t traceThreadId() {
+    static atomic<uint32_t> next{1};
+    thread_local uint32_t id = next.fetch_add(1);
+    return id;
+}
+
+uint64_t Profiler::nowNs() {
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::add(ProfileZone zone, uint64_t beginNs, uint64_t endNs) {
+    uint64_t duration = endNs > beginNs ? endNs - beginNs : 0;
+    pending[zone].fetch_add(duration, memory_order_relaxed);
+    if (!tracing()) return;
+    lock_guard<mutex> lock(traceMutex);
+    if (events.size() < events.capacity()) events.push_back({ (uint8_t)zone, false, traceThreadId(), beginNs, duration });
+    else droppedEvents++;
+}
+
+void Profiler::addGpu(uint64_t frame, ProfileZone zone, uint64_t issuedNs, uint64_t durationNs) {
+    // only frames still in the history ring can take it
+    if (frame < frameNumber && frameNumber - frame <= historyLength) {
+        gpu[frame % historyLength][zone] += durationNs * 1e-6f;
+    }
+    if (!tracing()) return;
+    lock_guard<mutex> lock(traceMutex);
+    if (events.size() < events.capacity()) events.push_back({ (uint8_t)zone, true, 0, issuedNs, durationNs });
+    else droppedEvents++;
+}
+
+void Profiler::endFrame() {
+    size_t s = (size_t)(frameNumber % historyLength);
+    for (int z = 0; z < profileZoneCount; ++z) {
+        cpu[s][z] = pending[z].exchange(0, memory_order_relaxed) * 1e-6f;
+        gpu[s][z] = 0.0f; // filled in when the queries come back
+    }
+    drift[s][0] = (float)latestDrift[0].load(memory_order_relaxed);
+    drift[s][1] = (float)latestDrift[1].load(memory_order_relaxed);
+    uint64_t now = nowNs();
+    total[s] = (now - frameStart) * 1e-6f;
+    frameStart = now;
+    frameNumber++;
+
+    if (tracing()) {
+        lock_guard<mutex> lock(traceMutex);
+        frameMarks.push_back(now);
+        if (--traceFramesLeft == 0) traceOn = false;
+    }
+}
+
+void Profiler::startTrace(size_t frames) {
+    lock_guard<mutex> lock(traceMutex);
+    // sized once here so a running trace never allocates in the frame loop,
+    // events past this are dropped and counted rather than grown into
+    events.clear();
+    events.reserve(frames * traceEventsPerFrame);
+    frameMarks.clear();
+    frameMarks.reserve(frames);
+    droppedEvents = 0;
+    traceFramesLeft = frames;
+    traceOn = frames > 0;
+}
+
+bool Profiler::writeTrace(const char* path) const {
+    FILE* f = fopen(path, "w");
+    if (!f) return false;
+
+    lock_guard<mutex> lock(traceMutex);
+    uint64_t origin = events.empty() ? 0 : events[0].beginNs;
+    for (const TraceEvent& e : events) origin = min(origin, e.beginNs);
+
+    // Complete ("X") events in microseconds, GPU work on its own track as tid 0
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}");
+    for (const TraceEvent& e : events) {
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                profileZoneNames[e.zone], e.gpu ? "gpu" : "cpu", e.thread,
+                (e.beginNs - origin) * 1e-3, e.durationNs * 1e-3);
+    }
+    for (uint64_t mark : frameMarks) {
+        if (mark < origin) continue;
+        fprintf(f, ",\n{\"name\":\"frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":1,\"ts\":%.3f}", (mark - origin) * 1e-3);
+    }
+    fprintf(f, "\n],\"otherData\":{\"droppedEvents\":%zu}}\n", droppedEvents);
+    return fclose(f) == 0;
+}
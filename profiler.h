@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Frame profiler. ProfileScope adds wall time to one of a fixed set of zones,
+// from any thread; the render thread closes each frame with endFrame(), which
+// moves everything accumulated since into a history ring for the overlay. GPU
+// durations arrive a few frames late (see GpuTimers) and go into the slot of
+// the frame they were measured in. With a trace running every scope is also
+// kept as an event for a Chrome trace (chrome://tracing, Perfetto)
+
+enum ProfileZone {
+    ZoneSim,          // physics step, on the sim thread or as compute dispatches
+    ZonePack,         // snapshot pickup and vertex packing
+    ZoneUpload,       // handing vertex data to GL
+    ZoneTrailDraw,
+    ZoneParticleDraw,
+    ZoneBloom,        // HDR resolve: threshold, blur chain, tonemap
+    ZoneSwap,         // glfwSwapBuffers, includes waiting for vsync
+    profileZoneCount
+};
+
+extern const char* const profileZoneNames[profileZoneCount];
+
+class Profiler {
+public:
+    static const size_t historyLength = 240;
+
+    static uint64_t nowNs();
+
+    // Thread-safe
+    void add(ProfileZone zone, uint64_t beginNs, uint64_t endNs);
+
+    // Render thread only
+    uint64_t frame() const { return frameNumber; }
+    void endFrame();
+    void addGpu(uint64_t frame, ProfileZone zone, uint64_t issuedNs, uint64_t durationNs);
+
+    // Relative energy and angular momentum drift from the diagnostics stage,
+    // thread-safe. Each frame keeps what was newest when it ended
+    void setDrift(double energy, double momentum) {
+        latestDrift[0].store(energy, std::memory_order_relaxed);
+        latestDrift[1].store(momentum, std::memory_order_relaxed);
+    }
+
+    // Milliseconds spent in zone during a finished frame, age 0 = the newest
+    float cpuMs(size_t age, ProfileZone zone) const { return cpu[slot(age)][zone]; }
+    float gpuMs(size_t age, ProfileZone zone) const { return gpu[slot(age)][zone]; }
+    float frameMs(size_t age) const { return total[slot(age)]; }
+    // NaN until something was measured
+    float energyDrift(size_t age) const { return drift[slot(age)][0]; }
+    float momentumDrift(size_t age) const { return drift[slot(age)][1]; }
+    size_t framesRecorded() const { return frameNumber < historyLength ? (size_t)frameNumber : historyLength; }
+
+    // Keep every event of the next `frames` frames, then stop on its own
+    void startTrace(size_t frames);
+    bool tracing() const { return traceOn.load(std::memory_order_relaxed); }
+    bool writeTrace(const char* path) const;
+
+private:
+    struct TraceEvent {
+        uint8_t zone;
+        bool gpu;
+        uint32_t thread;
+        uint64_t beginNs, durationNs;
+    };
+
+    size_t slot(size_t age) const { return (size_t)((frameNumber - 1 - age) % historyLength); }
+
+    std::atomic<uint64_t> pending[profileZoneCount] = {};
+    float cpu[historyLength][profileZoneCount] = {};
+    float gpu[historyLength][profileZoneCount] = {};
+    float total[historyLength] = {};
+    std::atomic<double> latestDrift[2] = { NAN, NAN };
+    float drift[historyLength][2] = {};
+    uint64_t frameNumber = 0;
+    uint64_t frameStart = nowNs();
+
+    std::atomic<bool> traceOn{false};
+    size_t traceFramesLeft = 0;
+    static const size_t traceEventsPerFrame = 64; // room per traced frame, the sim thread may step many times in one
+    size_t droppedEvents = 0;
+    mutable std::mutex traceMutex;
+    std::vector<TraceEvent> events;
+    std::vector<uint64_t> frameMarks;  // start of every traced frame
+};
+
+// Times its own lifetime into zone
+class ProfileScope {
+public:
+    ProfileScope(Profiler& profiler, ProfileZone zone) : profiler(profiler), zone(zone), begin(Profiler::nowNs()) {}
+    ~ProfileScope() { profiler.add(zone, begin, Profiler::nowNs()); }
+
+private:
+    Profiler& profiler;
+    ProfileZone zone;
+    uint64_t begin;
+};
@@ -0,0 +1,197 @@
+#include "profiler_overlay.h"
+#include "frame_arena.h"
+#include "shader.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+void GpuTimers::create() {
+    ring.resize(latency + 1);
+    for (FrameQueries& f : ring) {
+        glGenQueries(profileZoneCount, f.query);
+        fill(std::begin(f.issued), std::end(f.issued), false);
+        f.pending = false;
+    }
+    current = 0;
+}
+
+void GpuTimers::destroy() {
+    for (FrameQueries& f : ring) glDeleteQueries(profileZoneCount, f.query);
+    ring.clear();
+}
+
+void GpuTimers::begin(ProfileZone zone) {
+    if (ring.empty() || open >= 0) return;
+    FrameQueries& f = ring[current];
+    if (f.issued[zone]) return; // one query per zone per frame
+    glBeginQuery(GL_TIME_ELAPSED, f.query[zone]);
+    f.issued[zone] = true;
+    f.issuedNs[zone] = Profiler::nowNs();
+    open = zone;
+}
+
+void GpuTimers::end() {
+    if (open < 0) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    open = -1;
+}
+
+void GpuTimers::endFrame(Profiler& profiler) {
+    if (ring.empty()) return;
+    end();
+    ring[current].pending = true;
+    ring[current].frame = profiler.frame();
+
+    // Oldest first, stop at the first frame the GPU hasn't finished
+    for (int k = 1; k <= latency; ++k) {
+        FrameQueries& f = ring[(current + k) % ring.size()];
+        if (!f.pending) continue;
+        bool ready = true;
+        for (int z = 0; z < profileZoneCount && ready; ++z) {
+            if (!f.issued[z]) continue;
+            GLint available = 0;
+            glGetQueryObjectiv(f.query[z], GL_QUERY_RESULT_AVAILABLE, &available);
+            ready = available != 0;
+        }
+        if (!ready) break;
+        for (int z = 0; z < profileZoneCount; ++z) {
+            if (!f.issued[z]) continue;
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(f.query[z], GL_QUERY_RESULT, &ns);
+            profiler.addGpu(f.frame, (ProfileZone)z, f.issuedNs[z], ns);
+            f.issued[z] = false;
+        }
+        f.pending = false;
+    }
+
+    current = (current + 1) % (int)ring.size();
+    FrameQueries& next = ring[current];
+    if (next.pending) {
+        // the GPU is more than `latency` frames behind, drop that frame's results rather than wait
+        fill(std::begin(next.issued), std::end(next.issued), false);
+        next.pending = false;
+    }
+}
+
+const float ProfilerOverlay::zoneColours[profileZoneCount][3] = {
+    { 0.30f, 0.60f, 1.00f }, // sim
+    { 1.00f, 0.70f, 0.20f }, // pack
+    { 0.90f, 0.30f, 0.90f }, // upload
+    { 0.40f, 0.90f, 0.40f }, // trail draw
+    { 1.00f, 0.35f, 0.30f }, // particle draw
+    { 1.00f, 0.95f, 0.55f }, // bloom
+    { 0.60f, 0.60f, 0.60f }, // swap
+};
+
+const float ProfilerOverlay::driftColours[2][3] = {
+    { 1.00f, 0.80f, 0.25f }, // energy
+    { 0.35f, 0.85f, 1.00f }, // angular momentum
+};
+
+static const char* overlayVertexSrc = R"(
+#version 330 core
+layout(location = 0) in vec2 aPos;           // pixels from the lower left corner
+layout(location = 1) in vec4 aColor;
+uniform vec2 uScreen;
+out vec4 vColor;
+
+void main() {
+    gl_Position = vec4(aPos / uScreen * 2.0 - 1.0, 0.0, 1.0);
+    vColor = aColor;
+}
+)";
+
+static const char* overlayFragmentSrc = R"(
+#version 330 core
+in vec4 vColor;
+out vec4 FragColor;
+
+void main() {
+    FragColor = vColor;
+}
+)";
+
+void ProfilerOverlay::create() {
+    program = createProgram(overlayVertexSrc, overlayFragmentSrc);
+    screenLoc = glGetUniformLocation(program, "uScreen");
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(2 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+}
+
+void ProfilerOverlay::destroy() {
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(program);
+    program = vao = vbo = 0;
+}
+
+// Two triangles of x, y, r, g, b, a at v, moves v past them
+static void addQuad(float*& v, float x0, float y0, float x1, float y1, const float* rgb, float a) {
+    const float corners[6][2] = { { x0, y0 }, { x1, y0 }, { x1, y1 }, { x0, y0 }, { x1, y1 }, { x0, y1 } };
+    for (const auto& c : corners) {
+        const float vertex[6] = { c[0], c[1], rgb[0], rgb[1], rgb[2], a };
+        v = copy(vertex, vertex + 6, v);
+    }
+}
+
+void ProfilerOverlay::draw(const Profiler& profiler, int screenWidth, int screenHeight, FrameArena& arena) {
+    const float left = 10.0f, baseline = 110.0f;   // graph sits 100px either side of the baseline
+    const float pxPerMs = 100.0f / 33.3f;          // full height = two 60 Hz frames
+    const float barWidth = 1.0f;
+    const float grey[3] = { 1.0f, 1.0f, 1.0f };
+
+    // background, a CPU and a GPU bar per zone per frame, three guides, then
+    // the drift strip: background, a guide and two marks per frame
+    size_t maxQuads = 4 + Profiler::historyLength * profileZoneCount * 2 + 2 + Profiler::historyLength * 2;
+    float* vertices = arena.alloc<float>(maxQuads * 36);
+    float* end = vertices;
+    size_t frames = profiler.framesRecorded();
+    addQuad(end, left - 2, baseline - 102, left + Profiler::historyLength * barWidth + 2, baseline + 102, grey, 0.08f);
+    for (size_t age = 0; age < frames; ++age) {
+        float x = left + (Profiler::historyLength - 1 - age) * barWidth;
+        float up = baseline, down = baseline;
+        for (int z = 0; z < profileZoneCount; ++z) {
+            float cpuHeight = min(profiler.cpuMs(age, (ProfileZone)z) * pxPerMs, baseline + 100 - up);
+            float gpuHeight = min(profiler.gpuMs(age, (ProfileZone)z) * pxPerMs, down - (baseline - 100));
+            if (cpuHeight > 0) addQuad(end, x, up, x + barWidth, up + cpuHeight, zoneColours[z], 0.85f);
+            if (gpuHeight > 0) addQuad(end, x, down - gpuHeight, x + barWidth, down, zoneColours[z], 0.85f);
+            up += cpuHeight;
+            down -= gpuHeight;
+        }
+    }
+    float right = left + Profiler::historyLength * barWidth;
+    float frameBudget = 16.7f * pxPerMs;
+    addQuad(end, left, baseline - 0.5f, right, baseline + 0.5f, grey, 0.6f);
+    addQuad(end, left, baseline + frameBudget - 0.5f, right, baseline + frameBudget + 0.5f, grey, 0.3f);
+    addQuad(end, left, baseline - frameBudget - 0.5f, right, baseline - frameBudget + 0.5f, grey, 0.3f);
+
+    // |drift| on a log scale above the graph, 1e-10 at the bottom to 1e-1 at
+    // the top, with a guide at 1e-4. Frames before the first measurement stay empty
+    const float stripBottom = baseline + 108, stripHeight = 54, pxPerDecade = stripHeight / 9;
+    addQuad(end, left - 2, stripBottom - 2, right + 2, stripBottom + stripHeight + 2, grey, 0.08f);
+    addQuad(end, left, stripBottom + 6 * pxPerDecade - 0.5f, right, stripBottom + 6 * pxPerDecade + 0.5f, grey, 0.3f);
+    for (size_t age = 0; age < frames; ++age) {
+        float x = left + (Profiler::historyLength - 1 - age) * barWidth;
+        float drifts[2] = { profiler.energyDrift(age), profiler.momentumDrift(age) };
+        for (int k = 0; k < 2; ++k) {
+            if (!(drifts[k] == drifts[k])) continue;
+            float decades = log10(max(fabs(drifts[k]), 1e-10f)) + 10.0f;
+            float y = stripBottom + min(decades, 9.0f) * pxPerDecade;
+            addQuad(end, x, y - 1.0f, x + barWidth, y + 1.0f, driftColours[k], 0.9f);
+        }
+    }
+
+    glUseProgram(program);
+    glUniform2f(screenLoc, (float)screenWidth, (float)screenHeight);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, (end - vertices) * sizeof(float), vertices, GL_STREAM_DRAW);
+    glDrawArrays(GL_TRIANGLES, 0, (GLsizei)((end - vertices) / 6));
+}
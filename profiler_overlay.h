@@ -0,0 +1,59 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <vector>
+
+#include "profiler.h"
+
+class FrameArena;
+
+// GL_TIME_ELAPSED queries per zone, in a ring of frames. Results are only
+// asked for once GL says they're available, normally `latency` frames on, so
+// reading them never stalls the pipeline. Time-elapsed queries can't nest,
+// zones timed here must not overlap
+class GpuTimers {
+public:
+    static const int latency = 4;
+
+    void create();
+    void destroy();
+
+    void begin(ProfileZone zone);
+    void end();
+    // Collect whatever finished and move on to the next frame's queries.
+    // Call before profiler.endFrame()
+    void endFrame(Profiler& profiler);
+
+private:
+    struct FrameQueries {
+        GLuint query[profileZoneCount];
+        bool issued[profileZoneCount];
+        uint64_t issuedNs[profileZoneCount];
+        uint64_t frame;  // profiler frame the queries belong to
+        bool pending;
+    };
+
+    std::vector<FrameQueries> ring;
+    int current = 0;
+    int open = -1; // zone between begin() and end()
+};
+
+// Stacked bar history of the profiler in the lower left corner: one column per
+// frame, CPU zones above the baseline and GPU zones below it, each zone its own
+// colour. Faint guides mark 1/60 s in both directions. Above it a strip plots
+// the energy and angular momentum drift on a log scale. Numbers go in the window title
+class ProfilerOverlay {
+public:
+    void create();
+    void destroy();
+    // Vertices are built in this frame's arena
+    void draw(const Profiler& profiler, int screenWidth, int screenHeight, FrameArena& arena);
+
+    static const float zoneColours[profileZoneCount][3];
+    static const float driftColours[2][3]; // energy, angular momentum
+
+private:
+    GLuint program = 0, vao = 0, vbo = 0;
+    GLint screenLoc = -1;
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+// Counter-based random numbers: Philox4x32-10 from Salmon et al., "Parallel
+// random numbers: as easy as 1, 2, 3". Every draw is a pure function of a key
+// (the run seed) and a 128-bit counter (what the numbers are for, e.g. the
+// particle index), so there's no generator state to share between threads or
+// save in checkpoints. Counter word 3 says who's drawing, see the streams below
+struct Philox {
+    uint32_t key[2];
+
+    explicit Philox(uint64_t seed) : key{ (uint32_t)seed, (uint32_t)(seed >> 32) } {}
+
+    // Four independent 32-bit words for this counter
+    void operator()(const uint32_t counter[4], uint32_t out[4]) const {
+        uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int round = 0; round < 10; ++round) {
+            uint64_t p0 = (uint64_t)0xD2511F53u * c0, p1 = (uint64_t)0xCD9E8D57u * c2;
+            c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+            c1 = (uint32_t)p1;
+            c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+            c3 = (uint32_t)p0;
+            k0 += 0x9E3779B9u; // Weyl key schedule
+            k1 += 0xBB67AE85u;
+        }
+        out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+    }
+};
+
+// Low byte of counter word 3 says who is drawing, so draws stay apart under one seed
+enum RngStream : uint32_t {
+    RngInit = 0,  // initial particles, counter = particle index
+    RngSpawn = 1, // lifecycle spawns, emitter index in the bits above
+};
+
+// [0, 1) from the top 24 bits
+inline float rngUnit(uint32_t bits) {
+    return (float)(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// Unit vector at a uniform angle from one word. Polynomial sin and cos on a
+// quarter turn, good to ~1e-7, so fill loops don't wait on libm
+inline void rngDirection(uint32_t bits, float& c, float& s) {
+    uint32_t quadrant = bits >> 30;
+    float x = (float)(bits & 0x3fffffffu) * (1.5707963f / 1073741824.0f); // [0, pi/2)
+    float x2 = x * x;
+    float sn = x * (1.0f + x2 * (-1.0f / 6 + x2 * (1.0f / 120 + x2 * (-1.0f / 5040 + x2 * (1.0f / 362880 - x2 / 39916800)))));
+    float cs = 1.0f + x2 * (-0.5f + x2 * (1.0f / 24 + x2 * (-1.0f / 720 + x2 * (1.0f / 40320 - x2 / 3628800))));
+    // rotate by whole quarter turns without a branch, the quadrant is a coin flip
+    bool swap = quadrant & 1;
+    float a = swap ? sn : cs, b = swap ? cs : sn;
+    c = ((quadrant + 1) & 2) ? -a : a;
+    s = (quadrant & 2) ? -b : b;
+}
+
+// Two standard normals from two words, Box-Muller
+inline void rngNormal(uint32_t a, uint32_t b, float& n0, float& n1) {
+    float r = std::sqrt(-2.0f * std::log(1.0f - rngUnit(a))); // 1 - u is never 0
+    float c, s;
+    rngDirection(b, c, s);
+    n0 = r * c;
+    n1 = r * s;
+}
@@ -0,0 +1,42 @@
+#include "shader.h"
+#include <iostream>
+
+using namespace std;
+
+// Compile shader helper
+GLuint compileShader(GLenum type, const char* src) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &src, nullptr);
+    glCompileShader(shader);
+    GLint success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        char info[512];
+        glGetShaderInfoLog(shader, 512, nullptr, info);
+        cerr << "Shader compilation error: " << info << endl;
+    }
+    return shader;
+}
+
+// Create shader program helper
+GLuint createProgram(const char* vertSrc, const char* fragSrc) {
+    GLuint vs = compileShader(GL_VERTEX_SHADER, vertSrc);
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragSrc);
+    GLuint prog = glCreateProgram();
+    glAttachShader(prog, vs);
+    glAttachShader(prog, fs);
+    glLinkProgram(prog);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    return prog;
+}
+
+// Compute program helper
+GLuint createComputeProgram(const char* src) {
+    GLuint cs = compileShader(GL_COMPUTE_SHADER, src);
+    GLuint prog = glCreateProgram();
+    glAttachShader(prog, cs);
+    glLinkProgram(prog);
+    glDeleteShader(cs);
+    return prog;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Compile one shader stage, errors go to stderr
+GLuint compileShader(GLenum type, const char* src);
+
+// Link a vertex + fragment program
+GLuint createProgram(const char* vertSrc, const char* fragSrc);
+
+// Link a compute program, needs a GL 4.3 context
+GLuint createComputeProgram(const char* src);
@@ -0,0 +1,135 @@
+#include "sim_config.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static bool parseSize(const string& value, size_t& out) {
+    char* end;
+    errno = 0;
+    unsigned long long v = strtoull(value.c_str(), &end, 10);
+    if (value.empty() || *end || errno || value[0] == '-') return false;
+    out = (size_t)v;
+    return true;
+}
+
+static bool parseNumber(const string& value, double& out) {
+    char* end;
+    out = strtod(value.c_str(), &end);
+    return !value.empty() && !*end && out == out;
+}
+
+bool setParam(SimParams& params, const string& key, const string& value) {
+    double v;
+    if (key == "particles") return parseSize(value, params.particles);
+    if (key == "trail") return parseSize(value, params.trailLength) && params.trailLength > 0; // --trails off turns them off
+    if (!parseNumber(value, v)) return false;
+    if (key == "dt" && v > 0.0) params.dt = (float)v;
+    else if (key == "G" && v >= 0.0) params.G = (float)v;
+    else if (key == "M" && v >= 0.0) params.M = (float)v;
+    else if (key == "rate" && v >= 0.0) params.stepRate = v;
+    else return false;
+    return true;
+}
+
+bool parseOverride(const char* spec, ParamOverrides& overrides) {
+    const char* eq = strchr(spec, '=');
+    if (!eq) return false;
+    string key(spec, eq), value(eq + 1);
+    SimParams scratch;
+    if (!setParam(scratch, key, value)) return false;
+    overrides.emplace_back(key, value);
+    return true;
+}
+
+static string trim(const string& s) {
+    size_t begin = s.find_first_not_of(" \t\r"), end = s.find_last_not_of(" \t\r");
+    return begin == string::npos ? string() : s.substr(begin, end - begin + 1);
+}
+
+bool loadParams(const char* path, const ParamOverrides& overrides, SimParams& params) {
+    SimParams loaded = params;
+    bool ok = true;
+    if (path) {
+        ifstream in(path);
+        if (!in) {
+            cerr << "Can't read config " << path << "\n";
+            return false;
+        }
+        string line;
+        for (int number = 1; getline(in, line); ++number) {
+            line = trim(line.substr(0, line.find('#')));
+            if (line.empty()) continue;
+            size_t eq = line.find('=');
+            string key = eq == string::npos ? line : trim(line.substr(0, eq));
+            if (eq == string::npos || !setParam(loaded, key, trim(line.substr(eq + 1)))) {
+                cerr << path << ":" << number << ": bad setting \"" << line << "\"\n";
+                ok = false;
+            }
+        }
+    }
+    for (const auto& o : overrides) setParam(loaded, o.first, o.second); // checked by parseOverride
+    if (ok) params = loaded;
+    return ok;
+}
+
+ConfigWatcher::~ConfigWatcher() {
+#ifdef __linux__
+    if (fd >= 0) close(fd);
+#endif
+}
+
+static long long modifiedTime(const string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return 0;
+    return (long long)st.st_mtime;
+}
+
+bool ConfigWatcher::open(const char* file) {
+    path = file;
+    size_t slash = path.rfind('/');
+    string dir = slash == string::npos ? "." : path.substr(0, slash + 1);
+    name = slash == string::npos ? path : path.substr(slash + 1);
+    mtime = modifiedTime(path);
+#ifdef __linux__
+    // finished writes and renames onto it, not creation, a new file is still empty then
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd >= 0 && inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(fd);
+        fd = -1;
+    }
+#endif
+    return mtime != 0;
+}
+
+bool ConfigWatcher::changed() {
+#ifdef __linux__
+    if (fd >= 0) {
+        bool hit = false;
+        alignas(inotify_event) char buf[4096];
+        ssize_t got;
+        while ((got = read(fd, buf, sizeof(buf))) > 0) {
+            for (char* p = buf; p < buf + got;) {
+                const inotify_event* e = (const inotify_event*)p;
+                if (e->len > 0 && name == e->name) hit = true;
+                p += sizeof(inotify_event) + e->len;
+            }
+        }
+        return hit;
+    }
+#endif
+    long long now = modifiedTime(path);
+    if (now == mtime) return false;
+    mtime = now;
+    return true;
+}
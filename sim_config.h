@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "physics.h"
+
+// Run parameters that used to be compiled-in constants. They start at those
+// constants, then a config file of "key = value" lines (# comments) is read
+// over them, then --set KEY=VALUE from the command line, so the command line
+// wins. Keys:
+//   particles  particle count
+//   trail      trail points per particle, at least 1
+//   dt         timestep
+//   G, M       gravitational constant and central mass
+//   rate       steps per second, 0 = flat out
+// width and height stay compiled in: they're the logical screen everything
+// from the view to the culling grid is laid out in, not a tuning knob
+struct SimParams {
+    size_t particles = numParticles;
+    size_t trailLength = maxTrailLength;
+    float dt = defaultDt;
+    float G = ::G, M = ::M;
+    double stepRate = 60.0;
+};
+
+// One key. False for an unknown key or a value that doesn't parse or is out of range
+bool setParam(SimParams& params, const std::string& key, const std::string& value);
+
+// --set overrides in the order given, re-applied after every reload of the file
+typedef std::vector<std::pair<std::string, std::string>> ParamOverrides;
+// "KEY=VALUE" onto overrides, false when there's no '=' or the key is unknown
+bool parseOverride(const char* spec, ParamOverrides& overrides);
+
+// The file at path (none when null) over params, then the overrides. Every
+// bad line is reported on stderr with its line number; on any error params is
+// left as it was and this returns false
+bool loadParams(const char* path, const ParamOverrides& overrides, SimParams& params);
+
+// Tells when a config file was written. Watches its directory with inotify, so
+// editors that save by renaming a temp file over it are caught too, and falls
+// back to polling the mtime where there's no inotify. changed() never blocks
+class ConfigWatcher {
+public:
+    ConfigWatcher() = default;
+    ConfigWatcher(const ConfigWatcher&) = delete;
+    ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+    ~ConfigWatcher();
+
+    bool open(const char* path);
+    // Whether the file was written since the last call
+    bool changed();
+
+private:
+    std::string path, name; // the file, its name within the watched directory
+    int fd = -1;
+    long long mtime = 0;    // polling fallback
+};
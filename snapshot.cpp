@@ -0,0 +1,252 @@
+#include "snapshot.h"
+#include "thread_pool.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "snapshot files are little-endian and mapped as is, big-endian hosts need byte swapping here"
+#endif
+
+static const char snapshotMagic[8] = { 'B', 'H', 'S', 'N', 'A', 'P', 0, 0 };
+
+static size_t alignUp(size_t v) {
+    return (v + snapshotAlignment - 1) / snapshotAlignment * snapshotAlignment;
+}
+
+// Source pointer for every array of ps, in SnapshotArray order
+static void arrayPointers(const ParticleSystem& ps, const void* data[snapshotArrayCount], uint64_t bytes[snapshotArrayCount]) {
+    size_t n = ps.size();
+    const vector<float>* floats[] = { &ps.posX, &ps.posY, &ps.velX, &ps.velY, &ps.accX, &ps.accY, &ps.temp, &ps.stepSize,
+                                      &ps.internalEnergy };
+    for (int a = SnapPosX; a <= SnapInternalEnergy; ++a) {
+        data[a] = floats[a]->data();
+        bytes[a] = n * sizeof(float);
+    }
+    data[SnapTrailPool] = ps.trailPool.data();
+    bytes[SnapTrailPool] = ps.trailPool.size() * sizeof(Vec2);
+    data[SnapTrailHead] = ps.trailHead.data();
+    bytes[SnapTrailHead] = n * sizeof(uint32_t);
+    data[SnapTrailCount] = ps.trailCount.data();
+    bytes[SnapTrailCount] = n * sizeof(uint32_t);
+    data[SnapId] = ps.id.data();
+    bytes[SnapId] = n * sizeof(uint32_t);
+    data[SnapGeneration] = ps.generation.data();
+    bytes[SnapGeneration] = ps.generation.size() * sizeof(uint32_t);
+}
+
+bool writeSnapshot(const char* path, const ParticleSystem& ps, const SnapshotInfo& info) {
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+    header.version = snapshotVersion;
+    header.headerBytes = sizeof(SnapshotHeader);
+    header.count = ps.size();
+    header.trailLength = ps.trailLength;
+    header.step = info.step;
+    header.time = info.time;
+    header.seed = info.seed;
+    header.dt = info.dt;
+    header.smoothing = info.smoothing;
+    header.nextId = ps.nextId;
+
+    const void* data[snapshotArrayCount];
+    arrayPointers(ps, data, header.bytes);
+    size_t offset = alignUp(sizeof(SnapshotHeader));
+    for (int a = 0; a < snapshotArrayCount; ++a) {
+        header.offset[a] = offset;
+        offset = alignUp(offset + header.bytes[a]);
+    }
+
+    string tmpPath = string(path) + ".tmp";
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if (!f) return false;
+
+    static const unsigned char zeros[snapshotAlignment] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    size_t written = sizeof(header);
+    for (int a = 0; a < snapshotArrayCount && ok; ++a) {
+        ok = fwrite(zeros, 1, header.offset[a] - written, f) == header.offset[a] - written;
+        if (ok && header.bytes[a] > 0) ok = fwrite(data[a], header.bytes[a], 1, f) == 1;
+        written = header.offset[a] + header.bytes[a];
+    }
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (ok) ok = rename(tmpPath.c_str(), path) == 0;
+    if (!ok) remove(tmpPath.c_str());
+    return ok;
+}
+
+SnapshotWriter::SnapshotWriter() : worker(&SnapshotWriter::run, this) {}
+
+SnapshotWriter::~SnapshotWriter() {
+    {
+        lock_guard<mutex> lock(jobMutex);
+        stopping = true;
+    }
+    jobCv.notify_all();
+    worker.join();
+}
+
+bool SnapshotWriter::submit(const string& path, const ParticleSystem& ps, const SnapshotInfo& info) {
+    {
+        lock_guard<mutex> lock(jobMutex);
+        if (hasJob) return false;
+        // vector assignment keeps pending's capacity, so steady-state checkpoints don't allocate
+        pending = ps;
+        pendingInfo = info;
+        pendingPath = path;
+        hasJob = true;
+    }
+    jobCv.notify_all();
+    return true;
+}
+
+bool SnapshotWriter::wait() {
+    unique_lock<mutex> lock(jobMutex);
+    jobCv.wait(lock, [&] { return !hasJob; });
+    return lastOk;
+}
+
+void SnapshotWriter::run() {
+    unique_lock<mutex> lock(jobMutex);
+    while (true) {
+        jobCv.wait(lock, [&] { return hasJob || stopping; });
+        if (!hasJob) return;
+
+        // submit() refuses new work while hasJob is set, so pending is ours without the lock
+        lock.unlock();
+        bool ok = writeSnapshot(pendingPath.c_str(), pending, pendingInfo);
+        if (!ok) cerr << "Failed to write checkpoint " << pendingPath << "\n";
+        lock.lock();
+
+        lastOk = ok;
+        hasJob = false;
+        jobCv.notify_all();
+    }
+}
+
+bool MappedSnapshot::open(const char* path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        cerr << "Can't open checkpoint " << path << "\n";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        cerr << path << " is too small to be a checkpoint\n";
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file alive
+    if (mapped == MAP_FAILED) {
+        cerr << "Can't map checkpoint " << path << "\n";
+        return false;
+    }
+    base = (const unsigned char*)mapped;
+    mappedBytes = (size_t)st.st_size;
+
+    const SnapshotHeader& h = header();
+    const char* problem = nullptr;
+    if (memcmp(h.magic, snapshotMagic, sizeof(snapshotMagic)) != 0) problem = "not a checkpoint file";
+    else if (h.version != snapshotVersion) problem = "unsupported checkpoint version";
+    else if (h.headerBytes != sizeof(SnapshotHeader)) problem = "unexpected header size";
+    // bound count and trailLength by the file before multiplying them, so the products can't wrap
+    else if (h.count > mappedBytes / 4) problem = "particle count larger than the file";
+    else if (h.trailLength > UINT32_MAX || (h.count > 0 && h.trailLength > mappedBytes / sizeof(Vec2) / h.count))
+        problem = "trail length larger than the file";
+    else if (h.count > h.nextId) problem = "more particles than ids";
+    for (int a = 0; a < snapshotArrayCount && !problem; ++a) {
+        uint64_t expected = a == SnapTrailPool ? h.count * h.trailLength * sizeof(Vec2)
+                          : a == SnapGeneration ? (uint64_t)h.nextId * 4 : h.count * 4;
+        if (h.bytes[a] != expected) problem = a == SnapTrailPool ? "trail size mismatch" : "array size mismatch";
+        else if (h.offset[a] % snapshotAlignment != 0 || h.offset[a] > mappedBytes || h.bytes[a] > mappedBytes - h.offset[a])
+            problem = "truncated";
+    }
+    // The contents get used as indices: ring positions by recordTrails and
+    // trailSpans, ids by rebuildSlots and everything that goes through slotOf
+    if (!problem) {
+        const uint32_t* heads = (const uint32_t*)(base + h.offset[SnapTrailHead]);
+        const uint32_t* counts = (const uint32_t*)(base + h.offset[SnapTrailCount]);
+        const uint32_t* ids = (const uint32_t*)(base + h.offset[SnapId]);
+        vector<bool> seen(h.nextId);
+        for (size_t i = 0; i < h.count && !problem; ++i) {
+            if (counts[i] > h.trailLength || (heads[i] >= h.trailLength && heads[i] != 0)) problem = "trail ring out of range";
+            else if (ids[i] >= h.nextId) problem = "particle id out of range";
+            else if (seen[ids[i]]) problem = "duplicate particle id";
+            else seen[ids[i]] = true;
+        }
+    }
+    if (problem) {
+        cerr << path << ": " << problem << "\n";
+        close();
+        return false;
+    }
+    // we're about to read the whole thing front to back
+    madvise(mapped, mappedBytes, MADV_SEQUENTIAL | MADV_WILLNEED);
+    return true;
+}
+
+void MappedSnapshot::close() {
+    if (base) munmap((void*)base, mappedBytes);
+    base = nullptr;
+    mappedBytes = 0;
+}
+
+SnapshotInfo MappedSnapshot::info() const {
+    SnapshotInfo info;
+    info.step = header().step;
+    info.time = header().time;
+    info.seed = header().seed;
+    info.dt = header().dt;
+    info.smoothing = header().smoothing;
+    return info;
+}
+
+void MappedSnapshot::load(ParticleSystem& ps, ThreadPool* pool) const {
+    size_t n = size();
+    ps.trailLength = (size_t)header().trailLength;
+    vector<float>* floats[] = { &ps.posX, &ps.posY, &ps.velX, &ps.velY, &ps.accX, &ps.accY, &ps.temp, &ps.stepSize,
+                                &ps.internalEnergy };
+    for (vector<float>* v : floats) v->resize(n);
+    ps.trailPool.resize(n * ps.trailLength);
+    ps.trailHead.resize(n);
+    ps.trailCount.resize(n);
+    ps.id.resize(n);
+    ps.nextId = header().nextId;
+    ps.generation.resize(ps.nextId);
+
+    void* dest[snapshotArrayCount];
+    for (int a = SnapPosX; a <= SnapInternalEnergy; ++a) dest[a] = floats[a]->data();
+    dest[SnapTrailPool] = ps.trailPool.data();
+    dest[SnapTrailHead] = ps.trailHead.data();
+    dest[SnapTrailCount] = ps.trailCount.data();
+    dest[SnapId] = ps.id.data();
+    dest[SnapGeneration] = ps.generation.data();
+
+    // Straight copies in fixed size pieces, so the big trail array spreads over every thread
+    const size_t piece = 4 << 20;
+    size_t pieces[snapshotArrayCount + 1] = { 0 };
+    for (int a = 0; a < snapshotArrayCount; ++a) pieces[a + 1] = pieces[a] + (header().bytes[a] + piece - 1) / piece;
+
+    auto copy = [&](size_t begin, size_t end) {
+        int a = 0;
+        for (size_t p = begin; p < end; ++p) {
+            while (p >= pieces[a + 1]) a++;
+            size_t from = (p - pieces[a]) * piece;
+            size_t bytes = min((size_t)header().bytes[a] - from, piece);
+            memcpy((unsigned char*)dest[a] + from, base + header().offset[a] + from, bytes);
+        }
+    };
+    if (pool) pool->parallelFor(pieces[snapshotArrayCount], 1, copy);
+    else copy(0, pieces[snapshotArrayCount]);
+    ps.rebuildSlots();
+}
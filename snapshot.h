@@ -0,0 +1,112 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "physics.h"
+
+class ThreadPool;
+
+// Binary checkpoint of a ParticleSystem.
+//
+// Layout: a fixed SnapshotHeader, then each SoA array in SnapshotArray order,
+// every one starting on a 64 byte boundary. All values are little-endian and
+// stored exactly as they sit in memory, so a mapped file can be used as is.
+// Bump snapshotVersion whenever the layout changes
+
+const uint32_t snapshotVersion = 4;
+const size_t snapshotAlignment = 64;
+
+enum SnapshotArray {
+    SnapPosX, SnapPosY, SnapVelX, SnapVelY, SnapAccX, SnapAccY, SnapTemp, SnapStepSize, // float[count]
+    SnapInternalEnergy,                                                               // float[count]
+    SnapTrailPool,                                                                    // Vec2[count * trailLength]
+    SnapTrailHead, SnapTrailCount, SnapId,                                            // uint32[count]
+    SnapGeneration,                                                                   // uint32[nextId], by id
+    snapshotArrayCount
+};
+
+// Run state that isn't in the particle arrays
+struct SnapshotInfo {
+    uint64_t step = 0;
+    double time = 0.0;        // simulated time, step * dt for fixed-step runs
+    uint64_t seed = 0;        // seed the initial conditions came from
+    float dt = defaultDt;
+    float smoothing = 0.0f;   // SPH smoothing length the run picked, 0 = none yet
+};
+
+struct SnapshotHeader {
+    char magic[8];            // "BHSNAP\0\0"
+    uint32_t version;
+    uint32_t headerBytes;     // sizeof(SnapshotHeader)
+    uint64_t count;           // particles
+    uint64_t trailLength;
+    uint64_t step;
+    double time;
+    uint64_t seed;
+    float dt;
+    uint32_t nextId;          // ParticleSystem::nextId
+    float smoothing;          // SnapshotInfo::smoothing
+    uint32_t unused;          // keeps the offsets 8 byte aligned
+    uint64_t offset[snapshotArrayCount]; // byte offset of each array from the start of the file
+    uint64_t bytes[snapshotArrayCount];
+};
+
+// Write `ps` to path synchronously. Goes through path + ".tmp" and a rename, so
+// a crash mid-write never leaves a torn checkpoint behind
+bool writeSnapshot(const char* path, const ParticleSystem& ps, const SnapshotInfo& info);
+
+// Writes checkpoints from its own thread. submit() copies the state (one
+// memcpy per array) and returns, the file I/O happens in the background
+class SnapshotWriter {
+public:
+    SnapshotWriter();
+    ~SnapshotWriter();          // finishes the pending write
+
+    // false without copying when the previous checkpoint is still being written
+    bool submit(const std::string& path, const ParticleSystem& ps, const SnapshotInfo& info);
+    // Block until nothing is pending, returns whether the last write succeeded
+    bool wait();
+
+private:
+    void run();
+
+    std::mutex jobMutex;
+    std::condition_variable jobCv;
+    ParticleSystem pending;     // reused between checkpoints
+    SnapshotInfo pendingInfo;
+    std::string pendingPath;
+    bool hasJob = false;
+    bool stopping = false;
+    bool lastOk = true;
+    std::thread worker;         // last, so everything above exists before it starts
+};
+
+// Read-only mapping of a checkpoint file. open() only validates the header,
+// the arrays are paged in as they're read
+class MappedSnapshot {
+public:
+    MappedSnapshot() = default;
+    MappedSnapshot(const MappedSnapshot&) = delete;
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+    ~MappedSnapshot() { close(); }
+
+    bool open(const char* path); // prints why to cerr on failure
+    void close();
+
+    const SnapshotHeader& header() const { return *(const SnapshotHeader*)base; }
+    SnapshotInfo info() const;
+    size_t size() const { return (size_t)header().count; }
+    const void* array(SnapshotArray a) const { return base + header().offset[a]; }
+
+    // Copy the arrays into ps, split across the pool when given
+    void load(ParticleSystem& ps, ThreadPool* pool = nullptr) const;
+
+private:
+    const unsigned char* base = nullptr;
+    size_t mappedBytes = 0;
+};
@@ -0,0 +1,129 @@
+#include "spatial_grid.h"
+#include "physics.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+using namespace std;
+
+UniformGrid::UniformGrid() : UniformGrid({ -(float)width, -(float)height, 2.0f * width, 2.0f * height }, 32.0f) {}
+
+UniformGrid::UniformGrid(const Rect& area, float cellSize) {
+    reshape(area, cellSize);
+}
+
+void UniformGrid::reshape(const Rect& newArea, float cellSize) {
+    area = newArea;
+    invCell = 1.0f / cellSize;
+    columns = max(1, (int)ceil((area.maxX - area.minX) * invCell));
+    rows = max(1, (int)ceil((area.maxY - area.minY) * invCell));
+    cellStart.assign((size_t)columns * rows + 1, 0);
+    ids.clear();
+}
+
+int UniformGrid::cellOf(float x, float y) const {
+    // clamp in float first so far-off (or NaN) positions can't overflow the int
+    float fx = min(max((x - area.minX) * invCell, 0.0f), (float)(columns - 1));
+    float fy = min(max((y - area.minY) * invCell, 0.0f), (float)(rows - 1));
+    if (!(fx == fx)) fx = 0.0f;
+    if (!(fy == fy)) fy = 0.0f;
+    return (int)fy * columns + (int)fx;
+}
+
+void UniformGrid::build(const ParticleSystem& ps, ThreadPool* pool) {
+    size_t n = ps.size();
+    size_t cells = cellStart.size() - 1;
+    cellOfParticle.resize(n);
+    ids.resize(n);
+
+    // Parallel counting sort: every chunk histograms its own particles, a prefix
+    // over (cell, chunk) gives each chunk its own write position in every cell,
+    // then the chunks scatter independently. Chunks are big enough that the
+    // per-chunk histograms stay small, and their boundaries only depend on n, so
+    // the order comes out the same (ascending ids per cell) on any thread count
+    size_t chunkSize = max(physicsChunkSize, (n + maxChunks - 1) / maxChunks);
+    size_t chunks = (n + chunkSize - 1) / chunkSize;
+    chunkCounts.assign(chunks * cells, 0);
+    chunkFastest.assign(chunks, 0.0f);
+    chunkBox.resize(chunks);
+    auto run = [&](const function<void(size_t, size_t)>& body) {
+        if (pool) pool->parallelFor(n, chunkSize, body);
+        else for (size_t b = 0; b < n; b += chunkSize) body(b, min(n, b + chunkSize));
+    };
+
+    run([&](size_t begin, size_t end) {
+        uint32_t* counts = chunkCounts.data() + begin / chunkSize * cells;
+        float top = 0.0f;
+        Rect box = { ps.posX[begin], ps.posY[begin], ps.posX[begin], ps.posY[begin] };
+        for (size_t i = begin; i < end; ++i) {
+            float x = ps.posX[i], y = ps.posY[i];
+            uint32_t c = (uint32_t)cellOf(x, y);
+            cellOfParticle[i] = c;
+            counts[c]++;
+            top = max(top, ps.velX[i] * ps.velX[i] + ps.velY[i] * ps.velY[i]);
+            box = { min(box.minX, x), min(box.minY, y), max(box.maxX, x), max(box.maxY, y) };
+        }
+        chunkFastest[begin / chunkSize] = top;
+        chunkBox[begin / chunkSize] = box;
+    });
+    float top = 0.0f;
+    for (float f : chunkFastest) top = max(top, f);
+    fastest = sqrt(top);
+    box = chunks > 0 ? chunkBox[0] : Rect{ 0.0f, 0.0f, 0.0f, 0.0f };
+    for (const Rect& b : chunkBox) {
+        box = { min(box.minX, b.minX), min(box.minY, b.minY), max(box.maxX, b.maxX), max(box.maxY, b.maxY) };
+    }
+
+    // counts become write offsets, cell-major so cell c is a contiguous run
+    uint32_t offset = 0;
+    for (size_t c = 0; c < cells; ++c) {
+        cellStart[c] = offset;
+        for (size_t k = 0; k < chunks; ++k) {
+            uint32_t count = chunkCounts[k * cells + c];
+            chunkCounts[k * cells + c] = offset;
+            offset += count;
+        }
+    }
+    cellStart[cells] = offset;
+
+    run([&](size_t begin, size_t end) {
+        uint32_t* next = chunkCounts.data() + begin / chunkSize * cells;
+        for (size_t i = begin; i < end; ++i) ids[next[cellOfParticle[i]]++] = (uint32_t)i;
+    });
+}
+
+void UniformGrid::cellRange(const Rect& rect, int& x0, int& y0, int& x1, int& y1) const {
+    int lo = cellOf(rect.minX, rect.minY), hi = cellOf(rect.maxX, rect.maxY);
+    x0 = lo % columns; y0 = lo / columns;
+    x1 = hi % columns; y1 = hi / columns;
+}
+
+size_t UniformGrid::count(const Rect& rect) const {
+    int x0, y0, x1, y1;
+    cellRange(rect, x0, y0, x1, y1);
+    size_t total = 0;
+    for (int y = y0; y <= y1; ++y) {
+        total += cellStart[(size_t)y * columns + x1 + 1] - cellStart[(size_t)y * columns + x0];
+    }
+    return total;
+}
+
+void UniformGrid::query(const Rect& rect, vector<uint32_t>& out) const {
+    out.resize(count(rect));
+    query(rect, out.data());
+}
+
+size_t UniformGrid::query(const Rect& rect, uint32_t* out) const {
+    int x0, y0, x1, y1;
+    cellRange(rect, x0, y0, x1, y1);
+    size_t total = 0;
+    for (int y = y0; y <= y1; ++y) {
+        // a row of cells is one contiguous run of ids
+        const uint32_t* first = ids.data() + cellStart[(size_t)y * columns + x0];
+        const uint32_t* last = ids.data() + cellStart[(size_t)y * columns + x1 + 1];
+        copy(first, last, out + total);
+        total += last - first;
+    }
+    return total;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "physics.h"
+
+class ThreadPool;
+
+// Axis-aligned world rectangle
+struct Rect {
+    float minX, minY, maxX, maxY;
+
+    // & rather than && so it compiles without branches, culling tests are coin flips
+    bool contains(float x, float y) const { return (x >= minX) & (x <= maxX) & (y >= minY) & (y <= maxY); }
+    Rect padded(float by) const { return { minX - by, minY - by, maxX + by, maxY + by }; }
+};
+
+// Camera: world point at the middle of the screen and screen pixels per world
+// unit, against the 800x600 logical screen. The default is the original fixed view
+struct View {
+    float x = centerX, y = centerY;
+    float zoom = 1.0f;
+
+    Rect visible() const {
+        float halfW = 0.5f * width / zoom, halfH = 0.5f * height / zoom;
+        return { x - halfW, y - halfH, x + halfW, y + halfH };
+    }
+};
+
+// Uniform grid over a fixed world area, rebuilt from scratch every step with a
+// counting sort: particle ids end up grouped by cell in `ids`, cell c owning
+// [cellStart[c], cellStart[c + 1]). Particles outside the area are clamped
+// into the border cells, so queries still find them, they just aren't cheap
+class UniformGrid {
+public:
+    // Default area is the 800x600 view with a screen's worth of margin on every side
+    UniformGrid();
+    UniformGrid(const Rect& area, float cellSize);
+
+    // Start over on another area and cell size, storage is kept. Takes effect at the next build
+    void reshape(const Rect& area, float cellSize);
+
+    void build(const ParticleSystem& ps, ThreadPool* pool = nullptr);
+
+    // Ids of every particle in a cell touching `rect`, cell by cell. A superset,
+    // callers still test positions. count() is the size of that without gathering it
+    size_t count(const Rect& rect) const;
+    void query(const Rect& rect, std::vector<uint32_t>& out) const;
+    // Same into out, which holds at least count(rect). Returns how many went in
+    size_t query(const Rect& rect, uint32_t* out) const;
+
+    // Fastest particle at the last build, bounds how far a trail can reach
+    float maxSpeed() const { return fastest; }
+    // Box around every particle at the last build
+    const Rect& bounds() const { return box; }
+    size_t size() const { return ids.size(); }
+
+    // Layout for callers that walk cells themselves: cell (x, y) is y * columnCount() + x
+    // and owns particleIds()[cellStarts()[c], cellStarts()[c + 1]). Border cells
+    // also hold everything clamped into them, which never puts particles that are
+    // near each other more than one cell apart
+    int columnCount() const { return columns; }
+    int rowCount() const { return rows; }
+    const uint32_t* cellStarts() const { return cellStart.data(); }
+    const uint32_t* particleIds() const { return ids.data(); }
+
+private:
+    void cellRange(const Rect& rect, int& x0, int& y0, int& x1, int& y1) const;
+    int cellOf(float x, float y) const;
+
+    Rect area;
+    float invCell;
+    int columns, rows;
+    std::vector<uint32_t> cellStart;  // columns * rows + 1 prefix sums
+    std::vector<uint32_t> ids;
+    static const size_t maxChunks = 16;  // build() splits into at most this many histograms
+    std::vector<uint32_t> cellOfParticle; // scratch between the passes
+    std::vector<uint32_t> chunkCounts;    // per chunk per cell count, then write offset
+    std::vector<float> chunkFastest;      // per chunk squared top speed
+    std::vector<Rect> chunkBox;           // per chunk bounds
+    float fastest = 0.0f;
+    Rect box = { 0.0f, 0.0f, 0.0f, 0.0f };
+};
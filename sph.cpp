@@ -0,0 +1,462 @@
+#include "sph.h"
+#include "physics.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+bool parseSph(const char* spec, SphParams& params) {
+    float h, alpha = params.alpha, energy = params.minEnergy, cooling = params.coolingTime;
+    int fields = sscanf(spec, "%f:%f:%f:%f", &h, &alpha, &energy, &cooling);
+    if (fields < 1 || h < 0.0f || alpha < 0.0f || energy <= 0.0f || cooling < 0.0f) return false;
+    params.smoothing = h;
+    params.alpha = alpha;
+    params.minEnergy = energy;
+    params.coolingTime = cooling;
+    return true;
+}
+
+namespace {
+
+// 2D cubic spline, written as 0.25 (2 - q)^3 - (1 - q)^3 with both brackets
+// clamped at 0 so it has no branches. Both are missing the 10 / (7 pi h^2) factor
+inline float splineW(float q) {
+    float a = max(2.0f - q, 0.0f), b = max(1.0f - q, 0.0f);
+    return 0.25f * a * a * a - b * b * b;
+}
+
+// dW/dq
+inline float splineDW(float q) {
+    float a = max(2.0f - q, 0.0f), b = max(1.0f - q, 0.0f);
+    return 3.0f * b * b - 0.75f * a * a;
+}
+
+// The solver's cell order arrays, the pair kernels read neighbours out of these
+struct CellArrays {
+    const float *x, *y, *vx, *vy, *rho, *pressure, *sound;
+};
+
+struct PairConstants {
+    float h, invH, support2, eps2, alpha, beta;
+};
+
+struct PairSums {
+    float ax = 0.0f, ay = 0.0f, du = 0.0f, signal = 0.0f;
+    uint32_t found = 0; // neighbours inside 2h, itself included
+};
+
+// Sums for particle k over the count runs [runs[i][0], runs[i][1]) of its
+// neighbouring cells. Density is the bare kernel sum, the force sums still
+// need m sigma / h. Out-of-range pairs and the particle itself come out as 0
+// through the kernel and dx = dy = 0, without branches
+typedef float (*DensityKernel)(const CellArrays& c, uint32_t k, const uint32_t (*runs)[2], int count,
+                               const PairConstants& pc);
+typedef void (*ForceKernel)(const CellArrays& c, uint32_t k, const uint32_t (*runs)[2], int count,
+                            const PairConstants& pc, PairSums& out);
+
+float densityScalar(const CellArrays& c, uint32_t k, const uint32_t (*runs)[2], int count, const PairConstants& pc) {
+    float xi = c.x[k], yi = c.y[k], sum = 0.0f;
+    for (int run = 0; run < count; ++run) {
+        for (uint32_t j = runs[run][0]; j < runs[run][1]; ++j) {
+            float dx = xi - c.x[j], dy = yi - c.y[j];
+            sum += splineW(sqrt(dx * dx + dy * dy) * pc.invH); // 0 past 2h
+        }
+    }
+    return sum;
+}
+
+// Pressure, Monaghan viscosity and the heating both do:
+//   a_i    = -sum m (P_i / rho_i^2 + P_j / rho_j^2 + Pi_ij) grad W_ij
+//   du_i/dt = sum m (P_i / rho_i^2 + Pi_ij / 2) v_ij . grad W_ij
+// Pi_ij only acts on approaching pairs. The signal speed is Monaghan's
+// c_i + c_j - 3 v_ij . r_ij / r, for the Courant limit
+void forceScalar(const CellArrays& c, uint32_t k, const uint32_t (*runs)[2], int count, const PairConstants& pc,
+                 PairSums& out) {
+    float xi = c.x[k], yi = c.y[k], vxi = c.vx[k], vyi = c.vy[k];
+    float rhoi = c.rho[k], pi = c.pressure[k], ci = c.sound[k];
+    for (int run = 0; run < count; ++run) {
+        for (uint32_t j = runs[run][0]; j < runs[run][1]; ++j) {
+            float dx = xi - c.x[j], dy = yi - c.y[j];
+            float r2 = dx * dx + dy * dy;
+            float invR = 1.0f / sqrt(max(r2, 1e-12f));
+            float grad = splineDW(r2 * invR * pc.invH) * invR; // times (dx, dy) is grad W without sigma / h
+            float vr = (vxi - c.vx[j]) * dx + (vyi - c.vy[j]) * dy;
+            float mu = min(pc.h * vr / (r2 + pc.eps2), 0.0f);  // only approaching pairs
+            float viscosity = (pc.beta * mu - pc.alpha * 0.5f * (ci + c.sound[j])) * mu * 2.0f / (rhoi + c.rho[j]);
+            float both = pi + c.pressure[j] + viscosity;
+            out.ax += both * grad * dx;
+            out.ay += both * grad * dy;
+            out.du += (pi + 0.5f * viscosity) * grad * vr;
+            bool near = r2 < pc.support2;
+            out.found += near;
+            out.signal = max(out.signal, near ? ci + c.sound[j] - 3.0f * min(vr * invR, 0.0f) : 0.0f);
+        }
+    }
+}
+
+// Same sums a register of neighbours at a time, the last partial register of
+// each run masked. 1 / r comes from rsqrt and the divides from rcp, each with
+// a Newton-Raphson step, like the step kernels
+#if defined(__x86_64__) || defined(__i386__)
+// GCC 12 warns about the undefined passthrough registers inside its own intrinsic headers
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+__attribute__((target("avx512f")))
+inline __m512 invSqrtAVX512(__m512 x) {
+    __m512 y = _mm512_rsqrt14_ps(x);
+    __m512 hx = _mm512_mul_ps(x, _mm512_set1_ps(0.5f));
+    return _mm512_mul_ps(y, _mm512_fnmadd_ps(hx, _mm512_mul_ps(y, y), _mm512_set1_ps(1.5f)));
+}
+
+__attribute__((target("avx512f")))
+inline __m512 recipAVX512(__m512 x) {
+    __m512 y = _mm512_rcp14_ps(x);
+    return _mm512_mul_ps(y, _mm512_fnmadd_ps(x, y, _mm512_set1_ps(2.0f)));
+}
+
+// max(2 - q, 0) and max(1 - q, 0)
+__attribute__((target("avx512f")))
+inline void splineBracketsAVX512(__m512 q, __m512& a, __m512& b) {
+    const __m512 zero = _mm512_setzero_ps();
+    a = _mm512_max_ps(_mm512_sub_ps(_mm512_set1_ps(2.0f), q), zero);
+    b = _mm512_max_ps(_mm512_sub_ps(_mm512_set1_ps(1.0f), q), zero);
+}
+
+__attribute__((target("avx512f")))
+inline __mmask16 tailMaskAVX512(uint32_t left) {
+    return left >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << left) - 1);
+}
+
+__attribute__((target("avx512f")))
+float densityAVX512(const CellArrays& c, uint32_t k, const uint32_t (*runs)[2], int count, const PairConstants& pc) {
+    const __m512 xi = _mm512_set1_ps(c.x[k]), yi = _mm512_set1_ps(c.y[k]);
+    const __m512 invH = _mm512_set1_ps(pc.invH), tiny = _mm512_set1_ps(1e-12f), quarter = _mm512_set1_ps(0.25f);
+    __m512 sum = _mm512_setzero_ps();
+    for (int run = 0; run < count; ++run) {
+        for (uint32_t j = runs[run][0]; j < runs[run][1]; j += 16) {
+            __mmask16 m = tailMaskAVX512(runs[run][1] - j);
+            __m512 dx = _mm512_sub_ps(xi, _mm512_maskz_loadu_ps(m, c.x + j));
+            __m512 dy = _mm512_sub_ps(yi, _mm512_maskz_loadu_ps(m, c.y + j));
+            __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+            __m512 q = _mm512_mul_ps(_mm512_mul_ps(r2, invSqrtAVX512(_mm512_max_ps(r2, tiny))), invH);
+            __m512 a, b;
+            splineBracketsAVX512(q, a, b);
+            __m512 w = _mm512_fmsub_ps(_mm512_mul_ps(quarter, a), _mm512_mul_ps(a, a), _mm512_mul_ps(b, _mm512_mul_ps(b, b)));
+            sum = _mm512_mask_add_ps(sum, m, sum, w);
+        }
+    }
+    return _mm512_reduce_add_ps(sum);
+}
+
+__attribute__((target("avx512f")))
+void forceAVX512(const CellArrays& c, uint32_t k, const uint32_t (*runs)[2], int count, const PairConstants& pc,
+                 PairSums& out) {
+    const __m512 xi = _mm512_set1_ps(c.x[k]), yi = _mm512_set1_ps(c.y[k]);
+    const __m512 vxi = _mm512_set1_ps(c.vx[k]), vyi = _mm512_set1_ps(c.vy[k]);
+    const __m512 rhoi = _mm512_set1_ps(c.rho[k]), pi = _mm512_set1_ps(c.pressure[k]), ci = _mm512_set1_ps(c.sound[k]);
+    const __m512 invH = _mm512_set1_ps(pc.invH), h = _mm512_set1_ps(pc.h), eps2 = _mm512_set1_ps(pc.eps2);
+    const __m512 support2 = _mm512_set1_ps(pc.support2), tiny = _mm512_set1_ps(1e-12f);
+    const __m512 beta = _mm512_set1_ps(pc.beta), halfAlpha = _mm512_set1_ps(0.5f * pc.alpha);
+    const __m512 half = _mm512_set1_ps(0.5f), three = _mm512_set1_ps(3.0f), threeQuarters = _mm512_set1_ps(0.75f);
+    const __m512 zero = _mm512_setzero_ps();
+    __m512 sumX = zero, sumY = zero, heat = zero, signal = zero;
+    uint32_t found = 0;
+    for (int run = 0; run < count; ++run) {
+        for (uint32_t j = runs[run][0]; j < runs[run][1]; j += 16) {
+            __mmask16 m = tailMaskAVX512(runs[run][1] - j);
+            __m512 dx = _mm512_sub_ps(xi, _mm512_maskz_loadu_ps(m, c.x + j));
+            __m512 dy = _mm512_sub_ps(yi, _mm512_maskz_loadu_ps(m, c.y + j));
+            __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+            __m512 invR = invSqrtAVX512(_mm512_max_ps(r2, tiny));
+            __m512 a, b;
+            splineBracketsAVX512(_mm512_mul_ps(_mm512_mul_ps(r2, invR), invH), a, b);
+            __m512 grad = _mm512_mul_ps(_mm512_fmsub_ps(_mm512_mul_ps(three, b), b, _mm512_mul_ps(threeQuarters, _mm512_mul_ps(a, a))), invR);
+            __m512 dvx = _mm512_sub_ps(vxi, _mm512_maskz_loadu_ps(m, c.vx + j));
+            __m512 dvy = _mm512_sub_ps(vyi, _mm512_maskz_loadu_ps(m, c.vy + j));
+            __m512 vr = _mm512_fmadd_ps(dvx, dx, _mm512_mul_ps(dvy, dy));
+            __m512 mu = _mm512_min_ps(_mm512_mul_ps(_mm512_mul_ps(h, vr), recipAVX512(_mm512_add_ps(r2, eps2))), zero);
+            __m512 cj = _mm512_maskz_loadu_ps(m, c.sound + j);
+            __m512 rhoj = _mm512_maskz_loadu_ps(m, c.rho + j);
+            __m512 cSum = _mm512_add_ps(ci, cj);
+            __m512 viscosity = _mm512_mul_ps(_mm512_mul_ps(_mm512_fmsub_ps(beta, mu, _mm512_mul_ps(halfAlpha, cSum)), mu),
+                                             _mm512_mul_ps(_mm512_set1_ps(2.0f), recipAVX512(_mm512_add_ps(rhoi, rhoj))));
+            __m512 both = _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(pi, _mm512_maskz_loadu_ps(m, c.pressure + j)), viscosity), grad);
+            sumX = _mm512_mask3_fmadd_ps(both, dx, sumX, m);
+            sumY = _mm512_mask3_fmadd_ps(both, dy, sumY, m);
+            heat = _mm512_mask3_fmadd_ps(_mm512_mul_ps(_mm512_fmadd_ps(half, viscosity, pi), grad), vr, heat, m);
+            __mmask16 near = _mm512_mask_cmp_ps_mask(m, r2, support2, _CMP_LT_OQ);
+            found += (uint32_t)__builtin_popcount(near);
+            __m512 sig = _mm512_fnmadd_ps(three, _mm512_min_ps(_mm512_mul_ps(vr, invR), zero), cSum);
+            signal = _mm512_mask_max_ps(signal, near, signal, sig);
+        }
+    }
+    out.ax += _mm512_reduce_add_ps(sumX);
+    out.ay += _mm512_reduce_add_ps(sumY);
+    out.du += _mm512_reduce_add_ps(heat);
+    out.signal = max(out.signal, _mm512_reduce_max_ps(signal));
+    out.found += found;
+}
+
+__attribute__((target("avx2,fma")))
+inline __m256 invSqrtAVX2(__m256 x) {
+    __m256 y = _mm256_rsqrt_ps(x);
+    __m256 hx = _mm256_mul_ps(x, _mm256_set1_ps(0.5f));
+    return _mm256_mul_ps(y, _mm256_fnmadd_ps(hx, _mm256_mul_ps(y, y), _mm256_set1_ps(1.5f)));
+}
+
+__attribute__((target("avx2,fma")))
+inline __m256 recipAVX2(__m256 x) {
+    __m256 y = _mm256_rcp_ps(x);
+    return _mm256_mul_ps(y, _mm256_fnmadd_ps(x, y, _mm256_set1_ps(2.0f)));
+}
+
+__attribute__((target("avx2,fma")))
+inline void splineBracketsAVX2(__m256 q, __m256& a, __m256& b) {
+    const __m256 zero = _mm256_setzero_ps();
+    a = _mm256_max_ps(_mm256_sub_ps(_mm256_set1_ps(2.0f), q), zero);
+    b = _mm256_max_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), q), zero);
+}
+
+// All lanes set up to `left`, for maskload and for and-ing contributions
+__attribute__((target("avx2,fma")))
+inline __m256i tailMaskAVX2(uint32_t left) {
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32((int)min(left, 8u)), lanes);
+}
+
+__attribute__((target("avx2,fma")))
+inline float sumAVX2(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+float densityAVX2(const CellArrays& c, uint32_t k, const uint32_t (*runs)[2], int count, const PairConstants& pc) {
+    const __m256 xi = _mm256_set1_ps(c.x[k]), yi = _mm256_set1_ps(c.y[k]);
+    const __m256 invH = _mm256_set1_ps(pc.invH), tiny = _mm256_set1_ps(1e-12f), quarter = _mm256_set1_ps(0.25f);
+    __m256 sum = _mm256_setzero_ps();
+    for (int run = 0; run < count; ++run) {
+        for (uint32_t j = runs[run][0]; j < runs[run][1]; j += 8) {
+            __m256i m = tailMaskAVX2(runs[run][1] - j);
+            __m256 dx = _mm256_sub_ps(xi, _mm256_maskload_ps(c.x + j, m));
+            __m256 dy = _mm256_sub_ps(yi, _mm256_maskload_ps(c.y + j, m));
+            __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+            __m256 q = _mm256_mul_ps(_mm256_mul_ps(r2, invSqrtAVX2(_mm256_max_ps(r2, tiny))), invH);
+            __m256 a, b;
+            splineBracketsAVX2(q, a, b);
+            __m256 w = _mm256_fmsub_ps(_mm256_mul_ps(quarter, a), _mm256_mul_ps(a, a), _mm256_mul_ps(b, _mm256_mul_ps(b, b)));
+            sum = _mm256_add_ps(sum, _mm256_and_ps(w, _mm256_castsi256_ps(m)));
+        }
+    }
+    return sumAVX2(sum);
+}
+
+__attribute__((target("avx2,fma")))
+void forceAVX2(const CellArrays& c, uint32_t k, const uint32_t (*runs)[2], int count, const PairConstants& pc,
+               PairSums& out) {
+    const __m256 xi = _mm256_set1_ps(c.x[k]), yi = _mm256_set1_ps(c.y[k]);
+    const __m256 vxi = _mm256_set1_ps(c.vx[k]), vyi = _mm256_set1_ps(c.vy[k]);
+    const __m256 rhoi = _mm256_set1_ps(c.rho[k]), pi = _mm256_set1_ps(c.pressure[k]), ci = _mm256_set1_ps(c.sound[k]);
+    const __m256 invH = _mm256_set1_ps(pc.invH), h = _mm256_set1_ps(pc.h), eps2 = _mm256_set1_ps(pc.eps2);
+    const __m256 support2 = _mm256_set1_ps(pc.support2), tiny = _mm256_set1_ps(1e-12f);
+    const __m256 beta = _mm256_set1_ps(pc.beta), halfAlpha = _mm256_set1_ps(0.5f * pc.alpha);
+    const __m256 half = _mm256_set1_ps(0.5f), three = _mm256_set1_ps(3.0f), threeQuarters = _mm256_set1_ps(0.75f);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 sumX = zero, sumY = zero, heat = zero, signal = zero;
+    uint32_t found = 0;
+    for (int run = 0; run < count; ++run) {
+        for (uint32_t j = runs[run][0]; j < runs[run][1]; j += 8) {
+            __m256i mi = tailMaskAVX2(runs[run][1] - j);
+            __m256 m = _mm256_castsi256_ps(mi);
+            __m256 dx = _mm256_sub_ps(xi, _mm256_maskload_ps(c.x + j, mi));
+            __m256 dy = _mm256_sub_ps(yi, _mm256_maskload_ps(c.y + j, mi));
+            __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+            __m256 invR = invSqrtAVX2(_mm256_max_ps(r2, tiny));
+            __m256 a, b;
+            splineBracketsAVX2(_mm256_mul_ps(_mm256_mul_ps(r2, invR), invH), a, b);
+            __m256 grad = _mm256_mul_ps(_mm256_fmsub_ps(_mm256_mul_ps(three, b), b, _mm256_mul_ps(threeQuarters, _mm256_mul_ps(a, a))), invR);
+            grad = _mm256_and_ps(grad, m); // masked lanes add nothing below
+            __m256 dvx = _mm256_sub_ps(vxi, _mm256_maskload_ps(c.vx + j, mi));
+            __m256 dvy = _mm256_sub_ps(vyi, _mm256_maskload_ps(c.vy + j, mi));
+            __m256 vr = _mm256_fmadd_ps(dvx, dx, _mm256_mul_ps(dvy, dy));
+            __m256 mu = _mm256_min_ps(_mm256_mul_ps(_mm256_mul_ps(h, vr), recipAVX2(_mm256_add_ps(r2, eps2))), zero);
+            __m256 cj = _mm256_maskload_ps(c.sound + j, mi);
+            __m256 rhoj = _mm256_maskload_ps(c.rho + j, mi);
+            __m256 cSum = _mm256_add_ps(ci, cj);
+            __m256 viscosity = _mm256_mul_ps(_mm256_mul_ps(_mm256_fmsub_ps(beta, mu, _mm256_mul_ps(halfAlpha, cSum)), mu),
+                                             _mm256_mul_ps(_mm256_set1_ps(2.0f), recipAVX2(_mm256_add_ps(rhoi, rhoj))));
+            __m256 both = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(pi, _mm256_maskload_ps(c.pressure + j, mi)), viscosity), grad);
+            sumX = _mm256_fmadd_ps(both, dx, sumX);
+            sumY = _mm256_fmadd_ps(both, dy, sumY);
+            heat = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_fmadd_ps(half, viscosity, pi), grad), vr, heat);
+            __m256 near = _mm256_and_ps(_mm256_cmp_ps(r2, support2, _CMP_LT_OQ), m);
+            found += (uint32_t)__builtin_popcount(_mm256_movemask_ps(near));
+            __m256 sig = _mm256_fnmadd_ps(three, _mm256_min_ps(_mm256_mul_ps(vr, invR), zero), cSum);
+            signal = _mm256_max_ps(signal, _mm256_and_ps(sig, near));
+        }
+    }
+    out.ax += sumAVX2(sumX);
+    out.ay += sumAVX2(sumY);
+    out.du += sumAVX2(heat);
+    __m128 top = _mm_max_ps(_mm256_castps256_ps128(signal), _mm256_extractf128_ps(signal, 1));
+    top = _mm_max_ps(top, _mm_movehl_ps(top, top));
+    top = _mm_max_ss(top, _mm_shuffle_ps(top, top, 1));
+    out.signal = max(out.signal, _mm_cvtss_f32(top));
+    out.found += found;
+}
+
+#pragma GCC diagnostic pop
+#endif
+
+struct PairKernels {
+    DensityKernel density;
+    ForceKernel force;
+};
+
+// No NEON version yet, the scalar loops stand in
+PairKernels selectPairKernels() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return { densityAVX512, forceAVX512 };
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return { densityAVX2, forceAVX2 };
+#endif
+    return { densityScalar, forceScalar };
+}
+
+} // namespace
+
+void SphSolver::pickSmoothing(const Rect& box, size_t n) {
+    // pi (2h)^2 n / area ~ 30 neighbours, a bit more since the box is bigger than the disk
+    float area = max((box.maxX - box.minX) * (box.maxY - box.minY), 1.0f);
+    h = 1.3f * sqrt(area / (float)n);
+}
+
+void SphSolver::kick(ParticleSystem& ps, ThreadPool& pool, float dt, const SphParams& params) {
+    size_t n = ps.size();
+    if (n == 0) return;
+    Rect box = { ps.posX[0], ps.posY[0], ps.posX[0], ps.posY[0] };
+    for (size_t i = 1; i < n; ++i) {
+        box = { min(box.minX, ps.posX[i]), min(box.minY, ps.posY[i]), max(box.maxX, ps.posX[i]), max(box.maxY, ps.posY[i]) };
+    }
+    if (h == 0.0f) {
+        if (params.smoothing > 0.0f) h = params.smoothing;
+        else pickSmoothing(box, n);
+    }
+
+    // The grid is laid out from where the particles are now, so a resumed run
+    // gets the same cells. Cells are at least the kernel's reach, and no more
+    // of them than particles so the histograms stay small
+    Rect area = box.padded(4.0f * h);
+    float span = (area.maxX - area.minX) * (area.maxY - area.minY);
+    grid.reshape(area, max(2.0f * h, sqrt(span / (float)max(n, (size_t)1024))));
+    grid.build(ps, &pool);
+
+    int columns = grid.columnCount(), rows = grid.rowCount();
+    const uint32_t* starts = grid.cellStarts();
+    const uint32_t* ids = grid.particleIds();
+    x.resize(n); y.resize(n); vx.resize(n); vy.resize(n); u.resize(n);
+    rho.resize(n); pressure.resize(n); sound.resize(n);
+    ax.resize(n); ay.resize(n); du.resize(n);
+    rowNeighbours.assign(rows, 0);
+    rowSignal.assign(rows, 0.0f);
+
+    pool.parallelFor(n, physicsChunkSize, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            uint32_t i = ids[k];
+            x[k] = ps.posX[i]; y[k] = ps.posY[i];
+            vx[k] = ps.velX[i]; vy[k] = ps.velY[i];
+            u[k] = max(ps.internalEnergy[i], params.minEnergy);
+        }
+    });
+
+    const float m = params.particleMass, gamma = params.gamma;
+    const float invH = 1.0f / h, support2 = 4.0f * h * h;
+    const float sigma = 10.0f / (7.0f * 3.14159265f * h * h);
+    const float eps2 = 0.01f * h * h;
+
+    // Calls body(row, k, runs, count) for every particle k of every cell in rows
+    // [r0, r1), runs being the count contiguous ranges [runs[i][0], runs[i][1])
+    // of cell order that hold its three by three cells
+    auto forEachParticle = [&](size_t r0, size_t r1, auto&& body) {
+        uint32_t runs[3][2];
+        for (size_t r = r0; r < r1; ++r) {
+            int cy = (int)r;
+            int y0 = max(cy - 1, 0), y1 = min(cy + 1, rows - 1);
+            for (int cx = 0; cx < columns; ++cx) {
+                size_t c = (size_t)cy * columns + cx;
+                if (starts[c] == starts[c + 1]) continue;
+                int x0 = max(cx - 1, 0), x1 = min(cx + 1, columns - 1);
+                int count = 0;
+                for (int ny = y0; ny <= y1; ++ny, ++count) {
+                    runs[count][0] = starts[(size_t)ny * columns + x0];
+                    runs[count][1] = starts[(size_t)ny * columns + x1 + 1];
+                }
+                for (uint32_t k = starts[c]; k < starts[c + 1]; ++k) body(r, k, runs, count);
+            }
+        }
+    };
+
+    static const PairKernels kernels = selectPairKernels();
+    const CellArrays cells = { x.data(), y.data(), vx.data(), vy.data(), rho.data(), pressure.data(), sound.data() };
+    const PairConstants pc = { h, invH, support2, eps2, params.alpha, params.beta };
+
+    // Density, the particle itself included, then the equation of state
+    pool.parallelFor(rows, 1, [&](size_t r0, size_t r1) {
+        forEachParticle(r0, r1, [&](size_t, uint32_t k, const uint32_t (*runs)[2], int count) {
+            float density = m * sigma * kernels.density(cells, k, runs, count, pc);
+            rho[k] = density;
+            pressure[k] = (gamma - 1.0f) * u[k] / density; // P / rho^2 with P = (gamma - 1) rho u
+            sound[k] = sqrt(gamma * (gamma - 1.0f) * u[k]);
+        });
+    });
+
+    pool.parallelFor(rows, 1, [&](size_t r0, size_t r1) {
+        forEachParticle(r0, r1, [&](size_t r, uint32_t k, const uint32_t (*runs)[2], int count) {
+            PairSums sums;
+            kernels.force(cells, k, runs, count, pc, sums);
+            float scale = m * sigma * invH;
+            ax[k] = -scale * sums.ax;
+            ay[k] = -scale * sums.ay;
+            du[k] = scale * sums.du;
+            rowNeighbours[r] += sums.found - 1; // not itself
+            rowSignal[r] = max(rowSignal[r], sums.signal);
+        });
+    });
+
+    // Kick in slot order again, then floor and cool
+    float cooling = params.coolingTime > 0.0f ? exp(-dt / params.coolingTime) : 1.0f;
+    pool.parallelFor(n, physicsChunkSize, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            uint32_t i = ids[k];
+            ps.velX[i] += ax[k] * dt;
+            ps.velY[i] += ay[k] * dt;
+            float energy = max(u[k] + du[k] * dt, params.minEnergy);
+            ps.internalEnergy[i] = params.minEnergy + (energy - params.minEnergy) * cooling;
+        }
+    });
+
+    uint64_t total = 0;
+    float fastest = 0.0f;
+    for (size_t r = 0; r < (size_t)rows; ++r) {
+        total += rowNeighbours[r];
+        fastest = max(fastest, rowSignal[r]);
+    }
+    neighbours = (double)total / n;
+    courant = fastest > 0.0f ? 0.3f * h / fastest : INFINITY;
+}
+
+void SphSolver::setTemperatures(ParticleSystem& ps, ThreadPool& pool, const SphParams& params) const {
+    float scale = 1.0f / params.energyPerTemp;
+    pool.parallelFor(ps.size(), physicsChunkSize, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) ps.temp[i] = min(ps.internalEnergy[i] * scale, 3.0f);
+    });
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "spatial_grid.h"
+
+class ThreadPool;
+struct ParticleSystem;
+
+// Gas settings for SPH mode. Every particle is a parcel of ideal gas of the
+// same mass, its internal energy per unit mass lives in ParticleSystem::internalEnergy
+struct SphParams {
+    float smoothing = 0.0f;      // h in px, the kernel reaches 2h. 0 picks one at the first step for ~30 neighbours
+    float particleMass = 1.0f;   // only scales the density, forces don't depend on it
+    float gamma = 5.0f / 3.0f;   // adiabatic index
+    float alpha = 1.0f;          // Monaghan artificial viscosity, linear term
+    float beta = 2.0f;           // and the quadratic one that stops shocks interpenetrating
+    float minEnergy = 8.0f;      // internal energy new particles start at and nothing drops below (sound speed ~3 px/s)
+    float coolingTime = 1.0f;    // energy above minEnergy decays on this timescale, 0 = no cooling
+    float energyPerTemp = 40.0f; // internal energy that shows as temp 1, the colour scale tops out at 3
+};
+
+// "H[:ALPHA[:ENERGY[:COOLING]]]" for --sph, H 0 = automatic
+bool parseSph(const char* spec, SphParams& params);
+
+// 2D smoothed particle hydrodynamics with a fixed smoothing length, added to
+// the gravity step by operator splitting: the pressure and viscosity of the
+// state at the start of the step kick velocities and internal energies, then
+// the integrator moves particles under the force model as usual.
+//
+// Neighbours come from a UniformGrid with cells of at least 2h, so with
+// bounded density each particle looks at a fixed number of candidates and a
+// pass costs O(n). After the build, positions, velocities and energies are
+// gathered into cell order; a cell's particles then sum over three contiguous
+// runs of that copy (the rows of cells above, level and below), which keeps
+// the working set of a cell in L1 and lets the pair sums go a SIMD register of
+// neighbours at a time (AVX-512 or AVX2, picked at runtime, else scalar).
+// Passes run on the pool one row of cells a task. Every particle sums its own neighbours instead of sharing pair terms,
+// twice the arithmetic but no writes to anyone else, so results don't depend
+// on the thread count
+class SphSolver {
+public:
+    // Density, then pressure, viscosity and heating from the state as it is,
+    // then one kick of dt. Positions don't move. Energies are floored and cooled
+    void kick(ParticleSystem& ps, ThreadPool& pool, float dt, const SphParams& params);
+    // temp from the internal energy, after the integrator wrote its own guess
+    void setTemperatures(ParticleSystem& ps, ThreadPool& pool, const SphParams& params) const;
+
+    float smoothing() const { return h; }
+    // Average over particles of how many others were inside 2h at the last kick
+    double meanNeighbours() const { return neighbours; }
+    // Courant limit of the last kick, 0.3 h over the fastest signal speed. A dt past it isn't stable
+    float courantDt() const { return courant; }
+
+private:
+    void pickSmoothing(const Rect& box, size_t n);
+
+    UniformGrid grid;
+    float h = 0.0f;
+    double neighbours = 0.0;
+    float courant = 0.0f;
+    // cell order, see above
+    std::vector<float> x, y, vx, vy, u;
+    std::vector<float> rho, pressure, sound; // pressure is P / rho^2, the form the sums need
+    std::vector<float> ax, ay, du;
+    std::vector<uint64_t> rowNeighbours;
+    std::vector<float> rowSignal;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+
+// Lock-free single-producer/single-consumer hand-off of whole simulation states.
+//
+// This is a triple buffer (writer slot, published slot, reader slot) with one
+// extra slot so the reader keeps the two newest states it picked up and can
+// interpolate between them. Neither side ever waits: publish() and acquire()
+// are a single atomic exchange of the published slot index
+template <typename T>
+class StateExchange {
+public:
+    // Writer side: slot to fill, then publish() it
+    T& back() { return slots[writeIndex]; }
+
+    void publish() {
+        int old = middle.exchange(writeIndex | freshBit, std::memory_order_acq_rel);
+        writeIndex = old & indexMask;
+    }
+
+    // Reader side: returns true and rotates current() into previous() when a
+    // state was published since the last call
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & freshBit)) return false;
+        int got = middle.exchange(previousIndex, std::memory_order_acq_rel);
+        previousIndex = currentIndex;
+        currentIndex = got & indexMask;
+        return true;
+    }
+
+    const T& current() const { return slots[currentIndex]; }
+    const T& previous() const { return slots[previousIndex]; }
+
+    // Only safe before the writer thread starts, e.g. to seed every slot
+    T& slot(int i) { return slots[i]; }
+    static constexpr int slotCount = 4;
+
+private:
+    static constexpr int indexMask = 3;
+    static constexpr int freshBit = 4;
+
+    T slots[slotCount];
+    int writeIndex = 0;                 // owned by the writer
+    int currentIndex = 1, previousIndex = 2; // owned by the reader
+    std::atomic<int> middle{3};
+};
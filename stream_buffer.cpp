@@ -0,0 +1,73 @@
+#include "stream_buffer.h"
+
+using namespace std;
+
+void StreamBuffer::create(GLenum bufferTarget, size_t bytes, int regions) {
+    target = bufferTarget;
+    regionBytes = bytes;
+    regionCount = regions;
+    region = regions - 1; // first beginWrite() wraps round to region 0
+    fences.assign(regions, nullptr);
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(target, buffer);
+    size_t total = regionBytes * regionCount;
+
+    if (GLAD_GL_VERSION_4_4) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(target, total, nullptr, flags);
+        mapped = (char*)glMapBufferRange(target, 0, total, flags);
+    }
+    if (!mapped) {
+        glBufferData(target, total, nullptr, GL_DYNAMIC_DRAW);
+        staging.resize(regionBytes);
+    }
+}
+
+void StreamBuffer::destroy() {
+    for (GLsync& f : fences) {
+        if (f) glDeleteSync(f);
+        f = nullptr;
+    }
+    if (buffer) {
+        if (mapped) {
+            glBindBuffer(target, buffer);
+            glUnmapBuffer(target);
+        }
+        glDeleteBuffers(1, &buffer);
+    }
+    buffer = 0;
+    mapped = nullptr;
+}
+
+void* StreamBuffer::beginWrite() {
+    region = (region + 1) % regionCount;
+
+    if (!mapped) return staging.data();
+
+    // wait until the GPU is done drawing what we put here regionCount frames ago
+    GLsync& f = fences[region];
+    if (f) {
+        GLbitfield waitFlags = 0;
+        for (;;) {
+            GLenum result = glClientWaitSync(f, waitFlags, 1000000); // 1ms
+            if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) break;
+            waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        }
+        glDeleteSync(f);
+        f = nullptr;
+    }
+    return mapped + region * regionBytes;
+}
+
+void StreamBuffer::endWrite(size_t bytes) {
+    if (mapped || bytes == 0) return; // coherent mapping, nothing to flush
+    glBindBuffer(target, buffer);
+    glBufferSubData(target, region * regionBytes, bytes, staging.data());
+}
+
+void StreamBuffer::fence() {
+    if (!mapped) return;
+    if (fences[region]) glDeleteSync(fences[region]);
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
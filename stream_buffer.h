@@ -0,0 +1,44 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <vector>
+
+// Per-frame vertex streaming without reallocating GL storage.
+//
+// The buffer is split into regionCount equal regions used round-robin, one per
+// frame. With GL 4.4 it is created once with glBufferStorage, persistently and
+// coherently mapped, and the CPU writes vertices straight into it; a fence per
+// region keeps us from overwriting data the GPU hasn't drawn yet. Older contexts
+// write into a CPU staging block allocated once and upload it with glBufferSubData
+class StreamBuffer {
+public:
+    static const int defaultRegions = 3;
+
+    // regionBytes should be a multiple of the vertex stride so firstVertex() lines up
+    void create(GLenum target, size_t regionBytes, int regionCount = defaultRegions);
+    void destroy();
+
+    // Move to the next region and return where this frame's data goes
+    void* beginWrite();
+    // Make the first `bytes` written since beginWrite() visible to the GPU
+    void endWrite(size_t bytes);
+    // Call after the draws reading this frame's region have been issued
+    void fence();
+
+    GLuint id() const { return buffer; }
+    size_t capacity() const { return regionBytes; }
+    bool persistent() const { return mapped != nullptr; }
+    // Index of this region's first vertex when drawing from the whole buffer
+    GLint firstVertex(size_t stride) const { return (GLint)(region * regionBytes / stride); }
+
+private:
+    GLenum target = GL_ARRAY_BUFFER;
+    GLuint buffer = 0;
+    size_t regionBytes = 0;
+    int regionCount = 0;
+    int region = 0;
+    char* mapped = nullptr;        // persistent path
+    std::vector<char> staging;     // fallback path
+    std::vector<GLsync> fences;
+};
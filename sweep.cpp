@@ -0,0 +1,543 @@
+// Parameter sweep: runs every combination of the --G, --M, --particles, --dt
+// and --integrator lists as its own headless simulation and writes one CSV row
+// of summary numbers per run. Jobs too small to fill the pool run one per core
+// side by side, big ones get the whole pool one at a time. --serve hands the
+// jobs out over TCP to --worker processes on other machines instead
+#include "diagnostics.h"
+#include "initial_conditions.h"
+#include "integrators.h"
+#include "lifecycle.h"
+#include "physics.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <netdb.h>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+struct SweepJob {
+    size_t index = 0;
+    float G = ::G, M = ::M;
+    size_t particles = 10000;
+    float dt = defaultDt;
+    const IntegratorInfo* integrator = &integrators[0];
+};
+
+// Shared by every job of a sweep
+struct SweepOptions {
+    size_t steps = 1000;
+    double time = 0.0; // > 0 runs each job for this much simulated time instead, so dt rows are comparable
+    unsigned seed = 1;
+    ForceModel force = ForceModel::Central;
+
+    size_t stepsFor(const SweepJob& job) const {
+        // float dt is a hair off, 4 / 0.01 should still be 400 steps
+        return time > 0.0 ? (size_t)ceil(time / job.dt * (1.0 - 1e-6)) : steps;
+    }
+};
+
+struct SweepResult {
+    size_t steps = 0;
+    size_t captured = 0, escaped = 0;
+    double energyDrift = 0.0, energyDriftMax = 0.0; // |dE / E0| over the survivors, mean and worst
+    double seconds = 0.0;
+};
+
+static void usage(const char* prog) {
+    cerr << "Usage: " << prog << " [--G A,B,...] [--M A,B,...] [--particles N,...] [--dt A,B,...]"
+         << " [--integrator NAME,...] [--steps S | --time T] [--seed SEED] [--threads T]"
+         << " [--force central|pw|geodesic|nbody] [--out FILE] [--serve PORT | --worker HOST:PORT]\n";
+    cerr << "Integrators:\n";
+    for (size_t i = 0; i < integratorCount; ++i) {
+        cerr << "  " << integrators[i].name << " - " << integrators[i].description << "\n";
+    }
+}
+
+static bool parseFloats(const char* text, vector<float>& values) {
+    values.clear();
+    stringstream in(text);
+    string item;
+    while (getline(in, item, ',')) {
+        char* end;
+        float v = strtof(item.c_str(), &end);
+        if (item.empty() || *end != '\0') return false;
+        values.push_back(v);
+    }
+    return !values.empty();
+}
+
+static bool parseCounts(const char* text, vector<size_t>& values) {
+    vector<float> parsed; // through strtof so 1e6 works
+    if (!parseFloats(text, parsed)) return false;
+    values.clear();
+    for (float v : parsed) {
+        if (v < 1.0f) return false;
+        values.push_back((size_t)v);
+    }
+    return true;
+}
+
+static bool parseIntegrators(const char* text, vector<const IntegratorInfo*>& values) {
+    values.clear();
+    stringstream in(text);
+    string item;
+    while (getline(in, item, ',')) {
+        const IntegratorInfo* info = findIntegrator(item.c_str());
+        if (!info) return false;
+        values.push_back(info);
+    }
+    return !values.empty();
+}
+
+// Specific orbital energy in the hole's field, what the integrators are meant to conserve
+static double orbitalEnergy(ForceModel force, const ForceContext& ctx, double x, double y, double vx, double vy) {
+    return 0.5 * (vx * vx + vy * vy) + specificPotential(force, ctx, x, y, vx, vy);
+}
+
+// One job start to finish. Particles are retired on capture and escape but
+// never respawned, so the disk left at the end is the one that started
+static SweepResult runJob(const SweepJob& job, const SweepOptions& options, ThreadPool& pool) {
+    double gm = (double)job.G * job.M;
+    InitDistribution dist;
+    dist.gm = (float)gm;
+    ParticleSystem ps;
+    initParticles(ps, job.particles, 0, options.seed, dist, &pool);
+
+    Lifecycle lifecycle;
+    lifecycle.gm = (float)gm;
+    lifecycle.configure(ps, options.seed, {}, 0);
+    lifecycle.emitters.clear();
+
+    Stepper stepper;
+    stepper.select(job.integrator->name, options.force, Precision::Float);
+    stepper.context.G = job.G;
+    stepper.context.M = job.M;
+    stepper.context.nbody.particleMass = defaultDiskMass / job.particles;
+
+    // ids are 0..n-1 and nothing spawns, so the start energy is indexed by id
+    vector<double> startEnergy(ps.size());
+    for (size_t i = 0; i < ps.size(); ++i) {
+        startEnergy[ps.id[i]] = orbitalEnergy(options.force, stepper.context, ps.posX[i], ps.posY[i], ps.velX[i], ps.velY[i]);
+    }
+
+    SweepResult result;
+    result.steps = options.stepsFor(job);
+    auto start = chrono::steady_clock::now();
+    for (size_t s = 0; s < result.steps; ++s) {
+        stepper.step(ps, pool, job.dt);
+        lifecycle.update(ps, s + 1, job.dt);
+    }
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    result.captured = lifecycle.totals().captured;
+    result.escaped = lifecycle.totals().escaped;
+
+    if (options.force == ForceModel::NBody) {
+        // the disk's own potential isn't in orbitalEnergy, so there's nothing to compare
+        result.energyDrift = result.energyDriftMax = NAN;
+    } else {
+        double sum = 0.0;
+        for (size_t i = 0; i < ps.size(); ++i) {
+            double e0 = startEnergy[ps.id[i]];
+            double e = orbitalEnergy(options.force, stepper.context, ps.posX[i], ps.posY[i], ps.velX[i], ps.velY[i]);
+            double drift = fabs(e - e0) / max(fabs(e0), 1e-12);
+            sum += drift;
+            result.energyDriftMax = max(result.energyDriftMax, drift);
+        }
+        result.energyDrift = ps.size() > 0 ? sum / ps.size() : 0.0;
+    }
+    return result;
+}
+
+static const char* csvHeader =
+    "index,G,M,particles,dt,integrator,force,steps,captured,escaped,capture_rate,"
+    "energy_drift,energy_drift_max,steps_per_sec,particle_steps_per_sec,seconds";
+
+static string formatResult(const SweepJob& job, const SweepOptions& options, const SweepResult& r) {
+    double stepsPerSec = r.seconds > 0.0 ? r.steps / r.seconds : 0.0;
+    char line[512];
+    snprintf(line, sizeof(line), "%zu,%g,%g,%zu,%g,%s,%s,%zu,%zu,%zu,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g",
+             job.index, job.G, job.M, job.particles, job.dt, job.integrator->name, forceModelName(options.force),
+             r.steps, r.captured, r.escaped, (double)r.captured / job.particles, r.energyDrift, r.energyDriftMax,
+             stepsPerSec, stepsPerSec * job.particles, r.seconds);
+    return line;
+}
+
+// Run a batch on this machine. Jobs with enough particles to give every
+// thread a chunk each go one after another on the whole pool. The rest are
+// packed one per thread, each with a single-thread pool of its own, since many
+// small runs side by side scale better than one small run split across cores
+static void runLocal(const vector<SweepJob>& jobs, const SweepOptions& options, unsigned threads,
+                     const function<void(const SweepJob&, const string&)>& done) {
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    vector<const SweepJob*> large, small;
+    for (const SweepJob& job : jobs) {
+        (threads > 1 && job.particles >= physicsChunkSize * threads ? large : small).push_back(&job);
+    }
+
+    if (!large.empty()) {
+        ThreadPool pool(threads);
+        for (const SweepJob* job : large) done(*job, formatResult(*job, options, runJob(*job, options, pool)));
+    }
+
+    atomic<size_t> next{0};
+    mutex doneMutex;
+    auto worker = [&]() {
+        ThreadPool pool(1);
+        for (size_t k; (k = next++) < small.size();) {
+            string line = formatResult(*small[k], options, runJob(*small[k], options, pool));
+            lock_guard<mutex> lock(doneMutex);
+            done(*small[k], line);
+        }
+    };
+    vector<thread> packed;
+    for (unsigned t = 1; t < min<size_t>(threads, small.size()); ++t) packed.emplace_back(worker);
+    worker();
+    for (thread& t : packed) t.join();
+}
+
+// Work distribution is a line protocol over TCP:
+//   worker: HELLO <cores>           server: SWEEP <steps> <time> <seed> <force>
+//   worker: NEXT                    server: JOB <index> <G> <M> <particles> <dt> <integrator>... END, or DONE
+//   worker: RESULT <csv row>...     (one per job, before the next NEXT)
+// A NEXT gets up to <cores> jobs. Jobs of a worker that drops are handed out again
+static string formatJob(const SweepJob& job) {
+    char line[256];
+    snprintf(line, sizeof(line), "JOB %zu %.9g %.9g %zu %.9g %s\n", job.index, job.G, job.M, job.particles,
+             job.dt, job.integrator->name);
+    return line;
+}
+
+static bool parseJob(const string& line, SweepJob& job) {
+    char name[64];
+    if (sscanf(line.c_str(), "JOB %zu %f %f %zu %f %63s", &job.index, &job.G, &job.M, &job.particles,
+               &job.dt, name) != 6) return false;
+    job.integrator = findIntegrator(name);
+    return job.integrator != nullptr && job.particles > 0;
+}
+
+// Pop one complete line off the front of buffer
+static bool takeLine(string& buffer, string& line) {
+    size_t end = buffer.find('\n');
+    if (end == string::npos) return false;
+    line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+    return true;
+}
+
+static bool sendAll(int fd, const string& text) {
+    for (size_t sent = 0; sent < text.size();) {
+        ssize_t n = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+// Blocking read of the next line, false at EOF
+static bool readLine(int fd, string& buffer, string& line) {
+    char chunk[4096];
+    while (!takeLine(buffer, line)) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+    }
+    return true;
+}
+
+static int listenOn(const char* port) {
+    addrinfo hints = {}, *found;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(nullptr, port, &hints, &found) != 0) return -1;
+    int fd = -1;
+    for (addrinfo* a = found; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, a->ai_addr, a->ai_addrlen) != 0 || listen(fd, 64) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+static int connectTo(const char* address) {
+    const char* colon = strrchr(address, ':');
+    if (!colon) return -1;
+    string host(address, colon - address);
+    addrinfo hints = {}, *found;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), colon + 1, &hints, &found) != 0) return -1;
+    int fd = -1;
+    for (addrinfo* a = found; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+// Hands every job out and collects the rows into results, indexed by job.
+// One thread polling every socket, the server does no simulating itself
+static bool serve(const char* port, const vector<SweepJob>& jobs, const SweepOptions& options, vector<string>& results) {
+    int listener = listenOn(port);
+    if (listener < 0) {
+        cerr << "Can't listen on port " << port << "\n";
+        return false;
+    }
+    cerr << "serving " << jobs.size() << " jobs on port " << port << endl;
+
+    struct Client {
+        int fd;
+        string buffer;
+        unsigned cores = 0;
+        bool waiting = false;    // sent NEXT while the queue was empty
+        vector<size_t> assigned; // handed out, no result yet
+    };
+    vector<Client> clients;
+    vector<size_t> queue; // job indices still to hand out, back first
+    for (size_t i = jobs.size(); i-- > 0;) queue.push_back(i);
+    size_t finished = 0;
+
+    auto handOut = [&](Client& c) {
+        if (finished == jobs.size()) {
+            sendAll(c.fd, "DONE\n");
+            return;
+        }
+        if (queue.empty()) {
+            c.waiting = true; // others still have jobs out, one of them may drop
+            return;
+        }
+        c.waiting = false;
+        string batch;
+        for (unsigned k = 0; k < max(1u, c.cores) && !queue.empty(); ++k) {
+            c.assigned.push_back(queue.back());
+            batch += formatJob(jobs[queue.back()]);
+            queue.pop_back();
+        }
+        sendAll(c.fd, batch + "END\n");
+    };
+
+    while (finished < jobs.size()) {
+        vector<pollfd> fds(1, pollfd{ listener, POLLIN, 0 });
+        for (const Client& c : clients) fds.push_back({ c.fd, POLLIN, 0 });
+        if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) break;
+
+        vector<size_t> dropped;
+        for (size_t k = 0; k < clients.size(); ++k) {
+            if (!(fds[k + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            Client& c = clients[k];
+            char chunk[4096];
+            ssize_t n = read(c.fd, chunk, sizeof(chunk));
+            if (n <= 0) {
+                dropped.push_back(k);
+                continue;
+            }
+            c.buffer.append(chunk, n);
+            string line;
+            while (takeLine(c.buffer, line)) {
+                if (line.compare(0, 6, "HELLO ") == 0) {
+                    c.cores = (unsigned)strtoul(line.c_str() + 6, nullptr, 10);
+                    char reply[128];
+                    snprintf(reply, sizeof(reply), "SWEEP %zu %.17g %u %s\n", options.steps, options.time,
+                             options.seed, forceModelName(options.force));
+                    sendAll(c.fd, reply);
+                } else if (line == "NEXT") {
+                    handOut(c);
+                } else if (line.compare(0, 7, "RESULT ") == 0) {
+                    size_t index = strtoull(line.c_str() + 7, nullptr, 10);
+                    auto it = find(c.assigned.begin(), c.assigned.end(), index);
+                    if (it == c.assigned.end()) continue;
+                    c.assigned.erase(it);
+                    if (results[index].empty()) {
+                        results[index] = line.substr(7);
+                        finished++;
+                        cerr << "job " << index << " done (" << finished << "/" << jobs.size() << ")" << endl;
+                    }
+                }
+            }
+        }
+        // drop from the back so the indices above stay valid
+        for (size_t k = dropped.size(); k-- > 0;) {
+            Client& c = clients[dropped[k]];
+            for (size_t index : c.assigned) {
+                if (results[index].empty()) queue.push_back(index);
+            }
+            if (!c.assigned.empty()) cerr << "worker dropped, " << c.assigned.size() << " jobs requeued" << endl;
+            close(c.fd);
+            clients.erase(clients.begin() + dropped[k]);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0) clients.push_back({ fd, string() });
+        }
+        for (Client& c : clients) {
+            if (c.waiting && (!queue.empty() || finished == jobs.size())) handOut(c);
+        }
+    }
+    for (Client& c : clients) {
+        if (c.waiting) sendAll(c.fd, "DONE\n");
+        close(c.fd);
+    }
+    close(listener);
+    return finished == jobs.size();
+}
+
+// Asks the server for batches until it says DONE
+static bool work(const char* address, unsigned threads) {
+    int fd = connectTo(address);
+    if (fd < 0) {
+        cerr << "Can't connect to " << address << "\n";
+        return false;
+    }
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    string buffer, line;
+    SweepOptions options;
+    char force[32];
+    if (!sendAll(fd, "HELLO " + to_string(threads) + "\n") || !readLine(fd, buffer, line) ||
+        sscanf(line.c_str(), "SWEEP %zu %lf %u %31s", &options.steps, &options.time, &options.seed, force) != 4 ||
+        !parseForceModel(force, options.force)) {
+        cerr << "Bad handshake from " << address << "\n";
+        close(fd);
+        return false;
+    }
+
+    size_t ran = 0;
+    while (sendAll(fd, "NEXT\n")) {
+        vector<SweepJob> batch;
+        bool done = false;
+        while (readLine(fd, buffer, line) && line != "END") {
+            SweepJob job;
+            if (line == "DONE") done = true;
+            else if (parseJob(line, job)) batch.push_back(job);
+            if (done) break;
+        }
+        if (done || batch.empty()) break;
+        string replies;
+        runLocal(batch, options, threads, [&](const SweepJob&, const string& row) {
+            replies += "RESULT " + row + "\n";
+        });
+        if (!sendAll(fd, replies)) break;
+        ran += batch.size();
+    }
+    cerr << "worker ran " << ran << " jobs" << endl;
+    close(fd);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    vector<float> Gs = { G }, Ms = { M }, dts = { defaultDt };
+    vector<size_t> counts = { 10000 };
+    vector<const IntegratorInfo*> schemes = { &integrators[0] };
+    SweepOptions options;
+    unsigned numThreads = 0;
+    const char* outPath = nullptr;
+    const char* servePort = nullptr;
+    const char* workerAddress = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--G") == 0 && hasValue && parseFloats(argv[i + 1], Gs)) {
+            ++i;
+        } else if (strcmp(argv[i], "--M") == 0 && hasValue && parseFloats(argv[i + 1], Ms)) {
+            ++i;
+        } else if (strcmp(argv[i], "--dt") == 0 && hasValue && parseFloats(argv[i + 1], dts)) {
+            ++i;
+        } else if (strcmp(argv[i], "--particles") == 0 && hasValue && parseCounts(argv[i + 1], counts)) {
+            ++i;
+        } else if (strcmp(argv[i], "--integrator") == 0 && hasValue && parseIntegrators(argv[i + 1], schemes)) {
+            ++i;
+        } else if (strcmp(argv[i], "--steps") == 0 && hasValue) {
+            options.steps = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--time") == 0 && hasValue) {
+            options.time = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+            options.seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            numThreads = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--force") == 0 && hasValue && parseForceModel(argv[i + 1], options.force) &&
+                   options.force != ForceModel::Attractors) {
+            ++i;
+        } else if (strcmp(argv[i], "--out") == 0 && hasValue) {
+            outPath = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && hasValue) {
+            servePort = argv[++i];
+        } else if (strcmp(argv[i], "--worker") == 0 && hasValue) {
+            workerAddress = argv[++i];
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (workerAddress) return work(workerAddress, numThreads) ? 0 : 1;
+
+    // every combination, dt varies fastest
+    vector<SweepJob> jobs;
+    for (float g : Gs) for (float m : Ms) for (size_t n : counts) for (const IntegratorInfo* scheme : schemes) for (float dt : dts) {
+        SweepJob job;
+        job.index = jobs.size();
+        job.G = g;
+        job.M = m;
+        job.particles = n;
+        job.dt = dt;
+        job.integrator = scheme;
+        jobs.push_back(job);
+    }
+
+    vector<string> results(jobs.size());
+    auto start = chrono::steady_clock::now();
+    if (servePort) {
+        if (!serve(servePort, jobs, options, results)) return 1;
+    } else {
+        cerr << "running " << jobs.size() << " jobs" << endl;
+        size_t finished = 0;
+        runLocal(jobs, options, numThreads, [&](const SweepJob& job, const string& row) {
+            results[job.index] = row;
+            cerr << "job " << job.index << " done (" << ++finished << "/" << jobs.size() << ")" << endl;
+        });
+    }
+    cerr << "sweep took " << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " s" << endl;
+
+    // rows in job order, however they finished
+    ofstream file;
+    if (outPath) {
+        file.open(outPath);
+        if (!file) {
+            cerr << "Failed to write " << outPath << "\n";
+            return -1;
+        }
+    }
+    ostream& out = outPath ? file : cout;
+    out << csvHeader << "\n";
+    for (const string& row : results) out << row << "\n";
+    return out ? 0 : 1;
+}
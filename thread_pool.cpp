@@ -0,0 +1,97 @@
+#include "thread_pool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned threadCount) {
+    if (threadCount == 0) threadCount = max(1u, thread::hardware_concurrency());
+
+    for (unsigned i = 0; i < threadCount; ++i) queues.push_back(make_unique<Queue>());
+    // participant 0 is whoever calls parallelFor()
+    for (unsigned i = 1; i < threadCount; ++i) workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread& t : workers) t.join();
+}
+
+void ThreadPool::parallelFor(size_t count, size_t chunkSize, const function<void(size_t, size_t)>& func) {
+    if (count == 0) return;
+    if (chunkSize == 0) chunkSize = count;
+    size_t numChunks = (count + chunkSize - 1) / chunkSize;
+
+    // a single chunk or a single thread isn't worth waking anyone for
+    if (numChunks == 1 || queues.size() == 1) {
+        for (size_t begin = 0; begin < count; begin += chunkSize) func(begin, min(begin + chunkSize, count));
+        return;
+    }
+
+    // hand each participant a contiguous block of chunks, stealing evens out the rest
+    pending.store(numChunks);
+    size_t perQueue = (numChunks + queues.size() - 1) / queues.size();
+    for (size_t c = 0; c < numChunks; ++c) {
+        Queue& q = *queues[c / perQueue];
+        lock_guard<mutex> lock(q.m);
+        q.tasks.push_back({ &func, c * chunkSize, min((c + 1) * chunkSize, count) });
+    }
+
+    {
+        lock_guard<mutex> lock(wakeMutex);
+        ++generation;
+    }
+    wake.notify_all();
+
+    drain(0);
+
+    unique_lock<mutex> lock(doneMutex);
+    done.wait(lock, [this] { return pending.load() == 0; });
+}
+
+bool ThreadPool::pop(unsigned index, Task& task) {
+    Queue& q = *queues[index];
+    lock_guard<mutex> lock(q.m);
+    if (q.tasks.empty()) return false;
+    task = q.tasks.front();
+    q.tasks.pop_front();
+    return true;
+}
+
+bool ThreadPool::steal(unsigned thief, Task& task) {
+    for (size_t k = 1; k < queues.size(); ++k) {
+        Queue& q = *queues[(thief + k) % queues.size()];
+        lock_guard<mutex> lock(q.m);
+        if (q.tasks.empty()) continue;
+        task = q.tasks.back();
+        q.tasks.pop_back();
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::drain(unsigned index) {
+    Task task;
+    while (pop(index, task) || steal(index, task)) {
+        (*task.func)(task.begin, task.end);
+        if (pending.fetch_sub(1) == 1) {
+            lock_guard<mutex> lock(doneMutex);
+            done.notify_all();
+        }
+    }
+}
+
+void ThreadPool::workerLoop(unsigned index) {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            unique_lock<mutex> lock(wakeMutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        drain(index);
+    }
+}
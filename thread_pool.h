@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent work-stealing pool. The thread calling parallelFor() works as
+// participant 0 alongside the workers, so no thread sits idle waiting for others.
+//
+// Chunk boundaries only depend on the range and the chunk size, never on the
+// thread count or on who ends up running a chunk, so any kernel that doesn't
+// write across chunks gives bit-identical results on every run
+class ThreadPool {
+public:
+    // threadCount includes the calling thread, 0 picks hardware_concurrency()
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return (unsigned)queues.size(); }
+
+    // Run func(begin, end) over [0, count) in chunkSize pieces and return once all are done
+    void parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& func);
+
+private:
+    struct Task {
+        const std::function<void(size_t, size_t)>* func;
+        size_t begin, end;
+    };
+
+    // Owner pops from the front, thieves take from the back
+    struct Queue {
+        std::mutex m;
+        std::deque<Task> tasks;
+    };
+
+    bool pop(unsigned index, Task& task);
+    bool steal(unsigned thief, Task& task);
+    void drain(unsigned index);
+    void workerLoop(unsigned index);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    std::atomic<size_t> pending{0};
+    std::mutex doneMutex;
+    std::condition_variable done;
+};
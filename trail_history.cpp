@@ -0,0 +1,177 @@
+#include "trail_history.h"
+#include "physics.h"
+#include "shader.h"
+#include "spatial_grid.h"
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+// Instance = particle, vertex = trail point oldest first
+static const char* historyVertexShaderSrc = R"(
+#version 330 core
+uniform samplerBuffer uHistory;
+uniform usamplerBuffer uBirth;
+uniform uint uSerial;
+uniform int uParticles;
+uniform int uLength;
+uniform int uHead;
+uniform int uCount;
+uniform float uScreenWidth;
+uniform float uScreenHeight;
+uniform vec3 uView;                                     // centre x, y and zoom
+out float vAlpha;
+
+void main() {
+    // points from before the slot's owner arrived collapse onto its oldest one
+    int valid = int(min(uSerial - texelFetch(uBirth, gl_InstanceID).r, uint(uCount - 1))) + 1;
+    int age = min(uCount - 1 - gl_VertexID, valid - 1); // 0 = newest point
+    int slot = (uHead - age + uLength) % uLength;
+    vec2 pos = texelFetch(uHistory, slot * uParticles + gl_InstanceID).xy;
+
+    float x = (pos.x - uView.x) * uView.z / uScreenWidth * 2.0;
+    float y = (pos.y - uView.y) * uView.z / uScreenHeight * 2.0;
+    gl_Position = vec4(x, y, 0.0, 1.0);
+    vAlpha = float(gl_VertexID) / float(uCount);        // newer points are more opaque
+}
+)";
+
+static const char* historyFragmentShaderSrc = R"(
+#version 330 core
+in float vAlpha;
+out vec4 FragColor;
+uniform vec3 uColor;
+
+void main() {
+    FragColor = vec4(uColor * 0.8, vAlpha * 0.3);  // Dimmer, fading trails
+}
+)";
+
+void TrailHistory::create(size_t particles, size_t trailLength) {
+    particleCount = particles;
+    length = trailLength;
+    head = -1;
+    count = 0;
+    staging.resize(particles * 2);
+    owner.assign(particles, UINT64_MAX);
+    births.assign(particles, serial);
+
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    if ((size_t)maxTexels < particles * trailLength) {
+        cerr << "Trail history needs " << particles * trailLength << " texels, driver allows " << maxTexels << "\n";
+    }
+
+    glGenBuffers(1, &historyBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, historyBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, particles * trailLength * 2 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+
+    glGenTextures(1, &historyTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, historyTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32F, historyBuffer);
+
+    glGenBuffers(1, &birthBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, birthBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, particles * sizeof(uint32_t), births.data(), GL_DYNAMIC_DRAW);
+
+    glGenTextures(1, &birthTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, birthTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, birthBuffer);
+
+    glGenVertexArrays(1, &emptyVAO);
+
+    program = createProgram(historyVertexShaderSrc, historyFragmentShaderSrc);
+    historyLoc = glGetUniformLocation(program, "uHistory");
+    birthLoc = glGetUniformLocation(program, "uBirth");
+    serialLoc = glGetUniformLocation(program, "uSerial");
+    particlesLoc = glGetUniformLocation(program, "uParticles");
+    lengthLoc = glGetUniformLocation(program, "uLength");
+    headLoc = glGetUniformLocation(program, "uHead");
+    countLoc = glGetUniformLocation(program, "uCount");
+    widthLoc = glGetUniformLocation(program, "uScreenWidth");
+    heightLoc = glGetUniformLocation(program, "uScreenHeight");
+    viewLoc = glGetUniformLocation(program, "uView");
+    colorLoc = glGetUniformLocation(program, "uColor");
+}
+
+void TrailHistory::destroy() {
+    glDeleteProgram(program);
+    glDeleteVertexArrays(1, &emptyVAO);
+    glDeleteTextures(1, &historyTexture);
+    glDeleteBuffers(1, &historyBuffer);
+    glDeleteTextures(1, &birthTexture);
+    glDeleteBuffers(1, &birthBuffer);
+    program = emptyVAO = historyTexture = historyBuffer = birthTexture = birthBuffer = 0;
+}
+
+int TrailHistory::advance() {
+    if (length == 0) return 0;
+    head = (head + 1) % (int)length;
+    if (count < length) count++;
+    serial++;
+    return head;
+}
+
+void TrailHistory::push(const float* posX, const float* posY, const uint32_t* ids, const uint32_t* generations,
+                        size_t n) {
+    if (length == 0 || particleCount == 0) return;
+    n = min(n, particleCount);
+    for (size_t i = 0; i < n; ++i) {
+        staging[2*i] = posX[i];
+        staging[2*i+1] = posY[i];
+    }
+    for (size_t i = n; i < particleCount; ++i) {
+        staging[2*i] = centerX;
+        staging[2*i+1] = centerY;
+    }
+    int slot = advance();
+    glBindBuffer(GL_TEXTURE_BUFFER, historyBuffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, slot * particleCount * 2 * sizeof(float),
+                    particleCount * 2 * sizeof(float), staging.data());
+
+    // Slots that changed hands since the last push start over from this one.
+    // swapRemove and spawns only touch a few slots, upload them run by run
+    glBindBuffer(GL_TEXTURE_BUFFER, birthBuffer);
+    size_t runStart = particleCount;
+    for (size_t i = 0; i <= particleCount; ++i) {
+        bool changed = false;
+        if (i < particleCount) {
+            uint64_t k = i < n ? (uint64_t)generations[ids[i]] << 32 | ids[i] : UINT64_MAX;
+            changed = owner[i] != k;
+            if (changed) {
+                owner[i] = k;
+                births[i] = serial;
+            }
+        }
+        if (changed && runStart == particleCount) runStart = i;
+        else if (!changed && runStart != particleCount) {
+            glBufferSubData(GL_TEXTURE_BUFFER, runStart * sizeof(uint32_t), (i - runStart) * sizeof(uint32_t), &births[runStart]);
+            runStart = particleCount;
+        }
+    }
+}
+
+void TrailHistory::draw(float r, float g, float b, const View& view) {
+    if (count < 2 || particleCount == 0) return;
+
+    glUseProgram(program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, historyTexture);
+    glUniform1i(historyLoc, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, birthTexture);
+    glUniform1i(birthLoc, 1);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1ui(serialLoc, serial);
+    glUniform1i(particlesLoc, (GLint)particleCount);
+    glUniform1i(lengthLoc, (GLint)length);
+    glUniform1i(headLoc, head);
+    glUniform1i(countLoc, (GLint)count);
+    glUniform1f(widthLoc, (float)width);
+    glUniform1f(heightLoc, (float)height);
+    glUniform3f(viewLoc, view.x, view.y, view.zoom);
+    glUniform3f(colorLoc, r, g, b);
+
+    glBindVertexArray(emptyVAO);
+    glDrawArraysInstanced(GL_LINE_STRIP, 0, (GLsizei)count, (GLsizei)particleCount);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct View;
+
+// Trail history kept on the GPU. One buffer holds a ring of `length` slots and
+// every slot holds the position of every particle (slot-major, x and y), so
+// recording a step only writes one contiguous N-sized slot. The buffer is read
+// through a texture buffer and each particle is drawn as one instanced line
+// strip, with the fade rebuilt from the vertex index in the shader. A slot that
+// changes hands (retire, spawn) restarts its trail from the push it changed in
+class TrailHistory {
+public:
+    void create(size_t particles, size_t length);
+    void destroy();
+
+    // Move to the next slot and return it, the caller then fills it (compute path)
+    int advance();
+    // Record newest CPU-side positions of n <= particles() into the next slot,
+    // the unused rest of the slot goes to the hole where it's hidden. `ids` are
+    // the particles' ids and `generations` ParticleSystem::generation (by id),
+    // a slot holding a different particle than last push drops its older points
+    void push(const float* posX, const float* posY, const uint32_t* ids, const uint32_t* generations, size_t n);
+    // Forget every recorded slot, trails grow back from nothing
+    void clear() { head = -1; count = 0; }
+
+    void draw(float r, float g, float b, const View& view);
+
+    GLuint buffer() const { return historyBuffer; }
+    size_t particles() const { return particleCount; }
+    size_t trailLength() const { return length; }
+
+private:
+    size_t particleCount = 0;
+    size_t length = 0;
+    int head = -1;        // slot holding the newest positions
+    size_t count = 0;     // slots filled so far
+    uint32_t serial = 0;  // pushes so far, never reset so births stay comparable
+    GLuint historyBuffer = 0;
+    GLuint historyTexture = 0;
+    GLuint birthBuffer = 0;   // per particle serial its current owner arrived at
+    GLuint birthTexture = 0;
+    GLuint emptyVAO = 0;  // core profile still wants a VAO bound for attribute-less draws
+    GLuint program = 0;
+    GLint historyLoc = -1, particlesLoc = -1, lengthLoc = -1, headLoc = -1, countLoc = -1;
+    GLint birthLoc = -1, serialLoc = -1;
+    GLint widthLoc = -1, heightLoc = -1, viewLoc = -1, colorLoc = -1;
+    std::vector<float> staging; // interleaved x, y for push(), allocated once
+    std::vector<uint64_t> owner; // generation << 32 | id of each slot's particle, UINT64_MAX = empty
+    std::vector<uint32_t> births; // CPU copy of birthBuffer
+};
@@ -0,0 +1,330 @@
+#include "trajectory.h"
+#include "diagnostics.h"
+#include "physics.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const char trajectoryMagic[8] = { 'B', 'H', 'T', 'R', 'A', 'J', 0, 0 };
+
+static inline void putVarint(vector<uint8_t>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+static inline bool getVarint(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+bool parseTrajectorySubset(const char* text, TrajectoryOptions& options) {
+    unsigned long long begin, end, every = 1;
+    int fields = sscanf(text, "%llu:%llu:%llu", &begin, &end, &every);
+    if (fields < 2 || end <= begin || every == 0) return false;
+    options.begin = (size_t)begin;
+    options.end = (size_t)end;
+    options.every = (size_t)every;
+    return true;
+}
+
+bool TrajectoryWriter::open(const char* path, size_t idCount, const TrajectoryOptions& options) {
+    close();
+    opts = options;
+    opts.stride = max(opts.stride, 1u);
+    opts.every = max(opts.every, (size_t)1);
+    opts.framesPerChunk = max(opts.framesPerChunk, 1u);
+    opts.queueFrames = max(opts.queueFrames, (size_t)1);
+    opts.end = min(opts.end, idCount);
+    opts.begin = min(opts.begin, opts.end);
+    particles = (opts.end - opts.begin + opts.every - 1) / opts.every;
+
+    file = fopen(path, "wb");
+    if (!file) return false;
+    this->path = path;
+
+    TrajectoryHeader header = {};
+    memcpy(header.magic, trajectoryMagic, sizeof(trajectoryMagic));
+    header.version = trajectoryVersion;
+    header.fields = trajectoryFields;
+    header.particles = particles;
+    header.subsetBegin = opts.begin;
+    header.subsetEvery = opts.every;
+    header.stride = opts.stride;
+    header.framesPerChunk = opts.framesPerChunk;
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+
+    frames.assign(opts.queueFrames, Frame());
+    freeFrames.clear();
+    queued.clear();
+    for (size_t k = 0; k < frames.size(); ++k) {
+        frames[k].values.resize(trajectoryFields * particles);
+        frames[k].generation.resize(particles);
+        freeFrames.push_back(k);
+    }
+    stopping = false;
+    failed = false;
+    written = dropped = 0;
+    chunkSteps.clear();
+    chunkTimes.clear();
+    chunkDiagnostics.clear();
+    chunkDiagnostics.reserve((size_t)opts.framesPerChunk * 4);
+    chunkBits.clear();
+    chunkBits.reserve((size_t)opts.framesPerChunk * trajectoryFields * particles);
+    chunkGenerations.clear();
+    chunkGenerations.reserve((size_t)opts.framesPerChunk * particles);
+    worker = thread(&TrajectoryWriter::run, this);
+    return true;
+}
+
+void TrajectoryWriter::close() {
+    if (!file) return;
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueCv.notify_all();
+    worker.join();
+    if (fclose(file) != 0 && !failed) cerr << path << ": trajectory write failed (" << strerror(errno) << ")\n";
+    file = nullptr;
+}
+
+void TrajectoryWriter::record(uint64_t step, double time, const ParticleSystem& ps, const DriftMonitor* diagnostics) {
+    if (!file || step % opts.stride != 0) return;
+
+    size_t slot;
+    {
+        unique_lock<mutex> lock(queueMutex);
+        if (!opts.dropWhenFull) queueCv.wait(lock, [&] { return !freeFrames.empty() || failed; });
+        if (freeFrames.empty() || failed) {
+            dropped++;
+            return;
+        }
+        slot = freeFrames.front();
+        freeFrames.pop_front();
+    }
+
+    Frame& frame = frames[slot];
+    frame.step = step;
+    frame.time = time;
+    if (diagnostics && diagnostics->measured() && diagnostics->step() == step) {
+        frame.diagnostics[0] = diagnostics->latest().energy();
+        frame.diagnostics[1] = diagnostics->latest().angularMomentum;
+        frame.diagnostics[2] = diagnostics->energyDrift();
+        frame.diagnostics[3] = diagnostics->momentumDrift();
+    } else {
+        fill(begin(frame.diagnostics), end(frame.diagnostics), NAN);
+    }
+    float* x = frame.values.data();
+    float* y = x + particles;
+    float* t = y + particles;
+    uint32_t* g = frame.generation.data();
+    // by id, the sorter and swapRemove() move particles between slots
+    for (size_t j = 0; j < particles; ++j) {
+        size_t k = opts.begin + j * opts.every;
+        uint32_t i = k < ps.slotOf.size() ? ps.slotOf[k] : ParticleSystem::noSlot;
+        g[j] = k < ps.generation.size() ? ps.generation[k] : 0;
+        if (i == ParticleSystem::noSlot) {
+            x[j] = y[j] = t[j] = 0.0f; // id free: retired, not yet reused
+            continue;
+        }
+        x[j] = ps.posX[i];
+        y[j] = ps.posY[i];
+        t[j] = ps.temp[i];
+    }
+
+    {
+        lock_guard<mutex> lock(queueMutex);
+        queued.push_back(slot);
+    }
+    queueCv.notify_one();
+}
+
+void TrajectoryWriter::run() {
+    unique_lock<mutex> lock(queueMutex);
+    while (true) {
+        queueCv.wait(lock, [&] { return !queued.empty() || stopping; });
+        if (queued.empty()) break;
+        size_t slot = queued.front();
+        queued.pop_front();
+        // only this thread sets failed, frames queued before it did are dropped here
+        if (failed) {
+            freeFrames.push_back(slot);
+            dropped++;
+            continue;
+        }
+        lock.unlock();
+
+        const Frame& frame = frames[slot];
+        chunkSteps.push_back(frame.step);
+        chunkTimes.push_back(frame.time);
+        chunkDiagnostics.insert(chunkDiagnostics.end(), begin(frame.diagnostics), end(frame.diagnostics));
+        size_t base = chunkBits.size();
+        chunkBits.resize(base + frame.values.size());
+        memcpy(&chunkBits[base], frame.values.data(), frame.values.size() * sizeof(float));
+        chunkGenerations.insert(chunkGenerations.end(), frame.generation.begin(), frame.generation.end());
+        if (chunkSteps.size() >= opts.framesPerChunk) flushChunk();
+
+        lock.lock();
+        freeFrames.push_back(slot);
+        if (!opts.dropWhenFull) queueCv.notify_all();
+    }
+    lock.unlock();
+    if (!chunkSteps.empty()) flushChunk();
+}
+
+// Writer thread, without the lock: writes the pending frames and settles them
+// as written or dropped
+void TrajectoryWriter::flushChunk() {
+    uint64_t count = chunkSteps.size();
+    bool ok = writeChunk();
+    if (!ok) cerr << path << ": trajectory write failed (" << strerror(errno) << "), recording stopped\n";
+    lock_guard<mutex> lock(queueMutex);
+    if (ok) written += count;
+    else {
+        dropped += count;
+        failed = true;
+        queueCv.notify_all(); // record() may be waiting for a frame
+    }
+}
+
+// false on the first write that doesn't go through. The chunk is flushed so a
+// full disk shows up here rather than at close()
+bool TrajectoryWriter::writeChunk() {
+    uint32_t count = (uint32_t)chunkSteps.size();
+    TrajectoryChunkHeader header = {};
+    header.frames = count;
+
+    encoded.clear();
+    // one column: every particle's values frame by frame, frames `stride` apart
+    auto encodeColumn = [&](const uint32_t* first, size_t stride) {
+        size_t start = encoded.size();
+        for (size_t j = 0; j < particles; ++j) {
+            uint32_t prev = 0;
+            for (uint32_t k = 0; k < count; ++k) {
+                uint32_t b = first[j + k * stride];
+                int32_t delta = (int32_t)(b - prev);
+                putVarint(encoded, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31)); // zigzag
+                prev = b;
+            }
+        }
+        return encoded.size() - start;
+    };
+    for (uint32_t f = 0; f < trajectoryFields; ++f) {
+        header.columnBytes[f] = encodeColumn(chunkBits.data() + f * particles, trajectoryFields * particles);
+    }
+    header.generationBytes = (uint32_t)encodeColumn(chunkGenerations.data(), particles);
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (uint32_t k = 0; k < count && ok; ++k) {
+        ok = fwrite(&chunkSteps[k], sizeof(uint64_t), 1, file) == 1 &&
+             fwrite(&chunkTimes[k], sizeof(double), 1, file) == 1 &&
+             fwrite(&chunkDiagnostics[k * 4], sizeof(double), 4, file) == 4;
+    }
+    ok = ok && fwrite(encoded.data(), 1, encoded.size(), file) == encoded.size() && fflush(file) == 0;
+
+    chunkSteps.clear();
+    chunkTimes.clear();
+    chunkDiagnostics.clear();
+    chunkBits.clear();
+    chunkGenerations.clear();
+    return ok;
+}
+
+bool TrajectoryReader::open(const char* path) {
+    if (file) fclose(file);
+    file = fopen(path, "rb");
+    if (!file) return false;
+    if (fread(&head, sizeof(head), 1, file) != 1 || memcmp(head.magic, trajectoryMagic, sizeof(trajectoryMagic)) != 0 ||
+        head.version != trajectoryVersion || head.fields != trajectoryFields) {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    struct stat st;
+    fileBytes = fstat(fileno(file), &st) == 0 ? (uint64_t)st.st_size : 0;
+    return true;
+}
+
+bool TrajectoryReader::next(Chunk& chunk) {
+    if (!file) return false;
+    TrajectoryChunkHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1) return false;
+
+    // Every frame has its index entry and every value takes at least a byte,
+    // so a chunk that claims more than the rest of the file is damaged
+    uint32_t count = header.frames;
+    long at = ftell(file);
+    uint64_t left = at >= 0 && (uint64_t)at <= fileBytes ? fileBytes - (uint64_t)at : 0;
+    uint64_t indexBytes = (uint64_t)count * 48;
+    if (indexBytes > left) return false;
+    left -= indexBytes;
+    uint64_t columnBytes[trajectoryFields + 1] = { header.columnBytes[0], header.columnBytes[1], header.columnBytes[2],
+                                                   header.generationBytes };
+    for (uint32_t f = 0; f < trajectoryFields + 1; ++f) {
+        uint64_t bytes = columnBytes[f];
+        if (bytes > left) return false;
+        left -= bytes;
+        if (head.particles > 0 && count > bytes / head.particles) return false;
+    }
+
+    chunk.step.resize(count);
+    chunk.time.resize(count);
+    chunk.energy.resize(count);
+    chunk.angularMomentum.resize(count);
+    chunk.energyDrift.resize(count);
+    chunk.angularMomentumDrift.resize(count);
+    for (uint32_t k = 0; k < count; ++k) {
+        if (fread(&chunk.step[k], sizeof(uint64_t), 1, file) != 1) return false;
+        if (fread(&chunk.time[k], sizeof(double), 1, file) != 1) return false;
+        double d[4];
+        if (fread(d, sizeof(double), 4, file) != 4) return false;
+        chunk.energy[k] = d[0];
+        chunk.angularMomentum[k] = d[1];
+        chunk.energyDrift[k] = d[2];
+        chunk.angularMomentumDrift[k] = d[3];
+    }
+
+    size_t particles = (size_t)head.particles;
+    // one column of `bytes` from the file into first[j + k * stride], as bits
+    auto decodeColumn = [&](uint64_t bytes, auto* first, size_t stride) {
+        encoded.resize(bytes);
+        if (!encoded.empty() && fread(encoded.data(), 1, encoded.size(), file) != encoded.size()) return false;
+        const uint8_t* p = encoded.data();
+        const uint8_t* end = p + encoded.size();
+        for (size_t j = 0; j < particles; ++j) {
+            uint32_t prev = 0;
+            for (uint32_t k = 0; k < count; ++k) {
+                uint32_t zigzag;
+                if (!getVarint(p, end, zigzag)) return false;
+                prev += (zigzag >> 1) ^ (0u - (zigzag & 1));
+                memcpy(&first[j + k * stride], &prev, sizeof(uint32_t));
+            }
+        }
+        return true;
+    };
+    size_t frameStride = trajectoryFields * particles;
+    chunk.values.resize(count * frameStride);
+    for (uint32_t f = 0; f < trajectoryFields; ++f) {
+        if (!decodeColumn(header.columnBytes[f], chunk.values.data() + f * particles, frameStride)) return false;
+    }
+    chunk.generation.resize(count * particles);
+    return decodeColumn(header.generationBytes, chunk.generation.data(), particles);
+}
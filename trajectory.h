@@ -0,0 +1,153 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class DriftMonitor;
+struct ParticleSystem;
+
+// Trajectory stream: x, y and temp of a particle subset every `stride` steps.
+//
+// File = TrajectoryHeader, then chunks of up to framesPerChunk frames. A chunk is
+// a TrajectoryChunkHeader, (step, time, energy, angular momentum, energy
+// drift, angular momentum drift) for each frame, then one column per field
+// and the generation column. The four diagnostics are doubles, NaN on frames
+// whose step wasn't measured. Inside a column each particle's values run frame by frame, every value stored as the
+// LEB128 varint of the zigzagged difference of its float bits from the
+// previous frame's (previous starts at 0 in each chunk). Between frames a
+// particle barely moves, so the bit patterns differ by a small integer and most
+// values shrink to 2-3 bytes, and every chunk decodes on its own. Little-endian
+// throughout.
+//
+// ids get reused (ParticleSystem::takeId), so column j follows whatever particle
+// holds the id at the time: zeros while the id is free, then the next particle
+// handed it. The last column, coded the same way, has the id's generation per
+// frame. A change in it marks a new particle
+
+const uint32_t trajectoryVersion = 3;
+const uint32_t trajectoryFields = 3; // x, y, temp
+
+struct TrajectoryHeader {
+    char magic[8];              // "BHTRAJ\0\0"
+    uint32_t version;
+    uint32_t fields;
+    uint64_t particles;         // particles per frame
+    uint64_t subsetBegin;       // frame particle j is the one with id subsetBegin + j * subsetEvery
+    uint64_t subsetEvery;
+    uint32_t stride;            // steps between frames
+    uint32_t framesPerChunk;
+};
+
+struct TrajectoryChunkHeader {
+    uint32_t frames;
+    uint32_t generationBytes;   // the generation column, after the others
+    uint64_t columnBytes[trajectoryFields];
+};
+
+struct TrajectoryOptions {
+    uint32_t stride = 1;
+    size_t begin = 0;            // record particle ids [begin, end) taking every `every`th one
+    size_t end = SIZE_MAX;
+    size_t every = 1;
+    uint32_t framesPerChunk = 16;
+    size_t queueFrames = 8;      // frames that can wait for the writer before record() starts dropping
+    bool dropWhenFull = true;    // false makes record() wait for the writer instead, for batch runs that need every frame
+};
+
+// "BEGIN:END" or "BEGIN:END:EVERY" into the particle subset of options, for --traj-subset
+bool parseTrajectorySubset(const char* text, TrajectoryOptions& options);
+
+// Writes from its own thread. record() copies the subset into a free frame and
+// hands it over, it never waits on the disk: when the writer falls queueFrames
+// behind, frames are dropped and counted instead (unless dropWhenFull is off).
+// The first failed write is reported and stops the recording, the frames it
+// lost and every later one count as dropped
+class TrajectoryWriter {
+public:
+    TrajectoryWriter() = default;
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+    ~TrajectoryWriter() { close(); }
+
+    // idCount is how many ids exist, live or free (ParticleSystem::nextId), end is clamped to it
+    bool open(const char* path, size_t idCount, const TrajectoryOptions& options);
+    // Drains the queue, writes the last partial chunk and closes the file
+    void close();
+    bool isOpen() const { return file != nullptr; }
+
+    // Call after every step, frames are only taken when step % stride == 0.
+    // Diagnostics go along when the monitor was last given this step
+    void record(uint64_t step, double time, const ParticleSystem& ps, const DriftMonitor* diagnostics = nullptr);
+
+    // Frames in chunks that made it to the file, only settled once close() has returned
+    uint64_t framesWritten() const { return written; }
+    uint64_t framesDropped() const { return dropped; }
+
+private:
+    struct Frame {
+        uint64_t step;
+        double time;
+        double diagnostics[4];
+        std::vector<float> values; // fields x particles
+        std::vector<uint32_t> generation; // per particle
+    };
+
+    void run();
+    void flushChunk();
+    bool writeChunk();
+
+    FILE* file = nullptr;
+    std::string path;
+    TrajectoryOptions opts;
+    size_t particles = 0;
+
+    std::vector<Frame> frames;        // queueFrames slots, reused
+    std::deque<size_t> freeFrames, queued;
+    std::mutex queueMutex;
+    std::condition_variable queueCv;
+    bool stopping = false;
+    bool failed = false;              // a write failed, set by the writer thread
+    uint64_t written = 0, dropped = 0;
+
+    // writer thread only
+    std::vector<uint64_t> chunkSteps;
+    std::vector<double> chunkTimes;
+    std::vector<double> chunkDiagnostics; // 4 per frame
+    std::vector<uint32_t> chunkBits;  // [frame][field][particle]
+    std::vector<uint32_t> chunkGenerations; // [frame][particle]
+    std::vector<uint8_t> encoded;
+    std::thread worker;
+};
+
+// Decodes a trajectory file one chunk at a time, for analysis tools
+class TrajectoryReader {
+public:
+    struct Chunk {
+        std::vector<uint64_t> step;
+        std::vector<double> time;
+        std::vector<double> energy, angularMomentum;            // per unit particle mass
+        std::vector<double> energyDrift, angularMomentumDrift; // relative, see DriftMonitor
+        std::vector<float> values; // [frame][field][particle], same as the writer
+        std::vector<uint32_t> generation; // [frame][particle], see ParticleSystem::generation
+    };
+
+    ~TrajectoryReader() { if (file) fclose(file); }
+
+    bool open(const char* path);
+    const TrajectoryHeader& header() const { return head; }
+    // false at the end of the file or on a damaged chunk. Sizes are checked
+    // against what's left of the file before anything is allocated
+    bool next(Chunk& chunk);
+
+private:
+    FILE* file = nullptr;
+    uint64_t fileBytes = 0;
+    TrajectoryHeader head = {};
+    std::vector<uint8_t> encoded;
+};
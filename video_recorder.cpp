@@ -0,0 +1,197 @@
+#include "video_recorder.h"
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+// Frames allowed to queue up for the encoder before capture() waits on it.
+// The pool has two more: one being written out, one being filled
+static const size_t maxQueuedFrames = 4;
+static const size_t frameBuffers = maxQueuedFrames + 2;
+
+string VideoRecorder::ffmpegCommand(int width, int height, int fps, const string& output) {
+    // GL rows come bottom first, vflip puts them the right way up
+    return "ffmpeg -loglevel error -y -f rawvideo -pix_fmt rgba -s " + to_string(width) + "x" + to_string(height) +
+           " -r " + to_string(fps) + " -i - -vf vflip -c:v libx264 -pix_fmt yuv420p -crf 18 \"" + output + "\"";
+}
+
+bool VideoRecorder::create(int w, int h, const string& command, int ringSize) {
+    frameWidth = w;
+    frameHeight = h;
+    frameBytes = (size_t)w * h * 4;
+
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxSize);
+    if (w <= 0 || h <= 0 || w > maxSize || h > maxSize) {
+        cerr << "Video size " << w << "x" << h << " is outside what the driver allows (" << maxSize << ")\n";
+        return false;
+    }
+
+    glGenRenderbuffers(1, &colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (!complete) {
+        cerr << "Offscreen framebuffer is incomplete\n";
+        destroy();
+        return false;
+    }
+
+    pixelBuffers.resize(ringSize);
+    fences.assign(ringSize, nullptr);
+    glGenBuffers(ringSize, pixelBuffers.data());
+    for (GLuint pbo : pixelBuffers) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    nextSlot = 0;
+    captured = 0;
+
+    encoder = popen(command.c_str(), "w");
+    if (!encoder) {
+        cerr << "Failed to start encoder: " << command << "\n";
+        destroy();
+        return false;
+    }
+    // whole frames go out in one fwrite anyway. Unbuffered, every write happens
+    // on the encoder thread, pclose() has nothing left to flush
+    setvbuf(encoder, nullptr, _IONBF, 0);
+    frames.assign(frameBuffers, vector<uint8_t>(frameBytes));
+    queued.assign(maxQueuedFrames, 0);
+    queueHead = queueSize = 0;
+    spare.clear();
+    spare.reserve(frameBuffers);
+    for (size_t k = 0; k < frameBuffers; ++k) spare.push_back(k);
+    finishing = false;
+    encoderThread = thread(&VideoRecorder::runEncoder, this);
+    return true;
+}
+
+void VideoRecorder::destroy() {
+    // oldest first, so frames reach the encoder in order
+    for (size_t k = 0; k < fences.size(); ++k) collect((nextSlot + (int)k) % (int)fences.size());
+
+    if (encoder) {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            finishing = true;
+        }
+        queueCv.notify_all();
+        encoderThread.join();
+        pclose(encoder);
+        encoder = nullptr;
+    }
+    frames.clear();
+    queued.clear();
+    spare.clear();
+    queueHead = queueSize = 0;
+
+    if (!pixelBuffers.empty()) glDeleteBuffers((GLsizei)pixelBuffers.size(), pixelBuffers.data());
+    pixelBuffers.clear();
+    fences.clear();
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &colorBuffer);
+    framebuffer = colorBuffer = 0;
+}
+
+void VideoRecorder::bind() {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, frameWidth, frameHeight);
+}
+
+void VideoRecorder::capture() {
+    int slot = nextSlot;
+    collect(slot); // the frame from ringSize captures ago, finished by now
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[slot]);
+    glReadPixels(0, 0, frameWidth, frameHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr); // returns straight away
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    nextSlot = (slot + 1) % (int)pixelBuffers.size();
+    captured++;
+}
+
+void VideoRecorder::blitToScreen(int screenWidth, int screenHeight) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, frameWidth, frameHeight, 0, 0, screenWidth, screenHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, screenWidth, screenHeight);
+}
+
+void VideoRecorder::collect(int slot) {
+    if (slot >= (int)fences.size() || !fences[slot]) return;
+    glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    glDeleteSync(fences[slot]);
+    fences[slot] = nullptr;
+
+    if (!encoder) return;
+    size_t frame;
+    {
+        unique_lock<mutex> lock(queueMutex);
+        // encoder backpressure, with the pool sized as it is a spare buffer comes with room in the queue
+        queueCv.wait(lock, [&] { return queueSize < maxQueuedFrames && !spare.empty(); });
+        frame = spare.back();
+        spare.pop_back();
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[slot]);
+    const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameBytes, GL_MAP_READ_BIT);
+    if (pixels) {
+        memcpy(frames[frame].data(), pixels, frameBytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    {
+        lock_guard<mutex> lock(queueMutex);
+        if (pixels) {
+            queued[(queueHead + queueSize) % queued.size()] = frame;
+            queueSize++;
+        } else {
+            spare.push_back(frame);
+        }
+    }
+    queueCv.notify_all();
+}
+
+void VideoRecorder::runEncoder() {
+    // An encoder that quits early should show up as a write error, not kill us.
+    // SIGPIPE goes to the thread that wrote, so only this one blocks it
+    sigset_t pipe;
+    sigemptyset(&pipe);
+    sigaddset(&pipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe, nullptr);
+
+    bool failed = false;
+    unique_lock<mutex> lock(queueMutex);
+    while (true) {
+        queueCv.wait(lock, [&] { return queueSize > 0 || finishing; });
+        if (queueSize == 0) return;
+        size_t frame = queued[queueHead];
+        queueHead = (queueHead + 1) % queued.size();
+        queueSize--;
+        lock.unlock();
+        queueCv.notify_all();
+
+        const vector<uint8_t>& pixels = frames[frame];
+        if (!failed && fwrite(pixels.data(), 1, pixels.size(), encoder) != pixels.size()) {
+            cerr << "Encoder stopped taking frames\n";
+            failed = true; // keep draining so capture() never blocks on a dead encoder
+        }
+
+        lock.lock();
+        spare.push_back(frame);
+        queueCv.notify_all();
+    }
+}
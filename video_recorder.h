@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Offscreen render target that turns frames into a video.
+//
+// Frames are drawn into an FBO of any size. capture() starts an asynchronous
+// glReadPixels into the next pixel buffer of a ring and fences it; the buffer
+// is only mapped when the ring comes back round to it, by which time the copy
+// has long finished, so readback overlaps the following frames instead of
+// stalling on them. Mapped pixels are handed to a thread that writes them to
+// the encoder's stdin, raw RGBA bottom row first
+class VideoRecorder {
+public:
+    static const int defaultRing = 3;
+
+    // ffmpeg command line writing `output` from raw frames of this size
+    static std::string ffmpegCommand(int width, int height, int fps, const std::string& output);
+
+    // `command` is started with popen and fed frames on stdin
+    bool create(int width, int height, const std::string& command, int ringSize = defaultRing);
+    // Reads back every frame still in flight, then closes the encoder and waits for it
+    void destroy();
+
+    // Draw into the FBO from here on, viewport included
+    void bind();
+    // Start reading back what's been drawn since bind(), collecting the oldest frame in the ring
+    void capture();
+    // Scale the last frame onto the default framebuffer for a live preview
+    void blitToScreen(int screenWidth, int screenHeight);
+
+    int width() const { return frameWidth; }
+    int height() const { return frameHeight; }
+    uint64_t framesCaptured() const { return captured; }
+
+private:
+    void collect(int slot);
+    void runEncoder();
+
+    int frameWidth = 0, frameHeight = 0;
+    size_t frameBytes = 0;
+    GLuint framebuffer = 0, colorBuffer = 0;
+    std::vector<GLuint> pixelBuffers;
+    std::vector<GLsync> fences;       // null when that slot holds no frame
+    int nextSlot = 0;
+    uint64_t captured = 0;
+
+    // encoder side: a fixed pool of frame buffers allocated in create(), and
+    // indices into it for frames waiting to go down the pipe (a ring, oldest
+    // at queueHead) and buffers free to fill, so recording never allocates
+    FILE* encoder = nullptr;
+    std::thread encoderThread;
+    std::mutex queueMutex;
+    std::condition_variable queueCv;
+    std::vector<std::vector<uint8_t>> frames;
+    std::vector<size_t> queued, spare;
+    size_t queueHead = 0, queueSize = 0;
+    bool finishing = false;
+};